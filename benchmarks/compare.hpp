@@ -0,0 +1,259 @@
+#ifndef BENCHMARK_COMPARE_HPP
+#define BENCHMARK_COMPARE_HPP
+
+/**
+ * Regression gate against a recorded baseline.
+ *
+ * The baseline is a JSON report written by the benchmark runner. Every
+ * benchmark present in both runs is compared sample by sample with a
+ * one-sided Mann-Whitney U test, which doesn't assume normally distributed
+ * timings and isn't thrown off by a few outliers. A benchmark regressed
+ * when the test is significant and the median slowed down by more than the
+ * threshold, so neither noise nor tiny but consistent changes fail the gate.
+ *
+ */
+
+#include <harness.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace benchmark
+{
+    struct CompareOptions
+    {
+        double threshold = 5;               // allowed median slowdown in percent
+        double alpha = 0.01;                // significance level of the U test
+        std::vector<std::string> gates;     // name prefixes which fail the comparison
+    };
+
+    struct Comparison
+    {
+        std::string name;
+        double baseline = 0;    // median of the baseline in ns
+        double current = 0;     // median of the current run in ns
+        double change = 0;      // median change in percent
+        double p = 1;           // p-value of "current is slower"
+        bool gated = false;
+        bool regression = false;
+    };
+
+    /**
+     * Reads the raw samples of every benchmark from a JSON report.
+     *
+     * Only understands the layout written by @see Runner::writeJson.
+     */
+    inline bool load_baseline(const std::string &path, std::map<std::string, std::vector<double>> &baseline)
+    {
+        std::ifstream file(path);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        const auto json = buffer.str();
+
+        static const std::string name_key = "\"name\": \"";
+        static const std::string samples_key = "\"samples\": [";
+
+        std::size_t pos = 0;
+        while ((pos = json.find(name_key, pos)) != std::string::npos)
+        {
+            pos += name_key.size();
+            std::string name;
+            for (; pos < json.size() && json[pos] != '"'; ++pos)
+            {
+                if (json[pos] == '\\' && pos + 1 < json.size())
+                {
+                    ++pos;
+                }
+                name.push_back(json[pos]);
+            }
+
+            pos = json.find(samples_key, pos);
+            if (pos == std::string::npos)
+            {
+                return false;
+            }
+            pos += samples_key.size();
+
+            const auto end = json.find(']', pos);
+            if (end == std::string::npos)
+            {
+                return false;
+            }
+
+            std::vector<double> samples;
+            std::istringstream values(json.substr(pos, end - pos));
+            std::string value;
+            while (std::getline(values, value, ','))
+            {
+                try {
+                    samples.emplace_back(std::stod(value));
+                } catch (...) {
+                    return false;
+                }
+            }
+
+            baseline[name] = std::move(samples);
+            pos = end;
+        }
+
+        return !baseline.empty();
+    }
+
+    /**
+     * One-sided Mann-Whitney U test with tie correction.
+     *
+     * Returns the p-value of the hypothesis that samples of `current` tend to
+     * be larger than samples of `baseline`, using the normal approximation.
+     */
+    inline double mann_whitney_p(const std::vector<double> &baseline, const std::vector<double> &current)
+    {
+        const auto n1 = baseline.size();
+        const auto n2 = current.size();
+        if (n1 == 0 || n2 == 0)
+        {
+            return 1;
+        }
+
+        struct Sample
+        {
+            double value;
+            bool current;
+        };
+
+        std::vector<Sample> all;
+        all.reserve(n1 + n2);
+        for (auto&& value : baseline)
+        {
+            all.emplace_back(Sample{value, false});
+        }
+        for (auto&& value : current)
+        {
+            all.emplace_back(Sample{value, true});
+        }
+        std::sort(all.begin(), all.end(), [](const Sample &a, const Sample &b) {
+            return a.value < b.value;
+        });
+
+        // assign average ranks to ties
+        const auto n = static_cast<double>(all.size());
+        double rank_sum = 0;
+        double tie_term = 0;
+        for (std::size_t i = 0; i < all.size(); )
+        {
+            auto j = i;
+            while (j < all.size() && all[j].value == all[i].value)
+            {
+                ++j;
+            }
+
+            const auto rank = (static_cast<double>(i + 1) + static_cast<double>(j)) / 2;
+            for (auto k = i; k < j; ++k)
+            {
+                if (all[k].current)
+                {
+                    rank_sum += rank;
+                }
+            }
+
+            const auto t = static_cast<double>(j - i);
+            tie_term += t * t * t - t;
+            i = j;
+        }
+
+        const auto m1 = static_cast<double>(n1);
+        const auto m2 = static_cast<double>(n2);
+        const auto u = rank_sum - m2 * (m2 + 1) / 2;
+        const auto mean = m1 * m2 / 2;
+        const auto variance = m1 * m2 / 12 * ((n + 1) - tie_term / (n * (n - 1)));
+        if (variance <= 0)
+        {
+            return 1;
+        }
+
+        // continuity correction towards the mean
+        const auto z = (u - mean - 0.5) / std::sqrt(variance);
+        return 0.5 * std::erfc(z / std::sqrt(2.0));
+    }
+
+    /**
+     * Compares the current results against the baseline.
+     * Benchmarks missing in the baseline are skipped.
+     */
+    inline std::vector<Comparison> compare(const std::map<std::string, std::vector<double>> &baseline,
+                                           const std::vector<Result> &results, const CompareOptions &options)
+    {
+        std::vector<Comparison> comparisons;
+
+        for (auto&& result : results)
+        {
+            const auto it = baseline.find(result.name);
+            if (it == baseline.end() || it->second.empty())
+            {
+                continue;
+            }
+
+            auto sorted = it->second;
+            std::sort(sorted.begin(), sorted.end());
+
+            Comparison comparison;
+            comparison.name = result.name;
+            comparison.baseline = percentile(sorted, 50);
+            comparison.current = result.median;
+            comparison.change = comparison.baseline > 0 ? (comparison.current / comparison.baseline - 1) * 100 : 0;
+            comparison.p = mann_whitney_p(it->second, result.samples);
+            comparison.gated = std::any_of(options.gates.begin(), options.gates.end(), [&](const std::string &gate) {
+                return result.name.compare(0, gate.size(), gate) == 0;
+            });
+            comparison.regression = comparison.p < options.alpha && comparison.change > options.threshold;
+
+            comparisons.emplace_back(std::move(comparison));
+        }
+
+        return comparisons;
+    }
+
+    /**
+     * Prints the comparison and returns the number of gated regressions.
+     */
+    inline std::size_t print_comparison(const std::vector<Comparison> &comparisons, const CompareOptions &options)
+    {
+        fmt::print("\n{:<44} {:>12} {:>12} {:>9} {:>9}  {}\n",
+                   "benchmark", "baseline", "current", "change", "p", "verdict");
+
+        std::size_t failures = 0;
+        for (auto&& comparison : comparisons)
+        {
+            const char *verdict = "ok";
+            if (comparison.regression)
+            {
+                verdict = comparison.gated ? "REGRESSION" : "slower (not gated)";
+                failures += comparison.gated ? 1 : 0;
+            }
+            else if (comparison.p < options.alpha && comparison.change > 0)
+            {
+                verdict = "slower (within threshold)";
+            }
+
+            fmt::print("{:<44} {:>9.1f} ns {:>9.1f} ns {:>+8.1f}% {:>9.4f}  {}\n",
+                       comparison.name, comparison.baseline, comparison.current,
+                       comparison.change, comparison.p, verdict);
+        }
+
+        fmt::print("\n{} of {} compared benchmarks regressed by more than {}% (alpha {})\n",
+                   failures, comparisons.size(), options.threshold, options.alpha);
+        return failures;
+    }
+}
+
+#endif // BENCHMARK_COMPARE_HPP
@@ -0,0 +1,85 @@
+#include <harness.hpp>
+
+#include <otptoken.hpp>
+#include <private/basen.hpp>
+
+#include <ctime>
+#include <memory>
+
+namespace benchmark
+{
+    inline void register_otptoken_benchmarks(Runner &runner)
+    {
+        struct GenerateCase
+        {
+            const char *name;
+            OTPToken token;
+        };
+
+        const GenerateCase generate_cases[] = {
+            {"generate/TOTP/SHA1/6", OTPToken("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 6, 30, 0, OTPToken::TOTP, OTPToken::SHA1)},
+            {"generate/TOTP/SHA256/8", OTPToken("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZA", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA256)},
+            {"generate/TOTP/SHA512/8", OTPToken("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNA", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA512)},
+            {"generate/HOTP/SHA1/6", OTPToken("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 6, 0, 0, OTPToken::HOTP, OTPToken::SHA1)},
+            {"generate/Steam/SHA1/5", OTPToken("", "ABC30WAY33X57CCBU3EAXGDDMX35S39M", OTPToken::Steam)},
+        };
+
+        for (auto&& c : generate_cases)
+        {
+            runner.add(c.name, [token = c.token]{
+                return per_op([token, time = std::time_t(1536573862)]() mutable {
+                    char buffer[OTPToken::MaxTokenLength + 1];
+                    keep(token.generate(time, buffer));
+                    time += 30;
+                });
+            });
+        }
+
+        runner.add("generate/string/TOTP/SHA1/6", []{
+            OTPToken token("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 6, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+            return per_op([token, time = std::time_t(1536573862)]() mutable {
+                auto code = token.generate(time);
+                keep(code);
+                time += 30;
+            });
+        });
+
+        runner.add("serialize", []{
+            OTPToken token("label", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 6, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+            return per_op([token]{
+                auto data = token.serialize();
+                keep(data);
+            });
+        });
+
+        runner.add("deserialize", []{
+            const auto data = OTPToken("label", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 6, 30, 0, OTPToken::TOTP, OTPToken::SHA1).serialize();
+            return per_op([data]{
+                OTPToken token(data);
+                keep(token);
+            });
+        });
+
+        for (auto&& length : {32, 128, 1024})
+        {
+            runner.add(fmt::format("base32 decode/{}", length), [length]{
+                std::string input;
+                for (auto i = 0; i < length; ++i)
+                {
+                    input.push_back("ABCDEFGHIJKLMNOPQRSTUVWXYZ234567"[i % 32]);
+                }
+                auto out = std::make_shared<std::vector<unsigned char>>(BaseN::base32DecodedSize(input.size()));
+                return per_op([input, out]{
+                    keep(BaseN::base32Decode(input, out->data()));
+                });
+            });
+        }
+
+        runner.add("secret setup/SHA1/32", []{
+            return per_op([]{
+                OTPToken token("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 6, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+                keep(token.keyContext());
+            });
+        });
+    }
+}
@@ -0,0 +1,28 @@
+#include <harness.hpp>
+
+#include <qr/decoder.hpp>
+#include <qr/encoder.hpp>
+
+namespace benchmark
+{
+    inline void register_qr_benchmarks(Runner &runner, const std::string &assets_dir)
+    {
+        runner.add("qr/encode", []{
+            return per_op([]{
+                auto svg = QRCode::encode("otpauth://totp/Example:alice@google.com?secret=JBSWY3DPEHPK3PXP&issuer=Example");
+                keep(svg);
+            });
+        });
+
+        // decoding reads an image file on every run, just like the GUI import does
+        if (QRCode::supportsDecoding())
+        {
+            runner.add("qr/decode", [file = assets_dir + "/qrcode.png"]{
+                return per_op([file]{
+                    auto uri = QRCode::decode(file);
+                    keep(uri);
+                });
+            });
+        }
+    }
+}
@@ -0,0 +1,197 @@
+#include <harness.hpp>
+
+#include <tokenstore.hpp>
+
+#include <filesystem>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+#include <thread>
+
+namespace benchmark
+{
+    inline void fill_token_store(TokenStore &store, std::size_t count, std::size_t iconSize = 0)
+    {
+        static const OTPToken::Algorithm algorithms[] = {OTPToken::SHA1, OTPToken::SHA256, OTPToken::SHA512};
+
+        std::vector<OTPToken> tokens;
+        tokens.reserve(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            tokens.emplace_back(OTPToken(fmt::format("token {}", i), fmt::format("GEZDGNBVGY3TQOJQ{:016X}", i),
+                                         6, 30, 0, OTPToken::TOTP, algorithms[i % 3]));
+            if (iconSize > 0)
+            {
+                // distinct icons, the icon pool would share equal ones
+                OTPToken::Data icon(iconSize, static_cast<char>(i));
+                std::memcpy(icon.data(), &i, std::min(sizeof(i), iconSize));
+                tokens.back().setIcon(icon);
+            }
+        }
+        store.addTokens(tokens);
+    }
+
+    inline void register_tokenstore_benchmarks(Runner &runner, const std::string &output_dir)
+    {
+        for (auto&& count : {10, 100, 1000, 10000, 100000})
+        {
+            const auto file = fmt::format("{}/benchmark-{}.tks", output_dir, count);
+
+            runner.add(fmt::format("tokenstore/commit/{}", count), [file, count]{
+                std::filesystem::remove(file);
+                auto store = std::make_shared<TokenStore>(file, "password");
+                fill_token_store(*store, count);
+                return per_op([store]{
+                    keep(store->commit());
+                });
+            });
+
+            // time spent on the calling thread, the writer merges queued commits
+            runner.add(fmt::format("tokenstore/commit async/{}", count), [file, count]{
+                std::filesystem::remove(file);
+                auto store = std::make_shared<TokenStore>(file, "password");
+                fill_token_store(*store, count);
+                return per_op([store]{
+                    keep(store->commitAsync());
+                });
+            });
+
+            // a single changed HOTP counter, including the amortized journal compaction
+            runner.add(fmt::format("tokenstore/commit journaled/{}", count), [file, count]{
+                std::filesystem::remove(file);
+                std::filesystem::remove(file + ".journal");
+                auto store = std::make_shared<TokenStore>(file, "password", TokenStore::Journaled);
+                fill_token_store(*store, count);
+                store->addToken(OTPToken("hotp", "GEZDGNBVGY3TQOJQ", 6, 30, 0, OTPToken::HOTP, OTPToken::SHA1));
+                store->commit();
+                return per_op([store, handle = store->handle(store->size() - 1)]{
+                    auto token = *store->token(handle);
+                    token.setCounter(token.counter() + 1);
+                    store->updateToken(handle, token);
+                    keep(store->commit());
+                });
+            });
+
+            // a single changed HOTP counter in a loaded store, the other records are copied sealed
+            runner.add(fmt::format("tokenstore/commit loaded/{}", count), [file, count]{
+                std::filesystem::remove(file);
+                {
+                    TokenStore store(file, "password");
+                    fill_token_store(store, count);
+                    store.addToken(OTPToken("hotp", "GEZDGNBVGY3TQOJQ", 6, 30, 0, OTPToken::HOTP, OTPToken::SHA1));
+                    store.commit();
+                }
+                auto store = std::make_shared<TokenStore>(file, "password");
+                return per_op([store, handle = store->handleOf(OTPToken("hotp", "GEZDGNBVGY3TQOJQ", 6, 30, 0, OTPToken::HOTP, OTPToken::SHA1))]{
+                    auto token = *store->token(handle);
+                    token.setCounter(token.counter() + 1);
+                    store->updateToken(handle, token);
+                    keep(store->commit());
+                });
+            });
+
+            runner.add(fmt::format("tokenstore/load/{}", count), [file, count]{
+                {
+                    std::filesystem::remove(file);
+                    TokenStore store(file, "password");
+                    fill_token_store(store, count);
+                    store.commit();
+                }
+                return per_op([file]{
+                    TokenStore store(file, "password");
+                    keep(store.size());
+                });
+            });
+
+            // unlocking doesn't decrypt icons, 4 KiB each
+            if (count <= 10000)
+            {
+                runner.add(fmt::format("tokenstore/load icons/{}", count), [file, count]{
+                    {
+                        std::filesystem::remove(file);
+                        TokenStore store(file, "password");
+                        fill_token_store(store, count, 4096);
+                        store.commit();
+                    }
+                    return per_op([file]{
+                        TokenStore store(file, "password");
+                        keep(store.size());
+                    });
+                });
+            }
+
+            runner.add(fmt::format("tokenstore/add/{}", count), [count]{
+                std::vector<OTPToken> tokens;
+                for (auto i = 0; i < count; ++i)
+                {
+                    tokens.emplace_back(OTPToken(fmt::format("token {}", i), "GEZDGNBVGY3TQOJQ", OTPToken::TOTP, OTPToken::SHA1));
+                }
+                return per_op([tokens]{
+                    TokenStore store;
+                    keep(store.addTokens(tokens));
+                });
+            });
+
+            // queries after the first one, which builds the label index
+            for (auto&& [name, match, query] : {
+                    std::make_tuple("exact", TokenStore::ExactLabel, "TOKEN 4242"),
+                    std::make_tuple("prefix", TokenStore::LabelPrefix, "token 42"),
+                    std::make_tuple("substring", TokenStore::LabelSubstring, "n 42"),
+                    std::make_tuple("substring short", TokenStore::LabelSubstring, "7"),
+                })
+            {
+                runner.add(fmt::format("tokenstore/find label {}/{}", name, count), [count, match = match, query = query]{
+                    auto store = std::make_shared<TokenStore>();
+                    fill_token_store(*store, count);
+                    store->findByLabel(query, match);
+                    return per_op([store, match, query]{
+                        auto handles = store->findByLabel(query, match);
+                        keep(handles);
+                    });
+                });
+            }
+
+            runner.add(fmt::format("tokenstore/generate all/{}", count), [count]{
+                auto store = std::make_shared<TokenStore>();
+                fill_token_store(*store, count);
+                auto codes = std::make_shared<TokenStore::GeneratedCodes>();
+                return per_op([store, codes, time = std::time_t(1536573862)]() mutable {
+                    store->generateAll(time, *codes);
+                    keep(codes->codes.data());
+                    time += 30;
+                });
+            });
+        }
+
+        // sealing and opening everything, 10000 tokens with 4 KiB icons, from one thread up to one per core
+        const auto cores = std::max(1U, std::thread::hardware_concurrency());
+        for (auto threads = 1U; threads <= cores; threads = threads < cores ? std::min(threads * 2, cores) : cores + 1)
+        {
+            const auto file = fmt::format("{}/benchmark-threads-{}.tks", output_dir, threads);
+
+            runner.add(fmt::format("tokenstore/commit threads/{}", threads), [file, threads]{
+                std::filesystem::remove(file);
+                auto store = std::make_shared<TokenStore>(file, "password", TokenStore::Snapshot, TokenStore::ProgressCallback(), threads);
+                fill_token_store(*store, 10000, 4096);
+                return per_op([store]{
+                    keep(store->commit());
+                });
+            });
+
+            runner.add(fmt::format("tokenstore/load threads/{}", threads), [file, threads]{
+                {
+                    std::filesystem::remove(file);
+                    TokenStore store(file, "password");
+                    fill_token_store(store, 10000, 4096);
+                    store.commit();
+                }
+                return per_op([file, threads]{
+                    TokenStore store(file, "password", TokenStore::Snapshot, {}, threads);
+                    store.prefetchIcons();
+                    keep(store.size());
+                });
+            });
+        }
+    }
+}
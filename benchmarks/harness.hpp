@@ -0,0 +1,338 @@
+#ifndef BENCHMARK_HARNESS_HPP
+#define BENCHMARK_HARNESS_HPP
+
+/**
+ * Microbenchmark harness of the core library.
+ *
+ * Every benchmark is calibrated to a batch of iterations which runs for
+ * roughly the configured sample time, warmed up and then measured as a
+ * series of independent samples. The per-operation time of every sample
+ * is kept, so results can be summarized as min/median/p99 and compared
+ * between builds with a proper statistical test instead of a single
+ * wall clock reading.
+ *
+ * Heap allocations are counted with the replaced global operator new,
+ * include `allocation_counter.hpp` exactly once in the executable.
+ *
+ */
+
+#include <allocation_counter.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace benchmark
+{
+    /**
+     * Prevents the compiler from optimizing away a computed value.
+     */
+    template<typename T>
+    inline void keep(T &&value)
+    {
+#if defined(__GNUC__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile const void *sink;
+        sink = &value;
+#endif
+    }
+
+    // runs the measured operation the given number of times
+    using Batch = std::function<void(std::size_t iterations)>;
+
+    /**
+     * Turns a single operation into a batch, the operation is inlined
+     * into the loop so the indirect call happens once per batch.
+     */
+    template<typename Operation>
+    inline Batch per_op(Operation op)
+    {
+        return [op](std::size_t iterations) mutable {
+            for (std::size_t i = 0; i < iterations; ++i)
+            {
+                op();
+            }
+        };
+    }
+
+    struct Options
+    {
+        std::size_t samples = 50;       // samples per benchmark
+        std::size_t minSamples = 5;     // lower bound when the time budget is exceeded
+        double sampleMs = 10;           // target duration of a single sample
+        double warmupMs = 100;          // warmup duration before sampling
+        double budgetMs = 5000;         // time budget per benchmark
+        std::string filter;             // only run benchmarks whose name contains this
+        std::string json;               // path of the JSON report, empty to skip
+    };
+
+    struct Result
+    {
+        std::string name;
+        std::size_t iterations = 0;     // iterations per sample
+        std::vector<double> samples;    // nanoseconds per operation
+        double allocations = 0;         // heap allocations per operation
+
+        double min = 0;
+        double median = 0;
+        double p99 = 0;
+        double mean = 0;
+        double stddev = 0;
+    };
+
+    /**
+     * Returns the given percentile of sorted samples with linear interpolation.
+     */
+    inline double percentile(const std::vector<double> &sorted, double p)
+    {
+        if (sorted.empty())
+        {
+            return 0;
+        }
+
+        const auto rank = p / 100.0 * static_cast<double>(sorted.size() - 1);
+        const auto lower = static_cast<std::size_t>(rank);
+        const auto upper = std::min(lower + 1, sorted.size() - 1);
+        const auto weight = rank - static_cast<double>(lower);
+        return sorted[lower] + (sorted[upper] - sorted[lower]) * weight;
+    }
+
+    class Runner
+    {
+    public:
+        Runner(const Options &options)
+            : _options(options)
+        {
+        }
+
+        /**
+         * Registers a benchmark. The setup runs only when the benchmark is
+         * selected and returns the batch to measure, everything captured by
+         * the batch is prepared outside of the measurement.
+         */
+        void add(const std::string &name, std::function<Batch()> setup)
+        {
+            this->_cases.emplace_back(Case{name, std::move(setup)});
+        }
+
+        /**
+         * Runs all selected benchmarks and prints a summary line per benchmark.
+         */
+        const std::vector<Result> &run()
+        {
+            fmt::print("{:<44} {:>8} {:>12} {:>12} {:>12} {:>10}\n",
+                       "benchmark", "samples", "min", "median", "p99", "allocs/op");
+
+            for (auto&& c : this->_cases)
+            {
+                if (!this->_options.filter.empty() && c.name.find(this->_options.filter) == std::string::npos)
+                {
+                    continue;
+                }
+
+                auto batch = c.setup();
+                auto result = this->measure(c.name, batch);
+
+                fmt::print("{:<44} {:>8} {:>12} {:>12} {:>12} {:>10.2f}\n",
+                           result.name, result.samples.size(),
+                           format_time(result.min), format_time(result.median), format_time(result.p99),
+                           result.allocations);
+                std::fflush(stdout);
+
+                this->_results.emplace_back(std::move(result));
+            }
+
+            return this->_results;
+        }
+
+        /**
+         * Writes the results as JSON, including the raw samples.
+         */
+        bool writeJson(const std::string &path, const std::string &buildType) const
+        {
+            auto file = std::fopen(path.c_str(), "w");
+            if (!file)
+            {
+                return false;
+            }
+
+            fmt::print(file, "{{\n");
+            fmt::print(file, "  \"context\": {{\n");
+            fmt::print(file, "    \"compiler\": \"{}\",\n", escape(compiler()));
+            fmt::print(file, "    \"build_type\": \"{}\",\n", escape(buildType));
+            fmt::print(file, "    \"timestamp\": {},\n",
+                       std::chrono::duration_cast<std::chrono::seconds>(
+                           std::chrono::system_clock::now().time_since_epoch()).count());
+            fmt::print(file, "    \"sample_ms\": {},\n", this->_options.sampleMs);
+            fmt::print(file, "    \"warmup_ms\": {}\n", this->_options.warmupMs);
+            fmt::print(file, "  }},\n");
+            fmt::print(file, "  \"benchmarks\": [");
+
+            for (std::size_t i = 0; i < this->_results.size(); ++i)
+            {
+                const auto &result = this->_results[i];
+                fmt::print(file, "{}\n    {{\n", i == 0 ? "" : ",");
+                fmt::print(file, "      \"name\": \"{}\",\n", escape(result.name));
+                fmt::print(file, "      \"unit\": \"ns\",\n");
+                fmt::print(file, "      \"iterations\": {},\n", result.iterations);
+                fmt::print(file, "      \"min\": {:.3f},\n", result.min);
+                fmt::print(file, "      \"median\": {:.3f},\n", result.median);
+                fmt::print(file, "      \"p99\": {:.3f},\n", result.p99);
+                fmt::print(file, "      \"mean\": {:.3f},\n", result.mean);
+                fmt::print(file, "      \"stddev\": {:.3f},\n", result.stddev);
+                fmt::print(file, "      \"allocations_per_op\": {:.3f},\n", result.allocations);
+                fmt::print(file, "      \"samples\": [");
+                for (std::size_t s = 0; s < result.samples.size(); ++s)
+                {
+                    fmt::print(file, "{}{:.3f}", s == 0 ? "" : ", ", result.samples[s]);
+                }
+                fmt::print(file, "]\n    }}");
+            }
+
+            fmt::print(file, "\n  ]\n}}\n");
+            return std::fclose(file) == 0;
+        }
+
+    private:
+        struct Case
+        {
+            std::string name;
+            std::function<Batch()> setup;
+        };
+
+        using clock = std::chrono::steady_clock;
+
+        static double elapsed_ns(const clock::time_point &start)
+        {
+            return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        }
+
+        Result measure(const std::string &name, Batch &batch) const
+        {
+            const auto sample_ns = this->_options.sampleMs * 1e6;
+
+            // calibrate: grow the batch until it takes a noticeable fraction of a sample
+            std::size_t iterations = 1;
+            double batch_ns = 0;
+            for (;;)
+            {
+                const auto start = clock::now();
+                batch(iterations);
+                batch_ns = elapsed_ns(start);
+
+                if (batch_ns >= sample_ns / 10 || iterations >= (std::size_t(1) << 30))
+                {
+                    break;
+                }
+                iterations *= batch_ns < sample_ns / 1000 ? 16 : 2;
+            }
+
+            const auto op_ns = std::max(batch_ns / static_cast<double>(iterations), 1.0);
+            iterations = std::max<std::size_t>(1, static_cast<std::size_t>(sample_ns / op_ns));
+
+            // warmup caches, branch predictors and lazily built state
+            const auto warmup = clock::now();
+            while (elapsed_ns(warmup) < this->_options.warmupMs * 1e6)
+            {
+                batch(iterations);
+            }
+
+            // slow benchmarks are sampled less often to stay within the budget
+            auto samples = this->_options.samples;
+            const auto estimated_ns = op_ns * static_cast<double>(iterations * samples);
+            if (estimated_ns > this->_options.budgetMs * 1e6)
+            {
+                samples = std::max(this->_options.minSamples,
+                    static_cast<std::size_t>(this->_options.budgetMs * 1e6 / (op_ns * static_cast<double>(iterations))));
+            }
+
+            Result result;
+            result.name = name;
+            result.iterations = iterations;
+            result.samples.reserve(samples);
+
+            const auto allocations = allocation_counter::count();
+            for (std::size_t i = 0; i < samples; ++i)
+            {
+                const auto start = clock::now();
+                batch(iterations);
+                result.samples.emplace_back(elapsed_ns(start) / static_cast<double>(iterations));
+            }
+            const auto total_ops = static_cast<double>(iterations * samples);
+            result.allocations = static_cast<double>(allocation_counter::count() - allocations) / total_ops;
+
+            auto sorted = result.samples;
+            std::sort(sorted.begin(), sorted.end());
+            result.min = sorted.front();
+            result.median = percentile(sorted, 50);
+            result.p99 = percentile(sorted, 99);
+            result.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / static_cast<double>(sorted.size());
+
+            double variance = 0;
+            for (auto&& sample : sorted)
+            {
+                variance += (sample - result.mean) * (sample - result.mean);
+            }
+            result.stddev = sorted.size() > 1 ? std::sqrt(variance / static_cast<double>(sorted.size() - 1)) : 0;
+
+            return result;
+        }
+
+        static std::string format_time(double ns)
+        {
+            if (ns < 1e3)
+            {
+                return fmt::format("{:.1f} ns", ns);
+            }
+            else if (ns < 1e6)
+            {
+                return fmt::format("{:.2f} us", ns / 1e3);
+            }
+            else if (ns < 1e9)
+            {
+                return fmt::format("{:.2f} ms", ns / 1e6);
+            }
+            return fmt::format("{:.3f} s", ns / 1e9);
+        }
+
+        static std::string compiler()
+        {
+#if defined(__clang__)
+            return fmt::format("clang {}.{}.{}", __clang_major__, __clang_minor__, __clang_patchlevel__);
+#elif defined(__GNUC__)
+            return fmt::format("gcc {}.{}.{}", __GNUC__, __GNUC_MINOR__, __GNUC_PATCHLEVEL__);
+#else
+            return "unknown";
+#endif
+        }
+
+        static std::string escape(const std::string &str)
+        {
+            std::string escaped;
+            escaped.reserve(str.size());
+            for (auto&& c : str)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    escaped.push_back('\\');
+                }
+                escaped.push_back(c);
+            }
+            return escaped;
+        }
+
+        const Options _options;
+        std::vector<Case> _cases;
+        std::vector<Result> _results;
+    };
+}
+
+#endif // BENCHMARK_HARNESS_HPP
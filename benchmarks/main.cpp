@@ -0,0 +1,147 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fmt/printf.h>
+
+#include "core_benchmarks/otptoken_benchmarks.hpp"
+#include "core_benchmarks/tokenstore_benchmarks.hpp"
+#include "core_benchmarks/qr_benchmarks.hpp"
+
+#include <compare.hpp>
+
+// hot paths which fail the baseline comparison on regressions by default
+static const std::vector<std::string> default_gates = {
+    "generate/",
+    "tokenstore/load/",
+    "tokenstore/commit/",
+    "qr/decode",
+};
+
+static void print_usage(const char *program)
+{
+    fmt::print("Usage: {} [options]\n\n", program);
+    fmt::print("  --filter=<text>     only run benchmarks whose name contains text\n");
+    fmt::print("  --json=<file>       write the results including all samples to file\n");
+    fmt::print("  --samples=<n>       number of samples per benchmark (default: 50)\n");
+    fmt::print("  --sample-ms=<ms>    target duration of a single sample (default: 10)\n");
+    fmt::print("  --warmup-ms=<ms>    warmup duration per benchmark (default: 100)\n");
+    fmt::print("  --budget-ms=<ms>    time budget per benchmark (default: 5000)\n");
+    fmt::print("  --compare=<file>    compare against a baseline JSON report, fails on regressions\n");
+    fmt::print("  --threshold=<pct>   allowed median slowdown of gated benchmarks (default: 5)\n");
+    fmt::print("  --alpha=<p>         significance level of the regression test (default: 0.01)\n");
+    fmt::print("  --gate=<prefix>     gate benchmarks starting with prefix, can be repeated\n");
+    fmt::print("                      (default: generate/, tokenstore/load/, tokenstore/commit/, qr/decode)\n");
+}
+
+static bool parse_option(const char *arg, const char *name, std::string &value)
+{
+    const auto length = std::strlen(name);
+    if (std::strncmp(arg, name, length) == 0 && arg[length] == '=')
+    {
+        value = arg + length + 1;
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    benchmark::Options options;
+    benchmark::CompareOptions compare_options;
+    std::string baseline_path;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string value;
+        try {
+            if (parse_option(argv[i], "--filter", value))
+            {
+                options.filter = value;
+            }
+            else if (parse_option(argv[i], "--json", value))
+            {
+                options.json = value;
+            }
+            else if (parse_option(argv[i], "--samples", value))
+            {
+                options.samples = std::max<std::size_t>(1, std::stoul(value));
+                options.minSamples = std::min(options.minSamples, options.samples);
+            }
+            else if (parse_option(argv[i], "--sample-ms", value))
+            {
+                options.sampleMs = std::stod(value);
+            }
+            else if (parse_option(argv[i], "--warmup-ms", value))
+            {
+                options.warmupMs = std::stod(value);
+            }
+            else if (parse_option(argv[i], "--budget-ms", value))
+            {
+                options.budgetMs = std::stod(value);
+            }
+            else if (parse_option(argv[i], "--compare", value))
+            {
+                baseline_path = value;
+            }
+            else if (parse_option(argv[i], "--threshold", value))
+            {
+                compare_options.threshold = std::stod(value);
+            }
+            else if (parse_option(argv[i], "--alpha", value))
+            {
+                compare_options.alpha = std::stod(value);
+            }
+            else if (parse_option(argv[i], "--gate", value))
+            {
+                compare_options.gates.emplace_back(value);
+            }
+            else
+            {
+                print_usage(argv[0]);
+                return std::strcmp(argv[i], "--help") == 0 ? 0 : 1;
+            }
+        } catch (...) {
+            fmt::print(stderr, "Invalid value for {}\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (compare_options.gates.empty())
+    {
+        compare_options.gates = default_gates;
+    }
+
+    // load the baseline first, no point in running the suite without it
+    std::map<std::string, std::vector<double>> baseline;
+    if (!baseline_path.empty() && !benchmark::load_baseline(baseline_path, baseline))
+    {
+        fmt::print(stderr, "Failed to read the baseline {}\n", baseline_path);
+        fmt::print(stderr, "Record one with the bench-baseline target on the reference machine.\n");
+        return 2;
+    }
+
+    benchmark::Runner runner(options);
+    benchmark::register_otptoken_benchmarks(runner);
+    benchmark::register_tokenstore_benchmarks(runner, BENCHMARK_OUTPUT_DIR);
+    benchmark::register_qr_benchmarks(runner, BENCHMARK_ASSETS_DIR);
+
+    const auto &results = runner.run();
+
+    if (!options.json.empty() && !runner.writeJson(options.json, BENCHMARK_BUILD_TYPE))
+    {
+        fmt::print(stderr, "Failed to write {}\n", options.json);
+        return 1;
+    }
+
+    if (!baseline_path.empty())
+    {
+        const auto comparisons = benchmark::compare(baseline, results, compare_options);
+        if (benchmark::print_comparison(comparisons, compare_options) != 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "clock.hpp"
+
+#include <time.h>
+
+std::uint32_t Clock::remainingValidity(std::uint32_t period) const
+{
+    if (period == 0)
+    {
+        return 0;
+    }
+
+    const auto now = static_cast<std::uint64_t>(this->now());
+    return period - static_cast<std::uint32_t>(now % period);
+}
+
+Clock &Clock::system()
+{
+    static SystemClock clock;
+    return clock;
+}
+
+std::time_t SystemClock::read() const
+{
+#if defined(CLOCK_REALTIME_COARSE)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0)
+    {
+        return ts.tv_sec;
+    }
+#endif
+    return std::time(nullptr);
+}
+
+CachedClock::CachedClock(const Clock &source)
+    : _source(source),
+      _epoch(source.now())
+{
+}
+
+std::time_t CachedClock::tick()
+{
+    const auto epoch = this->_source.now();
+    this->_epoch.store(epoch, std::memory_order_relaxed);
+    return epoch + this->skew();
+}
+
+std::time_t CachedClock::read() const
+{
+    return this->_epoch.load(std::memory_order_relaxed);
+}
+
+FakeClock::FakeClock(std::time_t time)
+    : _time(time)
+{
+}
+
+std::time_t FakeClock::read() const
+{
+    return this->_time.load(std::memory_order_relaxed);
+}
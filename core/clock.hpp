@@ -0,0 +1,131 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+/**
+ * Time source for token generation.
+ *
+ * All token computations derive their time step from a clock, so the
+ * skew of hosts with a known drift can be corrected in one place and
+ * tests can run against a deterministic time.
+ *
+ * The skew in seconds is added to every time read from the source.
+ * All methods are thread-safe.
+ */
+class Clock
+{
+public:
+    Clock() = default;
+    virtual ~Clock() = default;
+
+    Clock(const Clock &) = delete;
+    Clock &operator= (const Clock &) = delete;
+
+    /**
+     * Returns the current UNIX time including the skew.
+     */
+    inline std::time_t now() const
+    {
+        return this->read() + this->_skew.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets the skew in seconds which is added to the time source.
+     * Use a negative value for clocks which are ahead.
+     */
+    inline void setSkew(std::int64_t seconds)
+    {
+        this->_skew.store(seconds, std::memory_order_relaxed);
+    }
+
+    inline std::int64_t skew() const
+    {
+        return this->_skew.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the seconds until the time step of the given period ends,
+     * between 1 and period. Returns 0 on a zero period.
+     */
+    std::uint32_t remainingValidity(std::uint32_t period) const;
+
+    /**
+     * Returns the system clock shared by the entire application.
+     */
+    static Clock &system();
+
+protected:
+    /**
+     * Reads the current UNIX time from the time source.
+     */
+    virtual std::time_t read() const = 0;
+
+private:
+    std::atomic<std::int64_t> _skew = 0;
+};
+
+/**
+ * The real time clock of the system.
+ *
+ * Uses the coarse real time clock where available, which doesn't
+ * need a system call and is precise enough for second resolution.
+ */
+class SystemClock : public Clock
+{
+protected:
+    std::time_t read() const override;
+};
+
+/**
+ * Caches the time of another clock until the next tick.
+ *
+ * Meant for refreshing many tokens at once, the source is read once per
+ * @see tick and every token of that refresh sees the exact same time.
+ */
+class CachedClock : public Clock
+{
+public:
+    CachedClock(const Clock &source = Clock::system());
+
+    /**
+     * Reads the source clock and caches the result, which is returned.
+     */
+    std::time_t tick();
+
+protected:
+    std::time_t read() const override;
+
+private:
+    const Clock &_source;
+    std::atomic<std::time_t> _epoch;
+};
+
+/**
+ * A clock which only moves when told to, for tests.
+ */
+class FakeClock : public Clock
+{
+public:
+    FakeClock(std::time_t time = 0);
+
+    inline void set(std::time_t time)
+    {
+        this->_time.store(time, std::memory_order_relaxed);
+    }
+
+    inline void advance(std::time_t seconds)
+    {
+        this->_time.fetch_add(seconds, std::memory_order_relaxed);
+    }
+
+protected:
+    std::time_t read() const override;
+
+private:
+    std::atomic<std::time_t> _time;
+};
+
+#endif // CLOCK_HPP
@@ -0,0 +1,269 @@
+#include "codeschedule.hpp"
+#include "private/otpgen.hpp"
+
+#include <chrono>
+
+namespace
+{
+    // wake up interval of the background refill when there is nothing scheduled
+    static const constexpr std::time_t IDLE_INTERVAL = 60;
+}
+
+CodeSchedule::CodeSchedule(std::size_t lookAhead)
+    : _lookAhead(lookAhead)
+{
+}
+
+CodeSchedule::CodeSchedule(const TokenStore &store, std::size_t lookAhead)
+    : CodeSchedule(lookAhead)
+{
+    this->assign(store);
+}
+
+CodeSchedule::~CodeSchedule()
+{
+    this->stop();
+}
+
+void CodeSchedule::assign(const TokenStore &store)
+{
+    std::vector<Entry> entries;
+    std::unordered_map<TokenStore::Handle, std::size_t> index;
+    entries.reserve(store.size());
+
+    for (std::size_t i = 0; i < store.size(); ++i)
+    {
+        Entry entry;
+        if (this->makeEntry(store[i], entry))
+        {
+            index.emplace(store.handle(i), entries.size());
+            entries.emplace_back(std::move(entry));
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_entries = std::move(entries);
+        this->_index = std::move(index);
+        this->_store = &store;
+    }
+
+    // let the background refill compute the new tokens right away
+    this->_wakeup.notify_all();
+}
+
+void CodeSchedule::clear()
+{
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_entries.clear();
+    this->_index.clear();
+    this->_store = nullptr;
+}
+
+void CodeSchedule::refill(const std::time_t &time)
+{
+    // lock per token so lookups never wait for the entire schedule
+    for (std::size_t i = 0; ; ++i)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        if (i >= this->_entries.size())
+        {
+            break;
+        }
+
+        auto &entry = this->_entries[i];
+        const auto current = static_cast<std::uint64_t>(time / entry.period);
+        for (auto step = current; step <= current + this->_lookAhead; ++step)
+        {
+            if (entry.slots[step % entry.slots.size()].step != step)
+            {
+                this->fill(entry, step);
+            }
+        }
+    }
+}
+
+void CodeSchedule::setClock(const Clock &clock)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_clock = &clock;
+    }
+    this->_wakeup.notify_all();
+}
+
+void CodeSchedule::start()
+{
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    if (this->_running)
+    {
+        return;
+    }
+
+    this->_running = true;
+    this->_worker = std::thread(&CodeSchedule::run, this);
+}
+
+void CodeSchedule::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_running = false;
+    }
+    this->_wakeup.notify_all();
+
+    if (this->_worker.joinable())
+    {
+        this->_worker.join();
+    }
+}
+
+std::size_t CodeSchedule::code(TokenStore::Handle handle, const std::time_t &time, std::span<char> buffer)
+{
+    std::unique_lock<std::mutex> lock(this->_mutex);
+
+    const auto *token = this->_store ? this->_store->token(handle) : nullptr;
+    if (!token)
+    {
+        if (!buffer.empty())
+        {
+            buffer[0] = '\0';
+        }
+        return 0;
+    }
+
+    auto it = this->_index.find(handle);
+    if (it != this->_index.end() && this->_entries[it->second].fingerprint != token->fingerprint())
+    {
+        // the token changed since assign
+        Entry entry;
+        if (this->makeEntry(*token, entry))
+        {
+            this->_entries[it->second] = std::move(entry);
+        }
+        else
+        {
+            this->_index.erase(it);
+            it = this->_index.end();
+        }
+    }
+
+    if (it == this->_index.end())
+    {
+        lock.unlock();
+        return token->generate(time, buffer);
+    }
+
+    auto &entry = this->_entries[it->second];
+    const auto step = static_cast<std::uint64_t>(time / entry.period);
+    auto &slot = entry.slots[step % entry.slots.size()];
+    if (slot.step != step)
+    {
+        this->fill(entry, step);
+    }
+
+    if (buffer.size() < slot.length + 1U)
+    {
+        return 0;
+    }
+
+    std::copy(slot.code, slot.code + slot.length + 1, buffer.data());
+    return slot.length;
+}
+
+const std::string CodeSchedule::code(TokenStore::Handle handle, const std::time_t &time)
+{
+    char buffer[OTPToken::MaxTokenLength + 1];
+    const auto length = this->code(handle, time, buffer);
+    return std::string(buffer, buffer + length);
+}
+
+bool CodeSchedule::isScheduled(TokenStore::Handle handle, const std::time_t &time) const
+{
+    std::lock_guard<std::mutex> lock(this->_mutex);
+
+    const auto *token = this->_store ? this->_store->token(handle) : nullptr;
+    const auto it = this->_index.find(handle);
+    if (!token || it == this->_index.end() || this->_entries[it->second].fingerprint != token->fingerprint())
+    {
+        return false;
+    }
+
+    const auto &entry = this->_entries[it->second];
+    const auto step = static_cast<std::uint64_t>(time / entry.period);
+    return entry.slots[step % entry.slots.size()].step == step;
+}
+
+std::size_t CodeSchedule::size() const
+{
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    return this->_index.size();
+}
+
+bool CodeSchedule::makeEntry(const OTPToken &token, Entry &entry) const
+{
+    if (!token.isValid() || token.type() == OTPToken::HOTP)
+    {
+        return false;
+    }
+
+    entry.type = token.type();
+    entry.period = token.type() == OTPToken::Steam ? STEAM_PERIOD : token.period();
+    entry.digits = token.type() == OTPToken::Steam ? STEAM_DIGITS : token.digits();
+
+    if (!check_period(entry.period) || !check_otp_length(entry.digits))
+    {
+        return false;
+    }
+
+    entry.context = token.keyContext();
+    if (entry.context.error != OTPToken::Valid)
+    {
+        return false;
+    }
+
+    entry.fingerprint = token.fingerprint();
+    entry.slots.resize(this->_lookAhead + 1);
+    return true;
+}
+
+void CodeSchedule::fill(Entry &entry, const std::uint64_t &step)
+{
+    auto &slot = entry.slots[step % entry.slots.size()];
+    slot.length = static_cast<std::uint8_t>(write_token(entry.context, entry.type, step, entry.digits, slot.code));
+    slot.code[slot.length] = '\0';
+    slot.step = step;
+}
+
+std::time_t CodeSchedule::nextBoundary(const std::time_t &time) const
+{
+    auto next = time + IDLE_INTERVAL;
+    for (auto&& entry : this->_entries)
+    {
+        const auto period = static_cast<std::time_t>(entry.period);
+        next = std::min(next, (time / period + 1) * period);
+    }
+    return next;
+}
+
+void CodeSchedule::run()
+{
+    // the first refill always runs, see start
+    std::unique_lock<std::mutex> lock(this->_mutex);
+    do
+    {
+        const auto &clock = *this->_clock;
+        lock.unlock();
+        this->refill(clock.now());
+        lock.lock();
+
+        if (!this->_running)
+        {
+            break;
+        }
+
+        // woken up early by assign, setClock and stop, spurious wake ups just refill again
+        const auto now = this->_clock->now();
+        this->_wakeup.wait_for(lock, std::chrono::seconds(this->nextBoundary(now) - now));
+    } while (this->_running);
+}
@@ -0,0 +1,176 @@
+#ifndef CODESCHEDULE_HPP
+#define CODESCHEDULE_HPP
+
+#include <string>
+#include <vector>
+#include <span>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#include "otptoken.hpp"
+#include "tokenstore.hpp"
+#include "clock.hpp"
+
+/**
+ * Precomputed codes of the current and upcoming time steps.
+ *
+ * Holds the codes of the current and the next `lookAhead` time steps of
+ * every TOTP and Steam token of a token store, indexed by token and
+ * `time / period`. Expired windows are replaced by upcoming ones when
+ * refilling, so codes are ready before the window boundary is reached
+ * and displays can rotate without generating anything on the spot.
+ *
+ * The schedule works on a snapshot of the token properties and key
+ * contexts, tokens are identified by their handle inside the store.
+ * Every lookup resolves the handle and checks the snapshot against the
+ * fingerprint of the token, so a token which changed since @see assign
+ * gets a new snapshot instead of stale codes and a removed token has no
+ * code. Call assign again after tokens were added to the store.
+ *
+ * All methods are thread-safe.
+ */
+class CodeSchedule
+{
+public:
+    // number of upcoming windows precomputed by default
+    static constexpr std::size_t DefaultLookAhead = 2;
+
+    /**
+     * Constructs an empty schedule.
+     */
+    CodeSchedule(std::size_t lookAhead = DefaultLookAhead);
+
+    /**
+     * Constructs a schedule for all tokens of the given token store.
+     */
+    CodeSchedule(const TokenStore &store, std::size_t lookAhead = DefaultLookAhead);
+
+    /**
+     * Stops the background refill and destroys the schedule.
+     */
+    ~CodeSchedule();
+
+    CodeSchedule(const CodeSchedule &) = delete;
+    CodeSchedule &operator= (const CodeSchedule &) = delete;
+
+    /**
+     * Replaces the scheduled tokens with the tokens of the given store.
+     * HOTP tokens and tokens which can't generate codes are skipped.
+     * Handles are resolved in the given store until the next assign or
+     * @see clear, it must stay alive until then.
+     */
+    void assign(const TokenStore &store);
+
+    /**
+     * Removes all tokens from the schedule.
+     */
+    void clear();
+
+    /**
+     * Computes all missing codes from the window containing the given
+     * time up to the look-ahead. Expired windows are evicted.
+     */
+    void refill(const std::time_t &time);
+
+    /**
+     * Sets the clock the background refill follows, the system clock by default.
+     * The clock must outlive the schedule.
+     */
+    void setClock(const Clock &clock);
+
+    /**
+     * Starts refilling the schedule in a background thread.
+     *
+     * The thread sleeps until the next window boundary of any token and
+     * then computes the windows which came into range, so the refill
+     * happens in idle time and not right when codes are needed. The
+     * current windows are computed once even when @see stop is called
+     * right away.
+     */
+    void start();
+
+    /**
+     * Stops the background refill thread if running.
+     */
+    void stop();
+
+    /**
+     * Writes the code of the token with the given handle at the given time
+     * into the buffer.
+     *
+     * Returns the length of the code, the code is null-terminated. When the
+     * window isn't scheduled yet it is computed on the spot and cached.
+     * Tokens which aren't part of the schedule fall back to
+     * @see OTPToken::generate. Returns 0 when the handle doesn't resolve
+     * to a token anymore.
+     */
+    std::size_t code(TokenStore::Handle handle, const std::time_t &time, std::span<char> buffer);
+
+    /**
+     * Returns the code of the token with the given handle at the given time.
+     */
+    const std::string code(TokenStore::Handle handle, const std::time_t &time);
+
+    /**
+     * Checks if the code of the token with the given handle at the given
+     * time is already precomputed.
+     */
+    bool isScheduled(TokenStore::Handle handle, const std::time_t &time) const;
+
+    /**
+     * Returns the number of scheduled tokens.
+     */
+    std::size_t size() const;
+
+    /**
+     * Returns the number of windows kept per token.
+     */
+    inline std::size_t lookAhead() const
+    {
+        return this->_lookAhead;
+    }
+
+private:
+    // code of a single time step
+    struct Slot
+    {
+        std::uint64_t step = UINT64_MAX; // UINT64_MAX: empty
+        std::uint8_t length = 0;
+        char code[OTPToken::MaxTokenLength + 1] = {};
+    };
+
+    // snapshot of a scheduled token with its ring of upcoming windows
+    struct Entry
+    {
+        OTPToken::KeyContext context;
+        std::uint64_t fingerprint; // of the token the snapshot was taken from
+        OTPToken::Type type;
+        std::uint32_t period;
+        std::uint8_t digits;
+        std::vector<Slot> slots; // indexed by step % slots.size()
+    };
+
+    bool makeEntry(const OTPToken &token, Entry &entry) const;
+    void fill(Entry &entry, const std::uint64_t &step);
+    std::time_t nextBoundary(const std::time_t &time) const;
+    void run();
+
+    std::size_t _lookAhead;
+    std::vector<Entry> _entries;
+    std::unordered_map<TokenStore::Handle, std::size_t> _index;
+    const TokenStore *_store = nullptr;
+
+    const Clock *_clock = &Clock::system();
+
+    mutable std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::thread _worker;
+    bool _running = false;
+};
+
+#endif // CODESCHEDULE_HPP
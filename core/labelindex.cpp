@@ -0,0 +1,216 @@
+#include "labelindex.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    // posting lists are compacted once they hold this many stale entries
+    // and more stale than live entries
+    static const constexpr std::size_t COMPACT_THRESHOLD = 4096;
+
+    static inline char fold_char(char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+}
+
+std::string LabelIndex::fold(std::string_view label)
+{
+    std::string folded(label);
+    std::transform(folded.begin(), folded.end(), folded.begin(), fold_char);
+    return folded;
+}
+
+void LabelIndex::insert(std::uint32_t id, std::string_view label)
+{
+    if (id < this->_entries.size() && this->_entries[id].used)
+    {
+        this->erase(id);
+    }
+    else if (id >= this->_entries.size())
+    {
+        this->_entries.resize(id + 1);
+    }
+
+    auto &entry = this->_entries[id];
+    entry.node = this->_tree.emplace(fold(label), id);
+    entry.used = true;
+    ++this->_size;
+
+    this->post(id);
+}
+
+void LabelIndex::erase(std::uint32_t id)
+{
+    if (id >= this->_entries.size() || !this->_entries[id].used)
+    {
+        return;
+    }
+
+    auto &entry = this->_entries[id];
+
+    // posting list entries stay until the next compaction
+    this->_stale += entry.postings;
+
+    this->_tree.erase(entry.node);
+    entry.used = false;
+    --this->_size;
+
+    if (this->_stale >= COMPACT_THRESHOLD && this->_stale * 2 > this->_postings)
+    {
+        this->compact();
+    }
+}
+
+void LabelIndex::clear()
+{
+    this->_tree.clear();
+    this->_entries.clear();
+    this->_grams.clear();
+    this->_size = 0;
+    this->_postings = 0;
+    this->_stale = 0;
+}
+
+void LabelIndex::reserve(std::size_t count)
+{
+    this->_entries.reserve(count);
+}
+
+std::vector<std::uint32_t> LabelIndex::exact(std::string_view query) const
+{
+    std::vector<std::uint32_t> ids;
+
+    const auto range = this->_tree.equal_range(fold(query));
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        ids.emplace_back(it->second);
+    }
+    return ids;
+}
+
+std::vector<std::uint32_t> LabelIndex::prefix(std::string_view query) const
+{
+    std::vector<std::uint32_t> ids;
+
+    const auto folded = fold(query);
+    for (auto it = this->_tree.lower_bound(folded); it != this->_tree.end(); ++it)
+    {
+        if (it->first.compare(0, folded.size(), folded) != 0)
+        {
+            break;
+        }
+        ids.emplace_back(it->second);
+    }
+    return ids;
+}
+
+std::vector<std::uint32_t> LabelIndex::substring(std::string_view query) const
+{
+    std::vector<std::uint32_t> ids;
+
+    if (query.empty())
+    {
+        ids.reserve(this->_size);
+        for (std::uint32_t id = 0; id < this->_entries.size(); ++id)
+        {
+            if (this->_entries[id].used)
+            {
+                ids.emplace_back(id);
+            }
+        }
+        return ids;
+    }
+
+    const auto folded = fold(query);
+
+    // the shortest posting list of all query grams bounds the candidates
+    const auto length = std::min(folded.size(), GramLength);
+    const std::vector<std::uint32_t> *candidates = nullptr;
+    for (std::size_t pos = 0; pos + length <= folded.size(); ++pos)
+    {
+        const auto it = this->_grams.find(gram(folded, pos, length));
+        if (it == this->_grams.end())
+        {
+            return ids;
+        }
+        if (!candidates || it->second.size() < candidates->size())
+        {
+            candidates = &it->second;
+        }
+    }
+
+    // without stale entries the posting list of a short query is the exact result
+    if (this->_stale == 0 && folded.size() <= GramLength)
+    {
+        ids = *candidates;
+        if (!std::is_sorted(ids.begin(), ids.end()))
+        {
+            std::sort(ids.begin(), ids.end());
+        }
+        return ids;
+    }
+
+    // candidates may be stale or reused by another label, always verify
+    for (auto&& id : *candidates)
+    {
+        const auto &entry = this->_entries[id];
+        if (entry.used && entry.node->first.find(folded) != std::string::npos)
+        {
+            ids.emplace_back(id);
+        }
+    }
+
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+std::uint32_t LabelIndex::gram(std::string_view folded, std::size_t pos, std::size_t length)
+{
+    // the length in the top byte keeps grams of different lengths apart
+    std::uint32_t key = static_cast<std::uint32_t>(length) << 24;
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        key |= static_cast<std::uint32_t>(static_cast<unsigned char>(folded[pos + i])) << (8 * i);
+    }
+    return key;
+}
+
+void LabelIndex::post(std::uint32_t id)
+{
+    auto &entry = this->_entries[id];
+    const std::string_view folded = entry.node->first;
+
+    entry.postings = 0;
+    for (std::size_t n = 1; n <= GramLength && n <= folded.size(); ++n)
+    {
+        for (std::size_t pos = 0; pos + n <= folded.size(); ++pos)
+        {
+            auto &list = this->_grams[gram(folded, pos, n)];
+
+            // labels are posted in one go, so repeated grams of the same label are adjacent
+            if (list.empty() || list.back() != id)
+            {
+                list.emplace_back(id);
+                ++entry.postings;
+            }
+        }
+    }
+    this->_postings += entry.postings;
+}
+
+void LabelIndex::compact()
+{
+    this->_grams.clear();
+    this->_postings = 0;
+    this->_stale = 0;
+
+    for (std::uint32_t id = 0; id < this->_entries.size(); ++id)
+    {
+        if (this->_entries[id].used)
+        {
+            this->post(id);
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef LABELINDEX_HPP
+#define LABELINDEX_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Case-insensitive index of token labels.
+ *
+ * Maps labels to caller-defined numeric ids and answers exact, prefix
+ * and substring queries without scanning all labels. Labels are case
+ * folded once on insertion, only ASCII letters are folded and all other
+ * bytes compare as they are.
+ *
+ * Exact and prefix queries run on an ordered tree of the folded labels.
+ * Substring queries run on posting lists of all 1 to 3 byte grams, the
+ * shortest list of the query grams is verified against the labels.
+ * Removed ids are dropped from the posting lists lazily, the lists are
+ * compacted once they hold more stale than live entries.
+ *
+ * Ids are meant to be small and dense, like array indices.
+ * This class isn't thread-safe.
+ */
+class LabelIndex
+{
+public:
+    // longest gram kept in the posting lists
+    static constexpr std::size_t GramLength = 3;
+
+    LabelIndex() = default;
+
+    /**
+     * Returns the case folded form of the given label.
+     */
+    static std::string fold(std::string_view label);
+
+    /**
+     * Adds or replaces the label of the given id.
+     */
+    void insert(std::uint32_t id, std::string_view label);
+
+    /**
+     * Removes the given id. Unknown ids are ignored.
+     */
+    void erase(std::uint32_t id);
+
+    /**
+     * Removes all labels.
+     */
+    void clear();
+
+    /**
+     * Reserves room for ids below the given count.
+     */
+    void reserve(std::size_t count);
+
+    /**
+     * Returns the ids of all labels equal to the query, ignoring case.
+     */
+    std::vector<std::uint32_t> exact(std::string_view query) const;
+
+    /**
+     * Returns the ids of all labels starting with the query, ignoring case.
+     * Ids are ordered by label.
+     */
+    std::vector<std::uint32_t> prefix(std::string_view query) const;
+
+    /**
+     * Returns the ids of all labels containing the query, ignoring case.
+     * Ids are in ascending order. An empty query matches every label.
+     */
+    std::vector<std::uint32_t> substring(std::string_view query) const;
+
+    /**
+     * Returns the number of indexed labels.
+     */
+    inline std::size_t size() const
+    {
+        return this->_size;
+    }
+
+private:
+    using Tree = std::multimap<std::string, std::uint32_t, std::less<>>;
+
+    struct Entry
+    {
+        Tree::iterator node;
+        std::uint32_t postings = 0;     // posting list entries added for this label
+        bool used = false;
+    };
+
+    static std::uint32_t gram(std::string_view folded, std::size_t pos, std::size_t length);
+    void post(std::uint32_t id);
+    void compact();
+
+    Tree _tree;
+    std::vector<Entry> _entries;                                        // indexed by id
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> _grams; // gram -> ids, may hold stale ids
+    std::size_t _size = 0;
+    std::size_t _postings = 0;                                          // total posting list entries
+    std::size_t _stale = 0;                                             // entries of removed labels
+};
+
+#endif // LABELINDEX_HPP
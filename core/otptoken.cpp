@@ -1,8 +1,19 @@
 #include "otptoken.hpp"
 #include "private/serialize.hpp"
 #include "private/otpgen.hpp"
+#include "private/hotp.hpp"
+#include "private/hmac_batch.hpp"
+#include "private/hash.hpp"
 
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+
+#include <cryptopp/sha.h>
 
 #include <magic_enum.hpp>
 #include <fmt/format.h>
@@ -25,42 +36,62 @@ namespace
     const auto hotp_defaults =  defaults{6,  0,  0, OTPToken::SHA1};
     const auto steam_defaults = defaults{5, 30,  0, OTPToken::SHA1};
 
-    // steam token alphabet
-    static const std::string steam_alphabet = "23456789BCDFGHJKMNPQRTVWXY";
-
-    // converts Steam's base64 secrets into a compatible base32 string for the OTP generator
-    static const std::string convert_steam_base64_secret(const std::string &steam_base64_secret)
+    static inline void set_error(OTPToken::Error *error, OTPToken::Error value)
     {
-        // input can't be empty
-        if (steam_base64_secret.empty())
+        if (error)
         {
-            return {};
+            (*error) = value;
         }
+    }
 
-        std::string base32;
+    // number of counters a HOTP search thread claims at once
+    static const constexpr std::uint64_t HOTP_SEARCH_BLOCK = 256;
 
-        try {
+    // smaller HOTP search windows aren't worth starting threads for
+    static const constexpr std::uint64_t HOTP_SEARCH_PARALLEL_THRESHOLD = 4096;
 
-            // create an RFC 4648 base-32 encoder
-            // crypto++ uses DUDE by default which isn't TOTP compatible
-            auto encoder = new CryptoPP::Base32Encoder();
-            static const CryptoPP::byte ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
-            static const CryptoPP::AlgorithmParameters params = CryptoPP::MakeParameters(
-                                                                CryptoPP::Name::EncodingLookupArray(),
-                                                                static_cast<const CryptoPP::byte*>(ALPHABET));
-            encoder->IsolatedInitialize(params);
+    // seed of the token fingerprint
+    static const constexpr std::uint64_t FINGERPRINT_SEED = 0x4f545047656e32ULL;
 
-            encoder->Attach(new CryptoPP::StringSink(base32));
+    // searches the counters [first, last) for the code and returns the first
+    // matching counter, or last if there is none
+    static std::uint64_t search_hotp_counter(const OTPToken::KeyContext &ctx,
+                                             std::string_view code,
+                                             std::uint64_t first,
+                                             std::uint64_t last)
+    {
+        static const constexpr std::size_t CHUNK = 4 * BatchHMAC::LANES;
 
-            // decode and re-encode base-64 data into base-32
-            CryptoPP::StringSource src(steam_base64_secret, true,
-                new CryptoPP::Base64Decoder(encoder));
+        const OTPToken::KeyContext *contexts[CHUNK];
+        std::fill(std::begin(contexts), std::end(contexts), &ctx);
 
-        } catch (...) {
-            return {};
+        std::uint64_t counters[CHUNK];
+        unsigned char hmacs[CHUNK * BatchHMAC::STRIDE];
+        const auto hmac_size = digest_size(ctx.algorithm);
+        const auto digits = static_cast<std::uint8_t>(code.size());
+
+        for (auto begin = first; begin < last; begin += CHUNK)
+        {
+            const auto count = static_cast<std::size_t>(std::min<std::uint64_t>(CHUNK, last - begin));
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                counters[i] = begin + i;
+            }
+
+            BatchHMAC::compute(contexts, counters, count, hmacs);
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                char candidate[MAX_TOKEN_LENGTH];
+                format_token(hmacs + i * BatchHMAC::STRIDE, hmac_size, OTPToken::HOTP, digits, candidate);
+                if (std::equal(candidate, candidate + digits, code.data()))
+                {
+                    return counters[i];
+                }
+            }
         }
 
-        return base32;
+        return last;
     }
 }
 
@@ -144,6 +175,271 @@ OTPToken::~OTPToken()
 {
 }
 
+OTPToken::KeyContextCache::KeyContextCache(const KeyContextCache &other)
+{
+    this->operator= (other);
+}
+
+OTPToken::KeyContextCache &OTPToken::KeyContextCache::operator= (const KeyContextCache &other)
+{
+    // only take over a fully published context, everything else is rebuilt on demand
+    if (other.state.load(std::memory_order_acquire) == Ready)
+    {
+        this->context = other.context;
+        this->generator = other.generator;
+        this->state.store(Ready, std::memory_order_release);
+    }
+    else
+    {
+        this->reset();
+    }
+    return *this;
+}
+
+std::uint64_t OTPToken::fingerprint() const
+{
+    auto hash = this->_fingerprint.value.load(std::memory_order_relaxed);
+    if (hash != 0)
+    {
+        return hash;
+    }
+
+    // racing threads compute the same values, so relaxed stores are enough
+    const std::uint64_t properties[] = {
+        this->_digits,
+        this->_period,
+        this->_counter,
+        static_cast<std::uint64_t>(this->_type),
+        static_cast<std::uint64_t>(this->_algorithm),
+        this->iconId(),
+    };
+
+    hash = murmur_hash64a(this->_label.data(), this->_label.size(), FINGERPRINT_SEED);
+    hash = murmur_hash64a(this->_secret.data(), this->_secret.size(), hash);
+    hash = murmur_hash64a(properties, sizeof(properties), hash);
+    hash = hash == 0 ? 1 : hash;
+
+    this->_fingerprint.value.store(hash, std::memory_order_relaxed);
+    return hash;
+}
+
+// icons by digest, only holding weak references so unused icons are released
+struct OTPToken::Icon::Pool
+{
+    struct DigestHash
+    {
+        std::size_t operator() (const IconDigest &digest) const
+        {
+            std::size_t hash;
+            std::memcpy(&hash, digest.data(), sizeof(hash));
+            return hash;
+        }
+    };
+
+    struct Entry
+    {
+        const Icon *icon;
+        std::weak_ptr<const Icon> ref;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<IconDigest, Entry, DigestHash> entries;
+    std::uint64_t nextId = 1;
+
+    // returns the live entry with the given digest, the mutex must be held
+    //
+    // an entry which can't be shared is handed out as stale, which the caller
+    // releases after unlocking the mutex, as releasing it may need the mutex
+    std::shared_ptr<const Icon> find(const IconDigest &digest, std::shared_ptr<const Icon> &stale)
+    {
+        const auto it = this->entries.find(digest);
+        if (it == this->entries.end())
+        {
+            return nullptr;
+        }
+
+        auto icon = it->second.ref.lock();
+        if (icon && icon->usable())
+        {
+            return icon;
+        }
+        stale = std::move(icon);
+        return nullptr;
+    }
+
+    // adds a new entry, the mutex must be held
+    std::shared_ptr<const Icon> insert(Icon *icon)
+    {
+        icon->id = this->nextId++;
+        std::shared_ptr<const Icon> ref(icon, [](const Icon *icon) {
+            pool().release(icon);
+            delete icon;
+        });
+        this->entries.insert_or_assign(icon->digest, Entry{icon, ref});
+        return ref;
+    }
+
+    void release(const Icon *icon)
+    {
+        std::lock_guard lock(this->mutex);
+        const auto it = this->entries.find(icon->digest);
+
+        // the entry may have been replaced already
+        if (it != this->entries.end() && it->second.icon == icon)
+        {
+            this->entries.erase(it);
+        }
+    }
+};
+
+OTPToken::Icon::Pool &OTPToken::Icon::pool()
+{
+    // never destroyed, icons of static tokens may outlive it otherwise
+    static auto *pool = new Pool();
+    return *pool;
+}
+
+std::shared_ptr<const OTPToken::Icon> OTPToken::Icon::intern(Data data)
+{
+    IconDigest digest;
+    CryptoPP::SHA256().CalculateDigest(digest.data(), reinterpret_cast<const unsigned char*>(data.data()), data.size());
+
+    auto &pool = Icon::pool();
+    std::shared_ptr<const Icon> stale;
+    std::lock_guard lock(pool.mutex);
+    if (auto icon = pool.find(digest, stale))
+    {
+        // a stored icon with the same content doesn't have to be loaded anymore
+        std::uint8_t expected = Pending;
+        if (icon->length == data.size() && icon->state.compare_exchange_strong(expected, Loading, std::memory_order_acquire))
+        {
+            icon->bytes = std::move(data);
+            icon->state.store(Ready, std::memory_order_release);
+        }
+        return icon;
+    }
+
+    auto *icon = new Icon();
+    icon->state.store(Ready, std::memory_order_relaxed);
+    icon->length = static_cast<std::uint32_t>(data.size());
+    icon->bytes = std::move(data);
+    icon->digest = digest;
+    return pool.insert(icon);
+}
+
+std::shared_ptr<const OTPToken::Icon> OTPToken::Icon::intern(const IconDigest &digest, std::shared_ptr<const IconSource> source,
+                                                             std::uint64_t offset, std::uint32_t length)
+{
+    auto &pool = Icon::pool();
+    std::shared_ptr<const Icon> stale;
+    std::lock_guard lock(pool.mutex);
+    if (auto icon = pool.find(digest, stale))
+    {
+        return icon;
+    }
+
+    auto *icon = new Icon();
+    icon->digest = digest;
+    icon->source = std::move(source);
+    icon->offset = offset;
+    icon->length = length;
+    return pool.insert(icon);
+}
+
+const OTPToken::Data &OTPToken::Icon::data() const
+{
+    if (this->state.load(std::memory_order_acquire) == Ready)
+    {
+        return this->bytes;
+    }
+
+    std::uint8_t expected = Pending;
+    if (this->state.compare_exchange_strong(expected, Loading, std::memory_order_acquire))
+    {
+        // icons which fail to load stay empty, retrying wouldn't change that
+        if (!this->source->loadIcon(this->digest, this->offset, this->length, this->bytes) || this->bytes.size() != this->length)
+        {
+            this->bytes.clear();
+        }
+        this->state.store(Ready, std::memory_order_release);
+        return this->bytes;
+    }
+
+    // another thread is loading the icon right now
+    while (this->state.load(std::memory_order_acquire) != Ready)
+    {
+        std::this_thread::yield();
+    }
+    return this->bytes;
+}
+
+bool OTPToken::Icon::usable() const
+{
+    return !this->loaded() || this->bytes.size() == this->length;
+}
+
+void OTPToken::setIcon(const Data &icon)
+{
+    this->_icon = icon.empty() ? nullptr : Icon::intern(icon);
+    this->_fingerprint.reset();
+}
+
+const OTPToken::Data &OTPToken::icon() const
+{
+    static const Data empty;
+    return this->_icon ? this->_icon->data() : empty;
+}
+
+std::size_t OTPToken::iconSize() const
+{
+    return this->_icon ? this->_icon->size() : 0;
+}
+
+bool OTPToken::iconLoaded() const
+{
+    return !this->_icon || this->_icon->loaded();
+}
+
+std::uint64_t OTPToken::iconId() const
+{
+    return this->_icon ? this->_icon->id : 0;
+}
+
+const OTPToken::KeyContext &OTPToken::keyContext() const
+{
+    auto &cache = this->_keyContext;
+
+    auto state = cache.state.load(std::memory_order_acquire);
+    if (state == KeyContextCache::Ready)
+    {
+        return cache.context;
+    }
+
+    std::uint8_t expected = KeyContextCache::Empty;
+    if (cache.state.compare_exchange_strong(expected, KeyContextCache::Building, std::memory_order_acquire))
+    {
+        // Steam tokens are always SHA-1
+        const auto algorithm = this->_type == Steam ? SHA1 : this->_algorithm;
+        cache.context = make_key_context(this->_secret, algorithm);
+        cache.generator = select_generator(this->_type, algorithm, this->_digits);
+
+        // tokens without a specialized generator can't generate codes
+        if (!cache.generator && cache.context.error == Valid)
+        {
+            cache.context.error = algorithm < SHA1 || algorithm > SHA512 ? InvalidAlgorithm : InvalidDigits;
+        }
+        cache.state.store(KeyContextCache::Ready, std::memory_order_release);
+        return cache.context;
+    }
+
+    // another thread is building the context right now, which is fast
+    while (cache.state.load(std::memory_order_acquire) != KeyContextCache::Ready)
+    {
+        std::this_thread::yield();
+    }
+    return cache.context;
+}
+
 const std::string OTPToken::typeName() const
 {
     return std::string(magic_enum::enum_name(this->_type));
@@ -165,106 +461,243 @@ const OTPToken::Data OTPToken::serialize() const
 
 const std::string OTPToken::generate(Error *error) const
 {
-    return this->generate(std::time(nullptr), error);
+    return this->generate(Clock::system().now(), error);
 }
 
 const std::string OTPToken::generate(const std::time_t &time, Error *error) const
+{
+    char buffer[MaxTokenLength + 1];
+    const auto length = this->generate(time, buffer, error);
+    return std::string(buffer, buffer + length);
+}
+
+std::size_t OTPToken::generate(const std::time_t &time, std::span<char> buffer, Error *error) const
 {
     if (!this->isValid())
     {
-        return {};
+        return 0;
     }
 
     if (!check_otp_length(this->_digits))
     {
-        if (error)
-        {
-            (*error) = InvalidDigits;
-        }
-        return {};
+        set_error(error, InvalidDigits);
+        return 0;
     }
 
+    std::uint64_t counter;
+    std::uint8_t digits = this->_digits;
+
     if (this->_type == TOTP)
     {
         if (!check_period(this->_period))
         {
-            if (error)
-            {
-                (*error) = InvalidPeriod;
-            }
-            return {};
+            set_error(error, InvalidPeriod);
+            return 0;
         }
 
-        const auto timestamp = time / this->_period;
-
         // use hotp with the timestamp as counter to compute a totp token
-        return hotp_helper(this->_secret, timestamp, this->_digits, this->_algorithm, error);
+        counter = static_cast<std::uint64_t>(time / this->_period);
     }
 
     else if (this->_type == HOTP)
     {
-        return hotp_helper(this->_secret, this->_counter, this->_digits, this->_algorithm, error);
+        counter = this->_counter;
     }
 
     else if (this->_type == Steam)
     {
-        const auto timestamp = time / 30; // hardcode 30 seconds besides default handling
+        counter = static_cast<std::uint64_t>(time / STEAM_PERIOD);
+        digits = STEAM_DIGITS;
+    }
 
-        const auto hmac = compute_hmac(this->_secret, timestamp, OTPToken::SHA1);
-        if (hmac.empty())
-        {
-            if (error)
+    else
+    {
+        return 0;
+    }
+
+    if (buffer.size() < digits + 1U)
+    {
+        set_error(error, InsufficientBuffer);
+        return 0;
+    }
+
+    const auto &ctx = this->keyContext();
+    const auto generator = this->_keyContext.generator;
+    if (ctx.error != Valid || !generator)
+    {
+        set_error(error, ctx.error != Valid ? ctx.error : InvalidAlgorithm);
+        return 0;
+    }
+
+    const auto length = generator(ctx, counter, buffer.data());
+    buffer[length] = '\0';
+    return length;
+}
+
+std::optional<int> OTPToken::verify(std::string_view code, const std::time_t &now, int windowBefore, int windowAfter) const
+{
+    if (!this->isValid() || windowBefore < 0 || windowAfter < 0)
+    {
+        return {};
+    }
+
+    const auto digits = this->_type == Steam ? STEAM_DIGITS : this->_digits;
+    if (!check_otp_length(digits) || code.size() != digits)
+    {
+        return {};
+    }
+
+    std::int64_t step;
+    switch (this->_type)
+    {
+        case TOTP:
+            if (!check_period(this->_period))
             {
-                (*error) = InvalidBase32Input;
+                return {};
             }
+            step = now / this->_period;
+            break;
+        case HOTP:
+            step = this->_counter;
+            break;
+        case Steam:
+            step = now / STEAM_PERIOD;
+            break;
+        default:
             return {};
-        }
+    }
 
-        unsigned long offset = (hmac[SHA1_DIGEST_SIZE-1] & 0x0f);
-        auto bin_code = compute_bin_code(hmac, offset);
+    const auto &ctx = this->keyContext();
+    const auto generator = this->_keyContext.generator;
+    if (ctx.error != Valid || !generator)
+    {
+        return {};
+    }
 
-        char code[6]; // hardcode digit length besides default handing
-        for (auto i = 0; i < 5; ++i)
+    // check every window without stopping early and prefer the closest match,
+    // order: 0, -1, +1, -2, +2, ...
+    std::optional<int> matched;
+    const auto widest = std::max(windowBefore, windowAfter);
+    for (auto distance = 0; distance <= widest; ++distance)
+    {
+        const int offsets[] = {-distance, distance};
+        for (auto i = distance == 0 ? 1 : 0; i < 2; ++i)
         {
-            int mod = bin_code % steam_alphabet.size();
-            bin_code = bin_code / steam_alphabet.size();
-            code[i] = steam_alphabet[mod];
+            const auto offset = offsets[i];
+            if (offset < -windowBefore || offset > windowAfter || step + offset < 0)
+            {
+                continue;
+            }
+
+            char expected[MaxTokenLength];
+            generator(ctx, static_cast<std::uint64_t>(step + offset), expected);
+
+            if (constant_time_equals(expected, code.data(), digits) && !matched)
+            {
+                matched = offset;
+            }
         }
-        code[5] = '\0';
+    }
 
-        return std::string(code, code + strlen(code));
+    return matched;
+}
+
+std::optional<std::uint32_t> OTPToken::findHotpCounter(std::string_view code, std::uint32_t lookAhead) const
+{
+    if (!this->isValid() || this->_type != HOTP)
+    {
+        return {};
     }
 
-    else
+    if (!check_otp_length(this->_digits) || code.size() != this->_digits)
     {
         return {};
     }
-}
 
-const std::uint64_t OTPToken::remainingTokenValidity() const
-{
-    if (this->_period == 0 || this->_type == HOTP)
+    const auto &ctx = this->keyContext();
+    if (ctx.error != Valid)
     {
-        return 0;
+        return {};
     }
 
-    // get remaining seconds since last minute
-    auto now = std::time(nullptr);
-    auto local = std::localtime(&now);
+    // search range [first, last), capped at the largest storable counter
+    const std::uint64_t first = this->_counter;
+    const std::uint64_t last = std::min<std::uint64_t>(
+        first + lookAhead + 1, std::uint64_t(std::numeric_limits<std::uint32_t>::max()) + 1);
 
-    // calculate token validity with 1 second update threshold
-    auto sec_expired = local->tm_sec;
-    auto token_validity = ( static_cast<int>(this->_period) - sec_expired );
-    if (token_validity < 0)
+    const auto window = last - first;
+    const auto hardware_threads = std::max(1U, std::thread::hardware_concurrency());
+    const auto thread_count = static_cast<unsigned>(std::min<std::uint64_t>(hardware_threads, window / HOTP_SEARCH_BLOCK));
+
+    std::uint64_t found = last;
+    if (window < HOTP_SEARCH_PARALLEL_THRESHOLD || thread_count < 2)
     {
-        token_validity = ( static_cast<int>(this->_period) - (sec_expired % static_cast<int>(this->_period)) ) + 1;
+        found = search_hotp_counter(ctx, code, first, last);
     }
     else
     {
-        token_validity++;
+        // threads claim blocks in ascending order and skip everything past the
+        // lowest match found so far, so the result is the same as a serial search
+        std::atomic<std::uint64_t> next_block = first;
+        std::atomic<std::uint64_t> lowest_match = last;
+
+        const auto worker = [&]{
+            while (true)
+            {
+                const auto begin = next_block.fetch_add(HOTP_SEARCH_BLOCK, std::memory_order_relaxed);
+                if (begin >= last || begin >= lowest_match.load(std::memory_order_relaxed))
+                {
+                    return;
+                }
+
+                const auto end = std::min(begin + HOTP_SEARCH_BLOCK, last);
+                const auto match = search_hotp_counter(ctx, code, begin, end);
+                if (match != end)
+                {
+                    auto current = lowest_match.load(std::memory_order_relaxed);
+                    while (match < current && !lowest_match.compare_exchange_weak(current, match, std::memory_order_relaxed));
+                    return;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(thread_count - 1);
+        for (auto i = 1U; i < thread_count; ++i)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto&& thread : threads)
+        {
+            thread.join();
+        }
+
+        found = lowest_match.load();
+    }
+
+    if (found == last)
+    {
+        return {};
+    }
+    return static_cast<std::uint32_t>(found);
+}
+
+const std::uint64_t OTPToken::remainingTokenValidity() const
+{
+    return this->remainingTokenValidity(Clock::system().now());
+}
+
+const std::uint64_t OTPToken::remainingTokenValidity(const std::time_t &now) const
+{
+    if (this->_period == 0 || this->_type == HOTP)
+    {
+        return 0;
     }
 
-    return static_cast<std::uint64_t>(token_validity);
+    // seconds into the current time step, not into the current minute
+    const auto period = static_cast<std::uint64_t>(this->_type == Steam ? STEAM_PERIOD : this->_period);
+    return period - static_cast<std::uint64_t>(now) % period;
 }
 
 void OTPToken::set_defaults(const void *_def)
@@ -297,7 +730,7 @@ OTPToken::operator const std::string() const
         "[hidden]",
         magic_enum::enum_name(this->_type),
         magic_enum::enum_name(this->_algorithm),
-        this->_icon.size(),
+        this->iconSize(),
         this->isValid()
     );
 }
@@ -1,11 +1,19 @@
 #ifndef OTPTOKEN_HPP
 #define OTPTOKEN_HPP
 
+#include <array>
 #include <string>
 #include <vector>
+#include <span>
+#include <string_view>
+#include <optional>
+#include <memory>
+#include <atomic>
 #include <cstdint>
 #include <ctime>
 
+#include "clock.hpp"
+
 class OTPToken
 {
 public:
@@ -13,6 +21,12 @@ public:
     // raw binary data container
     using Data = std::vector<char>;
 
+    // SHA-256 of the icon data, icons are pooled by their digest
+    using IconDigest = std::array<unsigned char, 32>;
+
+    // longest token which can be generated, excluding the null terminator
+    static constexpr std::size_t MaxTokenLength = 10;
+
     /**
      * error codes
      */
@@ -25,6 +39,7 @@ public:
         InvalidOTP,
         InvalidDigits,
         InvalidPeriod,
+        InsufficientBuffer, // output buffer too small for the token
     };
 
     /**
@@ -47,6 +62,43 @@ public:
         SHA512  = 3,
     };
 
+    /**
+     * Precomputed HMAC state of the decoded token secret.
+     *
+     * Holds the hash midstates after absorbing the inner and outer padded
+     * key block, so computing a code only needs to hash two more blocks.
+     */
+    struct KeyContext
+    {
+        Algorithm algorithm = SHA1;
+        Error error = Valid;
+
+        // SHA-1 and SHA-256 midstates
+        std::uint32_t inner32[8] = {};
+        std::uint32_t outer32[8] = {};
+
+        // SHA-512 midstates
+        std::uint64_t inner64[8] = {};
+        std::uint64_t outer64[8] = {};
+    };
+
+    /**
+     * Provides the data of icons which are kept apart from the token
+     * properties, like the icon section of a store file. Icons read from
+     * a source are only loaded on first access.
+     */
+    class IconSource
+    {
+    public:
+        virtual ~IconSource() = default;
+
+        /**
+         * Loads the icon with the given digest at the given position of the source.
+         * Returns false if the icon can't be read or doesn't authenticate.
+         */
+        virtual bool loadIcon(const IconDigest &digest, std::uint64_t offset, std::uint32_t length, Data &icon) const = 0;
+    };
+
 public:
     /**
      * Constructs a new OTPToken with default values.
@@ -115,48 +167,73 @@ public:
      */
     inline bool canGenerateTokens() const
     {
-        return !this->generate().empty();
+        char buffer[MaxTokenLength + 1];
+        return this->generate(Clock::system().now(), buffer) != 0;
     }
 
-    constexpr inline void setLabel(const std::string &label)
-    { this->_label = label; }
+    inline void setLabel(const std::string &label)
+    { this->_label = label; this->_fingerprint.reset(); }
     constexpr inline const auto &label() const
     { return this->_label; }
 
-    constexpr inline void setSecret(const std::string &secret)
-    { this->_secret = secret; }
+    inline void setSecret(const std::string &secret)
+    { this->_secret = secret; this->_keyContext.reset(); this->_fingerprint.reset(); }
     constexpr inline const auto &secret() const
     { return this->_secret; }
 
-    constexpr inline void setDigits(const std::uint8_t &digits)
-    { this->_digits = digits; }
+    inline void setDigits(const std::uint8_t &digits)
+    { this->_digits = digits; this->_keyContext.reset(); this->_fingerprint.reset(); }
     constexpr inline const auto &digits() const
     { return this->_digits; }
 
-    constexpr inline void setPeriod(const std::uint32_t &period)
-    { this->_period = period; }
+    inline void setPeriod(const std::uint32_t &period)
+    { this->_period = period; this->_fingerprint.reset(); }
     constexpr inline const auto &period() const
     { return this->_period; }
 
-    constexpr inline void setCounter(const std::uint32_t &counter)
-    { this->_counter = counter; }
+    inline void setCounter(const std::uint32_t &counter)
+    { this->_counter = counter; this->_fingerprint.reset(); }
     constexpr inline const auto &counter() const
     { return this->_counter; }
 
-    constexpr inline void setType(const Type &type)
-    { this->_type = type; }
+    inline void setType(const Type &type)
+    { this->_type = type; this->_keyContext.reset(); this->_fingerprint.reset(); }
     constexpr inline const auto &type() const
     { return this->_type; }
 
-    constexpr inline void setAlgorithm(const Algorithm &algorithm)
-    { this->_algorithm = algorithm; }
+    inline void setAlgorithm(const Algorithm &algorithm)
+    { this->_algorithm = algorithm; this->_keyContext.reset(); this->_fingerprint.reset(); }
     constexpr inline const auto &algorithm() const
     { return this->_algorithm; }
 
-    constexpr inline void setIcon(const Data &icon)
-    { this->_icon = icon; }
-    constexpr inline const auto &icon() const
-    { return this->_icon; }
+    void setIcon(const Data &icon);
+
+    /**
+     * Returns the raw icon data.
+     *
+     * Icons of tokens loaded from a store are read and decrypted on first
+     * access, an icon which fails to load is empty.
+     */
+    const Data &icon() const;
+
+    /**
+     * Returns the size of the icon data without loading the icon.
+     */
+    std::size_t iconSize() const;
+
+    /**
+     * Checks if the icon data is in memory, tokens without an icon
+     * are always loaded.
+     */
+    bool iconLoaded() const;
+
+    /**
+     * Returns the ID of the icon in the shared icon pool, 0 without icon.
+     *
+     * Icons are pooled by content, tokens with the same icon share its
+     * data and have the same icon ID while they exist.
+     */
+    std::uint64_t iconId() const;
 
     /**
      * Returns the type name of the token as string for display.
@@ -180,7 +257,16 @@ public:
     const Data serialize() const;
 
     /**
-     * Generate token from current time.
+     * Returns the precomputed HMAC key state of this token.
+     *
+     * The context is built on first use and cached until the secret,
+     * type, algorithm or digit count changes. Check the error member for secrets
+     * which couldn't be decoded.
+     */
+    const KeyContext &keyContext() const;
+
+    /**
+     * Generate token from the current time of the system clock.
      */
     const std::string generate(Error *error = nullptr) const;
 
@@ -190,13 +276,67 @@ public:
     const std::string generate(const std::time_t &time, Error *error = nullptr) const;
 
     /**
-     * Calculates the remaining token validity from the current system time.
-     * The returned time is in seconds.
+     * Generate token from the given time into the given buffer.
+     *
+     * The token is written null-terminated, a buffer of `MaxTokenLength + 1`
+     * characters fits every token. Returns the length of the token or 0
+     * on errors. Once the key context is built this never allocates.
+     */
+    std::size_t generate(const std::time_t &time, std::span<char> buffer, Error *error = nullptr) const;
+
+    /**
+     * Verifies a user-submitted code against the windows around the given time.
+     *
+     * Checks every time step from `now - windowBefore` to `now + windowAfter`
+     * periods. HOTP tokens check the same offsets around their counter instead.
+     * All windows are always computed with the same key context and compared
+     * in constant time, so the result doesn't leak which window matched.
+     *
+     * Returns the matched window offset (negative for past windows) so callers
+     * can track clock drift, or nothing when the code is invalid.
+     */
+    std::optional<int> verify(std::string_view code, const std::time_t &now,
+                              int windowBefore = 1, int windowAfter = 1) const;
+
+    /**
+     * Searches the HOTP counters from the current counter up to `lookAhead`
+     * steps ahead for the given code, used to resynchronize drifted tokens.
+     *
+     * All counters are hashed with the same key context. Large windows are
+     * split across multiple threads, which stop as soon as a match is found.
+     *
+     * Returns the lowest matching counter, pass it to @see setCounter to
+     * make the token generate the given code again. Returns nothing when
+     * the token isn't a HOTP token or no counter produced the code.
+     */
+    std::optional<std::uint32_t> findHotpCounter(std::string_view code, std::uint32_t lookAhead) const;
+
+    /**
+     * Calculates the remaining token validity from the current time of the
+     * system clock. The returned time is in seconds.
      *
      * This function always returns 0 on HOTP tokens.
      */
     const std::uint64_t remainingTokenValidity() const;
 
+    /**
+     * Calculates the seconds until the time step containing the given time
+     * ends, between 1 and the period.
+     *
+     * This function always returns 0 on HOTP tokens.
+     */
+    const std::uint64_t remainingTokenValidity(const std::time_t &now) const;
+
+    /**
+     * Returns a 64-bit hash of all properties compared by @see operator==.
+     *
+     * Equal tokens always have the same fingerprint, different tokens only
+     * collide by chance. The fingerprint is computed on first use and cached
+     * until a property changes. The icon contributes its pool ID, so
+     * the icon data is never hashed.
+     */
+    std::uint64_t fingerprint() const;
+
     /**
      * equal operator
      */
@@ -237,10 +377,123 @@ private:
     friend void save(Archive &archive, const OTPToken &token);
     template<class Archive>
     friend void load(Archive &archive, OTPToken &token);
+    friend struct StoredToken;
 
     // internal function to set token type defaults
     void set_defaults(const void *def);
 
+    // code generator specialized for the algorithm and digit count
+    using Generator = std::size_t (*)(const KeyContext &ctx, std::uint64_t counter, char *out);
+
+    // lazily built key context, published once ready so concurrent
+    // readers of the same token never observe a partially built state
+    class KeyContextCache final
+    {
+    public:
+        KeyContextCache() = default;
+        KeyContextCache(const KeyContextCache &other);
+        KeyContextCache &operator= (const KeyContextCache &other);
+
+        inline void reset()
+        { this->state.store(Empty, std::memory_order_relaxed); }
+
+    private:
+        friend class OTPToken;
+
+        enum State : std::uint8_t
+        {
+            Empty,
+            Building,
+            Ready,
+        };
+
+        std::atomic<std::uint8_t> state = Empty;
+        KeyContext context;
+        Generator generator = nullptr;
+    };
+
+    // lazily computed hash, 0 while not computed yet
+    class HashCache final
+    {
+    public:
+        HashCache() = default;
+        HashCache(const HashCache &other)
+            : value(other.value.load(std::memory_order_relaxed))
+        {}
+        HashCache &operator= (const HashCache &other)
+        { this->value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed); return *this; }
+
+        inline void reset()
+        { this->value.store(0, std::memory_order_relaxed); }
+
+    private:
+        friend class OTPToken;
+
+        std::atomic<std::uint64_t> value = 0;
+    };
+
+    // entry of the process wide icon pool, shared by all tokens with the
+    // same icon and removed from the pool with the last of them
+    //
+    // entries are immutable once created, except for loading the data of
+    // icons kept in an icon source
+    class Icon final
+    {
+    public:
+        Icon(const Icon &) = delete;
+        Icon &operator= (const Icon &) = delete;
+
+        /**
+         * Returns the pool entry of the given icon data.
+         */
+        static std::shared_ptr<const Icon> intern(Data data);
+
+        /**
+         * Returns the pool entry of the icon with the given digest,
+         * which is loaded from the source on first access if the pool
+         * doesn't have the icon yet.
+         */
+        static std::shared_ptr<const Icon> intern(const IconDigest &digest, std::shared_ptr<const IconSource> source,
+                                                  std::uint64_t offset, std::uint32_t length);
+
+        const Data &data() const;
+
+        inline std::size_t size() const
+        { return this->length; }
+        inline bool loaded() const
+        { return this->state.load(std::memory_order_acquire) == Ready; }
+
+    private:
+        friend class OTPToken;
+        friend class TokenStore;
+        friend struct StoredToken;
+
+        struct Pool;
+        static Pool &pool();
+
+        enum State : std::uint8_t
+        {
+            Pending,
+            Loading,
+            Ready,
+        };
+
+        Icon() = default;
+
+        // loaded icons which lost their data can't be shared anymore
+        bool usable() const;
+
+        mutable std::atomic<std::uint8_t> state = Pending;
+        mutable Data bytes;
+
+        IconDigest digest;
+        std::uint64_t id = 0;
+
+        std::shared_ptr<const IconSource> source;
+        std::uint64_t offset = 0;
+        std::uint32_t length = 0;
+    };
+
     // Token Properties
     std::string _label;     // label
     std::string _secret;    // token secret
@@ -249,7 +502,13 @@ private:
     std::uint32_t _counter; // HOTP token counter
     Type _type;             // token type
     Algorithm _algorithm;   // token algorithm
-    Data _icon;             // raw icon data
+    std::shared_ptr<const Icon> _icon;  // pooled icon data, null without icon
+
+    // cached HMAC key state, not part of the token properties
+    mutable KeyContextCache _keyContext;
+
+    // cached content hash, not part of the token properties
+    mutable HashCache _fingerprint;
 
     // internal validity state for deserialized instances
     bool valid = true;
@@ -0,0 +1,395 @@
+#include "basen.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BASEN_SIMD 1
+#include <immintrin.h>
+#else
+#define BASEN_SIMD 0
+#endif
+
+namespace
+{
+
+static const constexpr char BASE32_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+static const constexpr char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// maps every input character to its value, -1 for characters outside of the alphabet
+struct DecodeTable
+{
+    std::int8_t values[256];
+};
+
+static constexpr DecodeTable make_decode_table(const char *alphabet, std::size_t size, bool case_insensitive)
+{
+    DecodeTable table{};
+    for (auto &value : table.values)
+    {
+        value = -1;
+    }
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        const auto c = static_cast<unsigned char>(alphabet[i]);
+        table.values[c] = static_cast<std::int8_t>(i);
+        if (case_insensitive && c >= 'A' && c <= 'Z')
+        {
+            table.values[c + 32] = static_cast<std::int8_t>(i);
+        }
+    }
+
+    return table;
+}
+
+static constexpr auto BASE32_TABLE = make_decode_table(BASE32_ALPHABET, 32, true);
+static constexpr auto BASE64_TABLE = make_decode_table(BASE64_ALPHABET, 64, false);
+
+// partially decoded bits carried between blocks
+struct BitState
+{
+    std::uint32_t accumulator = 0;
+    int bits = 0;
+};
+
+template<int Bits>
+static inline std::size_t decode_scalar(const char *in, std::size_t length, const DecodeTable &table, BitState &state, unsigned char *out)
+{
+    std::size_t written = 0;
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        const auto value = table.values[static_cast<unsigned char>(in[i])];
+        if (value < 0)
+        {
+            continue;
+        }
+
+        state.accumulator = (state.accumulator << Bits) | static_cast<std::uint32_t>(value);
+        state.bits += Bits;
+        if (state.bits >= 8)
+        {
+            state.bits -= 8;
+            out[written++] = static_cast<unsigned char>(state.accumulator >> state.bits);
+        }
+    }
+    return written;
+}
+
+#if BASEN_SIMD
+
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+// range mask of lo <= c <= hi for signed 8-bit lanes, non-ASCII input is never in range
+TARGET_SSSE3 static inline __m128i in_range_x16(__m128i c, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                         _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(hi + 1)), c));
+}
+
+TARGET_AVX2 static inline __m256i in_range_x32(__m256i c, char lo, char hi)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), c));
+}
+
+// value of the characters inside the mask, zero elsewhere
+TARGET_SSSE3 static inline __m128i select_x16(__m128i mask, __m128i c, char first, char value)
+{
+    return _mm_and_si128(mask, _mm_add_epi8(c, _mm_set1_epi8(static_cast<char>(value - first))));
+}
+
+TARGET_AVX2 static inline __m256i select_x32(__m256i mask, __m256i c, char first, char value)
+{
+    return _mm256_and_si256(mask, _mm256_add_epi8(c, _mm256_set1_epi8(static_cast<char>(value - first))));
+}
+
+// translates 16 base-32 characters, fails if any of them isn't part of the alphabet
+TARGET_SSSE3 static inline bool base32_translate_x16(__m128i c, __m128i &values)
+{
+    const auto upper = in_range_x16(c, 'A', 'Z');
+    const auto lower = in_range_x16(c, 'a', 'z');
+    const auto digit = in_range_x16(c, '2', '7');
+
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), digit)) != 0xffff)
+    {
+        return false;
+    }
+
+    values = _mm_or_si128(_mm_or_si128(select_x16(upper, c, 'A', 0), select_x16(lower, c, 'a', 0)),
+                          select_x16(digit, c, '2', 26));
+    return true;
+}
+
+TARGET_AVX2 static inline bool base32_translate_x32(__m256i c, __m256i &values)
+{
+    const auto upper = in_range_x32(c, 'A', 'Z');
+    const auto lower = in_range_x32(c, 'a', 'z');
+    const auto digit = in_range_x32(c, '2', '7');
+
+    if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(upper, lower), digit)) != -1)
+    {
+        return false;
+    }
+
+    values = _mm256_or_si256(_mm256_or_si256(select_x32(upper, c, 'A', 0), select_x32(lower, c, 'a', 0)),
+                             select_x32(digit, c, '2', 26));
+    return true;
+}
+
+// translates 16 base-64 characters, fails if any of them isn't part of the alphabet
+TARGET_SSSE3 static inline bool base64_translate_x16(__m128i c, __m128i &values)
+{
+    const auto upper = in_range_x16(c, 'A', 'Z');
+    const auto lower = in_range_x16(c, 'a', 'z');
+    const auto digit = in_range_x16(c, '0', '9');
+    const auto plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+    const auto slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+
+    const auto valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, plus)), slash);
+    if (_mm_movemask_epi8(valid) != 0xffff)
+    {
+        return false;
+    }
+
+    values = _mm_or_si128(_mm_or_si128(select_x16(upper, c, 'A', 0), select_x16(lower, c, 'a', 26)),
+                          _mm_or_si128(_mm_or_si128(select_x16(digit, c, '0', 52), select_x16(plus, c, '+', 62)),
+                                       select_x16(slash, c, '/', 63)));
+    return true;
+}
+
+TARGET_AVX2 static inline bool base64_translate_x32(__m256i c, __m256i &values)
+{
+    const auto upper = in_range_x32(c, 'A', 'Z');
+    const auto lower = in_range_x32(c, 'a', 'z');
+    const auto digit = in_range_x32(c, '0', '9');
+    const auto plus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+    const auto slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+
+    const auto valid = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, plus)), slash);
+    if (_mm256_movemask_epi8(valid) != -1)
+    {
+        return false;
+    }
+
+    values = _mm256_or_si256(_mm256_or_si256(select_x32(upper, c, 'A', 0), select_x32(lower, c, 'a', 26)),
+                             _mm256_or_si256(_mm256_or_si256(select_x32(digit, c, '0', 52), select_x32(plus, c, '+', 62)),
+                                             select_x32(slash, c, '/', 63)));
+    return true;
+}
+
+// packs 8 base-32 values per 64-bit lane into 5 big-endian bytes at the bottom of each 128-bit lane
+static const constexpr char BASE32_PACK_SHUFFLE[16] = {4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1};
+
+// packs 4 base-64 values per 32-bit lane into 3 big-endian bytes at the bottom of each 128-bit lane
+static const constexpr char BASE64_PACK_SHUFFLE[16] = {2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1};
+
+// decodes 16 base-32 characters into 10 bytes
+TARGET_SSSE3 static bool base32_block_x16(const char *in, unsigned char *out)
+{
+    __m128i values;
+    if (!base32_translate_x16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), values))
+    {
+        return false;
+    }
+
+    // 5 + 5 -> 10 bits, 10 + 10 -> 20 bits, 20 + 20 -> 40 bits
+    const auto pairs = _mm_maddubs_epi16(values, _mm_set1_epi16(0x0120));
+    const auto quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00010400));
+    const auto groups = _mm_or_si128(_mm_slli_epi64(_mm_and_si128(quads, _mm_set1_epi64x(0xffffffff)), 20),
+                                     _mm_srli_epi64(quads, 32));
+    const auto bytes = _mm_shuffle_epi8(groups, _mm_loadu_si128(reinterpret_cast<const __m128i*>(BASE32_PACK_SHUFFLE)));
+
+    alignas(16) unsigned char packed[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(packed), bytes);
+    std::memcpy(out, packed, 10);
+    return true;
+}
+
+// decodes 32 base-32 characters into 20 bytes
+TARGET_AVX2 static bool base32_block_x32(const char *in, unsigned char *out)
+{
+    __m256i values;
+    if (!base32_translate_x32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in)), values))
+    {
+        return false;
+    }
+
+    const auto shuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(BASE32_PACK_SHUFFLE)));
+    const auto pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi16(0x0120));
+    const auto quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00010400));
+    const auto groups = _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(quads, _mm256_set1_epi64x(0xffffffff)), 20),
+                                        _mm256_srli_epi64(quads, 32));
+    const auto bytes = _mm256_shuffle_epi8(groups, shuffle);
+
+    alignas(32) unsigned char packed[32];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(packed), bytes);
+    std::memcpy(out, packed, 10);
+    std::memcpy(out + 10, packed + 16, 10);
+    return true;
+}
+
+// decodes 16 base-64 characters into 12 bytes
+TARGET_SSSE3 static bool base64_block_x16(const char *in, unsigned char *out)
+{
+    __m128i values;
+    if (!base64_translate_x16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), values))
+    {
+        return false;
+    }
+
+    // 6 + 6 -> 12 bits, 12 + 12 -> 24 bits
+    const auto pairs = _mm_maddubs_epi16(values, _mm_set1_epi16(0x0140));
+    const auto groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    const auto bytes = _mm_shuffle_epi8(groups, _mm_loadu_si128(reinterpret_cast<const __m128i*>(BASE64_PACK_SHUFFLE)));
+
+    alignas(16) unsigned char packed[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(packed), bytes);
+    std::memcpy(out, packed, 12);
+    return true;
+}
+
+// decodes 32 base-64 characters into 24 bytes
+TARGET_AVX2 static bool base64_block_x32(const char *in, unsigned char *out)
+{
+    __m256i values;
+    if (!base64_translate_x32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in)), values))
+    {
+        return false;
+    }
+
+    const auto shuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(BASE64_PACK_SHUFFLE)));
+    const auto pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi16(0x0140));
+    const auto groups = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    const auto bytes = _mm256_shuffle_epi8(groups, shuffle);
+
+    alignas(32) unsigned char packed[32];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(packed), bytes);
+    std::memcpy(out, packed, 12);
+    std::memcpy(out + 12, packed + 16, 12);
+    return true;
+}
+
+#undef TARGET_SSSE3
+#undef TARGET_AVX2
+
+static bool cpu_supports_ssse3()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+static bool cpu_supports_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif // BASEN_SIMD
+
+// a vectorized block decoder: characters per block, bytes per block, kernel
+struct BlockKernel
+{
+    std::size_t input;
+    std::size_t output;
+    bool (*decode)(const char *in, unsigned char *out);
+};
+
+/**
+ * Decodes the input with the widest available block kernels while the
+ * bit state is byte aligned. Blocks containing characters outside of the
+ * alphabet are decoded with the scalar decoder, which skips them.
+ */
+template<int Bits>
+static std::size_t decode(std::string_view input, const DecodeTable &table,
+                          const BlockKernel &wide, const BlockKernel &narrow, unsigned char *out)
+{
+    const char *in = input.data();
+    const auto length = input.size();
+
+    BitState state;
+    std::size_t i = 0, written = 0;
+
+    while (i < length)
+    {
+        // block kernels can only start on a byte boundary
+        if (state.bits == 0)
+        {
+            if (wide.decode && length - i >= wide.input && wide.decode(in + i, out + written))
+            {
+                i += wide.input;
+                written += wide.output;
+                continue;
+            }
+            if (narrow.decode && length - i >= narrow.input && narrow.decode(in + i, out + written))
+            {
+                i += narrow.input;
+                written += narrow.output;
+                continue;
+            }
+        }
+
+        // one scalar group, 8 base-32 or 4 base-64 characters fill whole bytes again
+        const auto chunk = std::min<std::size_t>(length - i, Bits == 5 ? 8 : 4);
+        written += decode_scalar<Bits>(in + i, chunk, table, state, out + written);
+        i += chunk;
+    }
+
+    return written;
+}
+
+static const BlockKernel &base32_wide_kernel()
+{
+#if BASEN_SIMD
+    static const BlockKernel kernel = cpu_supports_avx2() ? BlockKernel{32, 20, &base32_block_x32} : BlockKernel{};
+#else
+    static const BlockKernel kernel{};
+#endif
+    return kernel;
+}
+
+static const BlockKernel &base32_narrow_kernel()
+{
+#if BASEN_SIMD
+    static const BlockKernel kernel = cpu_supports_ssse3() ? BlockKernel{16, 10, &base32_block_x16} : BlockKernel{};
+#else
+    static const BlockKernel kernel{};
+#endif
+    return kernel;
+}
+
+static const BlockKernel &base64_wide_kernel()
+{
+#if BASEN_SIMD
+    static const BlockKernel kernel = cpu_supports_avx2() ? BlockKernel{32, 24, &base64_block_x32} : BlockKernel{};
+#else
+    static const BlockKernel kernel{};
+#endif
+    return kernel;
+}
+
+static const BlockKernel &base64_narrow_kernel()
+{
+#if BASEN_SIMD
+    static const BlockKernel kernel = cpu_supports_ssse3() ? BlockKernel{16, 12, &base64_block_x16} : BlockKernel{};
+#else
+    static const BlockKernel kernel{};
+#endif
+    return kernel;
+}
+
+} // anonymous namespace
+
+std::size_t BaseN::base32Decode(std::string_view input, unsigned char *out)
+{
+    // secrets are treated like C strings
+    input = input.substr(0, input.find('\0'));
+
+    return decode<5>(input, BASE32_TABLE, base32_wide_kernel(), base32_narrow_kernel(), out);
+}
+
+std::size_t BaseN::base64Decode(std::string_view input, unsigned char *out)
+{
+    return decode<6>(input, BASE64_TABLE, base64_wide_kernel(), base64_narrow_kernel(), out);
+}
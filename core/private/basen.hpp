@@ -0,0 +1,48 @@
+#ifndef CORE_PRIVATE_BASEN_HPP
+#define CORE_PRIVATE_BASEN_HPP
+
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Fused secret normalization and decoding.
+ *
+ * Decodes RFC 4648 base-32 and base-64 in a single pass over the input,
+ * directly into a caller buffer. Characters outside of the alphabet, like
+ * whitespace and padding, are skipped. Base-32 is case-insensitive.
+ *
+ * Blocks which consist entirely of alphabet characters are translated and
+ * packed with SSSE3 or AVX2 when the CPU supports them, everything else
+ * runs through the scalar decoder with the same results.
+ */
+namespace BaseN
+{
+    /**
+     * Upper bound of the decoded size of the given number of input characters.
+     */
+    constexpr std::size_t base32DecodedSize(std::size_t length)
+    {
+        return length * 5 / 8;
+    }
+
+    constexpr std::size_t base64DecodedSize(std::size_t length)
+    {
+        return length * 3 / 4;
+    }
+
+    /**
+     * Decodes base-32 input into out and returns the number of bytes written.
+     * The input ends at the first null character, trailing bits are dropped.
+     * out must have room for base32DecodedSize(input.size()) bytes.
+     */
+    std::size_t base32Decode(std::string_view input, unsigned char *out);
+
+    /**
+     * Decodes base-64 input into out and returns the number of bytes written.
+     * out must have room for base64DecodedSize(input.size()) bytes.
+     */
+    std::size_t base64Decode(std::string_view input, unsigned char *out);
+}
+
+#endif // CORE_PRIVATE_BASEN_HPP
@@ -0,0 +1,115 @@
+#ifndef CORE_PRIVATE_CIPHER_STREAMBUF_HPP
+#define CORE_PRIVATE_CIPHER_STREAMBUF_HPP
+
+#include <streambuf>
+#include <algorithm>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstddef>
+
+/**
+ * Stream buffer running a CBC mode cipher with PKCS #7 padding over
+ * a stream in fixed size chunks, so the plaintext doesn't have to be
+ * in memory as a whole. The cipher keeps the chaining state between
+ * chunks, any type with `ProcessData(out, in, length)` works.
+ *
+ * Only reads store files of version 3 and older, newer files seal
+ * every record on its own.
+ */
+
+namespace
+{
+    static const constexpr std::size_t CIPHER_BLOCK_SIZE = 16;
+    static const constexpr std::size_t CIPHER_CHUNK_SIZE = 64 * 1024;
+
+    static_assert(CIPHER_CHUNK_SIZE % CIPHER_BLOCK_SIZE == 0);
+
+    // returns the padding length of the last plaintext block, 0 if it is invalid
+    static std::size_t pkcs7_padding(const unsigned char *block)
+    {
+        const std::size_t padding = block[CIPHER_BLOCK_SIZE - 1];
+        if (padding == 0 || padding > CIPHER_BLOCK_SIZE)
+        {
+            return 0;
+        }
+
+        for (std::size_t i = CIPHER_BLOCK_SIZE - padding; i < CIPHER_BLOCK_SIZE; ++i)
+        {
+            if (block[i] != padding)
+            {
+                return 0;
+            }
+        }
+        return padding;
+    }
+
+    // decrypts the ciphertext chunk by chunk while it is read
+    template<typename Cipher>
+    class CipherDecryptStreambuf final : public std::streambuf
+    {
+    public:
+        CipherDecryptStreambuf(Cipher &cipher, std::string_view ciphertext)
+            : _cipher(cipher),
+              _ciphertext(ciphertext),
+              _buffer(CIPHER_CHUNK_SIZE)
+        {
+        }
+
+        /**
+         * Returns true when the ciphertext or its padding is malformed.
+         */
+        inline bool failed() const
+        {
+            return this->_failed;
+        }
+
+    protected:
+        int_type underflow() override
+        {
+            if (this->gptr() < this->egptr())
+            {
+                return traits_type::to_int_type(*this->gptr());
+            }
+
+            if (this->_failed || this->_ciphertext.empty())
+            {
+                return traits_type::eof();
+            }
+
+            if (this->_ciphertext.size() % CIPHER_BLOCK_SIZE != 0)
+            {
+                this->_failed = true;
+                return traits_type::eof();
+            }
+
+            const auto length = std::min(this->_ciphertext.size(), CIPHER_CHUNK_SIZE);
+            auto *plaintext = reinterpret_cast<unsigned char*>(this->_buffer.data());
+            this->_cipher.ProcessData(plaintext, reinterpret_cast<const unsigned char*>(this->_ciphertext.data()), length);
+            this->_ciphertext.remove_prefix(length);
+
+            auto available = length;
+            if (this->_ciphertext.empty())
+            {
+                const auto padding = pkcs7_padding(plaintext + length - CIPHER_BLOCK_SIZE);
+                if (padding == 0)
+                {
+                    this->_failed = true;
+                    return traits_type::eof();
+                }
+                available -= padding;
+            }
+
+            this->setg(this->_buffer.data(), this->_buffer.data(), this->_buffer.data() + available);
+            return available > 0 ? traits_type::to_int_type(*this->gptr()) : traits_type::eof();
+        }
+
+    private:
+        Cipher &_cipher;
+        std::string_view _ciphertext;
+        std::vector<char> _buffer;
+        bool _failed = false;
+    };
+}
+
+#endif // CORE_PRIVATE_CIPHER_STREAMBUF_HPP
@@ -0,0 +1,185 @@
+#ifndef CORE_PRIVATE_DURABLE_FILE_HPP
+#define CORE_PRIVATE_DURABLE_FILE_HPP
+
+#include <string>
+#include <filesystem>
+#include <system_error>
+#include <cstddef>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if !defined(_WIN32)
+    static bool write_all(int fd, const char *data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            const auto written = ::write(fd, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+        return true;
+    }
+
+    // makes a rename within the directory durable, not every file system supports this
+    static void sync_directory(const std::filesystem::path &path)
+    {
+        const auto directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+        const auto fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
+#endif
+
+    // creates an empty file which only the owner can read and write,
+    // the umask can't make a new store file readable by others
+    static bool create_private_file(const std::string &filePath)
+    {
+#if defined(_WIN32)
+        std::fstream file;
+        file.open(filePath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        file.close();
+        return true;
+#else
+        const auto fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            return false;
+        }
+        return ::close(fd) == 0;
+#endif
+    }
+
+    // writes the contents at the given offset, drops everything behind them
+    // and only returns once the data reached the storage device
+    static bool write_file_synced(const std::string &filePath, std::size_t offset, const std::string &contents)
+    {
+#if defined(_WIN32)
+        std::error_code ec;
+        if (offset > 0)
+        {
+            std::filesystem::resize_file(filePath, offset, ec);
+            if (ec)
+            {
+                return false;
+            }
+        }
+
+        std::fstream file;
+        file.open(filePath, std::ios_base::binary | std::ios_base::out |
+                            (offset > 0 ? std::ios_base::app : std::ios_base::trunc));
+        if (!file.is_open())
+        {
+            return false;
+        }
+        file.write(contents.data(), contents.size());
+        file.flush();
+        file.close();
+        return !file.fail();
+#else
+        const auto fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        const auto written = ::ftruncate(fd, static_cast<off_t>(offset)) == 0 &&
+                             ::lseek(fd, static_cast<off_t>(offset), SEEK_SET) >= 0 &&
+                             write_all(fd, contents.data(), contents.size()) &&
+                             ::fsync(fd) == 0;
+        return ::close(fd) == 0 && written;
+#endif
+    }
+
+    // replaces the file as a whole, readers see either the old or the new
+    // contents but never a partially written file, even after a crash
+    //
+    // the contents are produced by the given function, which receives a
+    // `bool(const char *data, std::size_t size)` callback to write chunks
+    // and returns false to abort
+    template<typename Producer>
+    static bool replace_file_with(const std::string &filePath, Producer produce)
+    {
+        const auto tempPath = filePath + ".tmp";
+        std::error_code ec;
+
+#if defined(_WIN32)
+        std::fstream file;
+        file.open(tempPath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        const auto produced = produce([&file](const char *data, std::size_t size) {
+            file.write(data, static_cast<std::streamsize>(size));
+            return !file.fail();
+        });
+        file.flush();
+        file.close();
+        const auto written = produced && !file.fail();
+#else
+        const auto fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        const auto produced = produce([fd](const char *data, std::size_t size) {
+            return write_all(fd, data, size);
+        });
+        const auto synced = produced && ::fsync(fd) == 0;
+        const auto written = ::close(fd) == 0 && synced;
+#endif
+
+        if (!written)
+        {
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+
+        // keep the permissions of the replaced file
+        const auto status = std::filesystem::status(filePath, ec);
+        if (!ec && std::filesystem::exists(status))
+        {
+            std::filesystem::permissions(tempPath, status.permissions(), ec);
+        }
+
+        std::filesystem::rename(tempPath, filePath, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+
+#if !defined(_WIN32)
+        sync_directory(filePath);
+#endif
+        return true;
+    }
+}
+
+#endif // CORE_PRIVATE_DURABLE_FILE_HPP
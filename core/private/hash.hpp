@@ -0,0 +1,63 @@
+#ifndef CORE_PRIVATE_HASH_HPP
+#define CORE_PRIVATE_HASH_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+    // finalizer of MurmurHash3, spreads the key bits over the whole word
+    static inline std::uint64_t mix64(std::uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    // MurmurHash64A by Austin Appleby, pass the previous hash as seed to chain fields
+    static inline std::uint64_t murmur_hash64a(const void *data, std::size_t length, std::uint64_t seed)
+    {
+        const std::uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+
+        const auto *bytes = static_cast<const unsigned char*>(data);
+        std::uint64_t h = seed ^ (length * m);
+
+        const auto *end = bytes + (length / 8) * 8;
+        for (; bytes != end; bytes += 8)
+        {
+            std::uint64_t k;
+            std::memcpy(&k, bytes, sizeof(k));
+
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+
+            h ^= k;
+            h *= m;
+        }
+
+        switch (length & 7)
+        {
+            case 7: h ^= std::uint64_t(bytes[6]) << 48; [[fallthrough]];
+            case 6: h ^= std::uint64_t(bytes[5]) << 40; [[fallthrough]];
+            case 5: h ^= std::uint64_t(bytes[4]) << 32; [[fallthrough]];
+            case 4: h ^= std::uint64_t(bytes[3]) << 24; [[fallthrough]];
+            case 3: h ^= std::uint64_t(bytes[2]) << 16; [[fallthrough]];
+            case 2: h ^= std::uint64_t(bytes[1]) << 8;  [[fallthrough]];
+            case 1: h ^= std::uint64_t(bytes[0]);
+                    h *= m;
+        }
+
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
+}
+
+#endif // CORE_PRIVATE_HASH_HPP
@@ -0,0 +1,183 @@
+#ifndef CORE_PRIVATE_HMAC_HPP
+#define CORE_PRIVATE_HMAC_HPP
+
+#include "sha.hpp"
+
+#include <otptoken.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+
+static const constexpr auto SHA1_DIGEST_SIZE = 20;
+static const constexpr auto SHA256_DIGEST_SIZE = 32;
+static const constexpr auto SHA512_DIGEST_SIZE = 64;
+
+// largest possible HMAC output
+static const constexpr auto HMAC_MAX_DIGEST_SIZE = SHA512_DIGEST_SIZE;
+
+static constexpr std::size_t digest_size(const OTPToken::Algorithm &algo)
+{
+    switch (algo)
+    {
+        case OTPToken::SHA1:   return SHA1_DIGEST_SIZE;
+        case OTPToken::SHA256: return SHA256_DIGEST_SIZE;
+        case OTPToken::SHA512: return SHA512_DIGEST_SIZE;
+    }
+    return 0;
+}
+
+/**
+ * Absorbs the inner and outer padded key into the midstates of the context.
+ * Keys longer than the block size are hashed first as required by RFC 2104.
+ */
+static inline void hmac_prepare(OTPToken::KeyContext &ctx, const unsigned char *key, std::size_t length, const OTPToken::Algorithm &algo)
+{
+    ctx.algorithm = algo;
+
+    const std::size_t block_size = algo == OTPToken::SHA512 ? SHA512_BLOCK_SIZE : SHA1_BLOCK_SIZE;
+
+    unsigned char kblock[SHA512_BLOCK_SIZE] = {};
+    if (length > block_size)
+    {
+        switch (algo)
+        {
+            case OTPToken::SHA1:   sha1_digest(key, length, kblock); break;
+            case OTPToken::SHA256: sha256_digest(key, length, kblock); break;
+            case OTPToken::SHA512: sha512_digest(key, length, kblock); break;
+        }
+    }
+    else
+    {
+        std::memcpy(kblock, key, length);
+    }
+
+    unsigned char ipad[SHA512_BLOCK_SIZE];
+    unsigned char opad[SHA512_BLOCK_SIZE];
+    for (std::size_t i = 0; i < block_size; ++i)
+    {
+        ipad[i] = kblock[i] ^ 0x36;
+        opad[i] = kblock[i] ^ 0x5c;
+    }
+
+    switch (algo)
+    {
+        case OTPToken::SHA1:
+            std::memcpy(ctx.inner32, SHA1_INIT, sizeof(SHA1_INIT));
+            std::memcpy(ctx.outer32, SHA1_INIT, sizeof(SHA1_INIT));
+            sha1_compress(ctx.inner32, ipad);
+            sha1_compress(ctx.outer32, opad);
+            break;
+        case OTPToken::SHA256:
+            std::memcpy(ctx.inner32, SHA256_INIT, sizeof(SHA256_INIT));
+            std::memcpy(ctx.outer32, SHA256_INIT, sizeof(SHA256_INIT));
+            sha256_compress(ctx.inner32, ipad);
+            sha256_compress(ctx.outer32, opad);
+            break;
+        case OTPToken::SHA512:
+            std::memcpy(ctx.inner64, SHA512_INIT, sizeof(SHA512_INIT));
+            std::memcpy(ctx.outer64, SHA512_INIT, sizeof(SHA512_INIT));
+            sha512_compress(ctx.inner64, ipad);
+            sha512_compress(ctx.outer64, opad);
+            break;
+    }
+
+    // don't leave key material on the stack
+    std::memset(kblock, 0, sizeof(kblock));
+    std::memset(ipad, 0, sizeof(ipad));
+    std::memset(opad, 0, sizeof(opad));
+}
+
+/**
+ * Computes the HMAC of the 8-byte big-endian counter using the precomputed
+ * midstates. This is exactly one inner and one outer block, no allocations.
+ *
+ * The algorithm is fixed at compile time, out receives digest_size(Algo) bytes.
+ */
+template<OTPToken::Algorithm Algo>
+static inline void hmac_compute(const OTPToken::KeyContext &ctx, std::uint64_t counter, unsigned char *out)
+{
+    if constexpr (Algo == OTPToken::SHA512)
+    {
+        unsigned char block[SHA512_BLOCK_SIZE] = {};
+        std::uint64_t state[8];
+
+        // inner: H((K ^ ipad) || counter)
+        store_be64(block, counter);
+        block[8] = 0x80;
+        store_be64(block + SHA512_BLOCK_SIZE - 8, (SHA512_BLOCK_SIZE + 8) * 8);
+        std::memcpy(state, ctx.inner64, sizeof(state));
+        sha512_compress(state, block);
+
+        // outer: H((K ^ opad) || inner)
+        std::memset(block, 0, sizeof(block));
+        for (auto i = 0; i < 8; ++i)
+        {
+            store_be64(block + i * 8, state[i]);
+        }
+        block[SHA512_DIGEST_SIZE] = 0x80;
+        store_be64(block + SHA512_BLOCK_SIZE - 8, (SHA512_BLOCK_SIZE + SHA512_DIGEST_SIZE) * 8);
+        std::memcpy(state, ctx.outer64, sizeof(state));
+        sha512_compress(state, block);
+
+        for (auto i = 0; i < 8; ++i)
+        {
+            store_be64(out + i * 8, state[i]);
+        }
+    }
+    else
+    {
+        constexpr bool sha1 = Algo == OTPToken::SHA1;
+        constexpr std::size_t size = digest_size(Algo);
+        constexpr std::size_t words = size / 4;
+
+        unsigned char block[SHA1_BLOCK_SIZE] = {};
+        std::uint32_t state[8];
+
+        // inner: H((K ^ ipad) || counter)
+        store_be64(block, counter);
+        block[8] = 0x80;
+        store_be64(block + SHA1_BLOCK_SIZE - 8, (SHA1_BLOCK_SIZE + 8) * 8);
+        std::memcpy(state, ctx.inner32, sizeof(state));
+        sha1 ? sha1_compress(state, block) : sha256_compress(state, block);
+
+        // outer: H((K ^ opad) || inner)
+        std::memset(block, 0, sizeof(block));
+        for (std::size_t i = 0; i < words; ++i)
+        {
+            store_be32(block + i * 4, state[i]);
+        }
+        block[size] = 0x80;
+        store_be64(block + SHA1_BLOCK_SIZE - 8, (SHA1_BLOCK_SIZE + size) * 8);
+        std::memcpy(state, ctx.outer32, sizeof(state));
+        sha1 ? sha1_compress(state, block) : sha256_compress(state, block);
+
+        for (std::size_t i = 0; i < words; ++i)
+        {
+            store_be32(out + i * 4, state[i]);
+        }
+    }
+}
+
+/**
+ * Computes the HMAC with the algorithm of the key context.
+ *
+ * Returns the number of bytes written to out.
+ */
+static inline std::size_t hmac_compute(const OTPToken::KeyContext &ctx, std::uint64_t counter, unsigned char out[HMAC_MAX_DIGEST_SIZE])
+{
+    switch (ctx.algorithm)
+    {
+        case OTPToken::SHA1:   hmac_compute<OTPToken::SHA1>(ctx, counter, out); break;
+        case OTPToken::SHA256: hmac_compute<OTPToken::SHA256>(ctx, counter, out); break;
+        case OTPToken::SHA512: hmac_compute<OTPToken::SHA512>(ctx, counter, out); break;
+    }
+    return digest_size(ctx.algorithm);
+}
+
+} // anonymous namespace
+
+#endif // CORE_PRIVATE_HMAC_HPP
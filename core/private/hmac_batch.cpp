@@ -0,0 +1,298 @@
+#include "hmac_batch.hpp"
+#include "hmac.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BATCH_HMAC_AVX2 1
+#include <immintrin.h>
+#else
+#define BATCH_HMAC_AVX2 0
+#endif
+
+namespace
+{
+
+#if BATCH_HMAC_AVX2
+
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+using KeyContextWords = std::uint32_t (OTPToken::KeyContext::*)[8];
+
+TARGET_AVX2 static inline __m256i rotl_x8(__m256i x, int n)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+}
+
+TARGET_AVX2 static inline __m256i rotr_x8(__m256i x, int n)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+TARGET_AVX2 static inline __m256i add_x8(__m256i a, __m256i b)
+{
+    return _mm256_add_epi32(a, b);
+}
+
+// loads word k of the given midstate of all 8 contexts into one vector
+TARGET_AVX2 static inline __m256i gather_x8(const OTPToken::KeyContext *const *ctx, KeyContextWords words, std::size_t k)
+{
+    return _mm256_setr_epi32(
+        static_cast<int>((ctx[0]->*words)[k]), static_cast<int>((ctx[1]->*words)[k]),
+        static_cast<int>((ctx[2]->*words)[k]), static_cast<int>((ctx[3]->*words)[k]),
+        static_cast<int>((ctx[4]->*words)[k]), static_cast<int>((ctx[5]->*words)[k]),
+        static_cast<int>((ctx[6]->*words)[k]), static_cast<int>((ctx[7]->*words)[k]));
+}
+
+// builds the padded inner message block, only the counter differs between lanes
+TARGET_AVX2 static inline void inner_block_x8(__m256i block[16], const std::uint64_t *counters)
+{
+    alignas(32) std::uint32_t hi[8], lo[8];
+    for (std::size_t lane = 0; lane < 8; ++lane)
+    {
+        hi[lane] = static_cast<std::uint32_t>(counters[lane] >> 32);
+        lo[lane] = static_cast<std::uint32_t>(counters[lane]);
+    }
+
+    block[0] = _mm256_load_si256(reinterpret_cast<const __m256i*>(hi));
+    block[1] = _mm256_load_si256(reinterpret_cast<const __m256i*>(lo));
+    block[2] = _mm256_set1_epi32(static_cast<int>(0x80000000));
+    for (auto i = 3; i < 15; ++i)
+    {
+        block[i] = _mm256_setzero_si256();
+    }
+    block[15] = _mm256_set1_epi32((SHA1_BLOCK_SIZE + 8) * 8);
+}
+
+// writes the big-endian digests of all lanes with STRIDE bytes per lane
+TARGET_AVX2 static inline void store_x8(const __m256i *state, std::size_t words, unsigned char *out)
+{
+    alignas(32) std::uint32_t lanes[8][8];
+    for (std::size_t k = 0; k < words; ++k)
+    {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[k]), state[k]);
+    }
+
+    for (std::size_t lane = 0; lane < 8; ++lane)
+    {
+        for (std::size_t k = 0; k < words; ++k)
+        {
+            store_be32(out + lane * BatchHMAC::STRIDE + k * 4, lanes[k][lane]);
+        }
+    }
+}
+
+TARGET_AVX2 static void sha1_compress_x8(__m256i state[5], const __m256i block[16])
+{
+    __m256i w[80];
+    for (auto i = 0; i < 16; ++i)
+    {
+        w[i] = block[i];
+    }
+    for (auto i = 16; i < 80; ++i)
+    {
+        w[i] = rotl_x8(_mm256_xor_si256(_mm256_xor_si256(w[i-3], w[i-8]), _mm256_xor_si256(w[i-14], w[i-16])), 1);
+    }
+
+    __m256i a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+    for (auto i = 0; i < 80; ++i)
+    {
+        __m256i f, k;
+        if (i < 20)
+        {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_andnot_si256(b, d));
+            k = _mm256_set1_epi32(0x5a827999);
+        }
+        else if (i < 40)
+        {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = _mm256_set1_epi32(0x6ed9eba1);
+        }
+        else if (i < 60)
+        {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+            k = _mm256_set1_epi32(static_cast<int>(0x8f1bbcdc));
+        }
+        else
+        {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = _mm256_set1_epi32(static_cast<int>(0xca62c1d6));
+        }
+
+        const __m256i t = add_x8(add_x8(rotl_x8(a, 5), f), add_x8(add_x8(e, k), w[i]));
+        e = d;
+        d = c;
+        c = rotl_x8(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state[0] = add_x8(state[0], a);
+    state[1] = add_x8(state[1], b);
+    state[2] = add_x8(state[2], c);
+    state[3] = add_x8(state[3], d);
+    state[4] = add_x8(state[4], e);
+}
+
+TARGET_AVX2 static void sha256_compress_x8(__m256i state[8], const __m256i block[16])
+{
+    __m256i w[64];
+    for (auto i = 0; i < 16; ++i)
+    {
+        w[i] = block[i];
+    }
+    for (auto i = 16; i < 64; ++i)
+    {
+        const __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(w[i-15], 7), rotr_x8(w[i-15], 18)), _mm256_srli_epi32(w[i-15], 3));
+        const __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(w[i-2], 17), rotr_x8(w[i-2], 19)), _mm256_srli_epi32(w[i-2], 10));
+        w[i] = add_x8(add_x8(w[i-16], s0), add_x8(w[i-7], s1));
+    }
+
+    __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+    __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (auto i = 0; i < 64; ++i)
+    {
+        const __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(e, 6), rotr_x8(e, 11)), rotr_x8(e, 25));
+        const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        const __m256i k = _mm256_set1_epi32(static_cast<int>(SHA256_K[i]));
+        const __m256i t1 = add_x8(add_x8(add_x8(h, S1), add_x8(ch, k)), w[i]);
+        const __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(a, 2), rotr_x8(a, 13)), rotr_x8(a, 22));
+        const __m256i maj = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)), _mm256_and_si256(b, c));
+        const __m256i t2 = add_x8(S0, maj);
+
+        h = g;
+        g = f;
+        f = e;
+        e = add_x8(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = add_x8(t1, t2);
+    }
+
+    state[0] = add_x8(state[0], a);
+    state[1] = add_x8(state[1], b);
+    state[2] = add_x8(state[2], c);
+    state[3] = add_x8(state[3], d);
+    state[4] = add_x8(state[4], e);
+    state[5] = add_x8(state[5], f);
+    state[6] = add_x8(state[6], g);
+    state[7] = add_x8(state[7], h);
+}
+
+TARGET_AVX2 static void hmac_sha1_x8(const OTPToken::KeyContext *const *ctx, const std::uint64_t *counters, unsigned char *out)
+{
+    __m256i state[5];
+    __m256i block[16];
+
+    // inner: H((K ^ ipad) || counter)
+    for (std::size_t k = 0; k < 5; ++k)
+    {
+        state[k] = gather_x8(ctx, &OTPToken::KeyContext::inner32, k);
+    }
+    inner_block_x8(block, counters);
+    sha1_compress_x8(state, block);
+
+    // outer: H((K ^ opad) || inner), the inner digest is already transposed
+    for (std::size_t k = 0; k < 5; ++k)
+    {
+        block[k] = state[k];
+        state[k] = gather_x8(ctx, &OTPToken::KeyContext::outer32, k);
+    }
+    block[5] = _mm256_set1_epi32(static_cast<int>(0x80000000));
+    for (auto i = 6; i < 15; ++i)
+    {
+        block[i] = _mm256_setzero_si256();
+    }
+    block[15] = _mm256_set1_epi32((SHA1_BLOCK_SIZE + SHA1_DIGEST_SIZE) * 8);
+    sha1_compress_x8(state, block);
+
+    store_x8(state, 5, out);
+}
+
+TARGET_AVX2 static void hmac_sha256_x8(const OTPToken::KeyContext *const *ctx, const std::uint64_t *counters, unsigned char *out)
+{
+    __m256i state[8];
+    __m256i block[16];
+
+    // inner: H((K ^ ipad) || counter)
+    for (std::size_t k = 0; k < 8; ++k)
+    {
+        state[k] = gather_x8(ctx, &OTPToken::KeyContext::inner32, k);
+    }
+    inner_block_x8(block, counters);
+    sha256_compress_x8(state, block);
+
+    // outer: H((K ^ opad) || inner), the inner digest is already transposed
+    for (std::size_t k = 0; k < 8; ++k)
+    {
+        block[k] = state[k];
+        state[k] = gather_x8(ctx, &OTPToken::KeyContext::outer32, k);
+    }
+    block[8] = _mm256_set1_epi32(static_cast<int>(0x80000000));
+    for (auto i = 9; i < 15; ++i)
+    {
+        block[i] = _mm256_setzero_si256();
+    }
+    block[15] = _mm256_set1_epi32((SHA256_BLOCK_SIZE + SHA256_DIGEST_SIZE) * 8);
+    sha256_compress_x8(state, block);
+
+    store_x8(state, 8, out);
+}
+
+#undef TARGET_AVX2
+
+static bool cpu_supports_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif // BATCH_HMAC_AVX2
+
+} // anonymous namespace
+
+bool BatchHMAC::accelerated()
+{
+#if BATCH_HMAC_AVX2
+    static const bool avx2 = cpu_supports_avx2();
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+void BatchHMAC::compute(const OTPToken::KeyContext *const *contexts,
+                        const std::uint64_t *counters,
+                        std::size_t count,
+                        unsigned char *out)
+{
+    std::size_t i = 0;
+
+#if BATCH_HMAC_AVX2
+    if (count >= LANES && accelerated())
+    {
+        const auto algorithm = contexts[0]->algorithm;
+        if (algorithm == OTPToken::SHA1)
+        {
+            for (; i + LANES <= count; i += LANES)
+            {
+                hmac_sha1_x8(contexts + i, counters + i, out + i * STRIDE);
+            }
+        }
+        else if (algorithm == OTPToken::SHA256)
+        {
+            for (; i + LANES <= count; i += LANES)
+            {
+                hmac_sha256_x8(contexts + i, counters + i, out + i * STRIDE);
+            }
+        }
+    }
+#endif
+
+    // scalar fallback for SHA-512, remaining tokens and CPUs without a vectorized kernel
+    for (; i < count; ++i)
+    {
+        hmac_compute(*contexts[i], counters[i], out + i * STRIDE);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef CORE_PRIVATE_HMAC_BATCH_HPP
+#define CORE_PRIVATE_HMAC_BATCH_HPP
+
+#include <otptoken.hpp>
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Multi-buffer HMAC engine for many tokens at once.
+ *
+ * An HOTP message is always exactly 8 bytes, so with precomputed key
+ * midstates every HMAC is one inner and one outer block. This allows
+ * hashing independent tokens side by side in SIMD lanes.
+ */
+namespace BatchHMAC
+{
+    // number of tokens hashed side by side by the vectorized kernels
+    static const constexpr std::size_t LANES = 8;
+
+    // output stride per token, large enough for every algorithm
+    static const constexpr std::size_t STRIDE = 64;
+
+    /**
+     * Checks if a vectorized kernel is available on the running CPU.
+     * Otherwise all computations use the scalar implementation.
+     */
+    bool accelerated();
+
+    /**
+     * Computes HMAC(contexts[i], counters[i]) for count tokens which all
+     * use the same algorithm. Digests are written to out with STRIDE bytes
+     * per token. All key contexts must be valid.
+     */
+    void compute(const OTPToken::KeyContext *const *contexts,
+                 const std::uint64_t *counters,
+                 std::size_t count,
+                 unsigned char *out);
+}
+
+#endif // CORE_PRIVATE_HMAC_BATCH_HPP
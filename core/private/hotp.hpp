@@ -0,0 +1,116 @@
+#ifndef CORE_PRIVATE_HOTP_HPP
+#define CORE_PRIVATE_HOTP_HPP
+
+#include "otpgen.hpp"
+
+#include <array>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+namespace
+{
+
+// writes the zero padded token digits into out without a null terminator
+template<std::uint8_t Digits>
+static inline void write_digits(char *out, std::uint64_t token)
+{
+    for (std::size_t i = Digits; i >= 2; i -= 2)
+    {
+        const auto pair = (token % 100) * 2;
+        token /= 100;
+        out[i - 1] = DIGIT_PAIRS[pair + 1];
+        out[i - 2] = DIGIT_PAIRS[pair];
+    }
+
+    if constexpr (Digits % 2 == 1)
+    {
+        out[0] = static_cast<char>('0' + token % 10);
+    }
+}
+
+/**
+ * HOTP code generation specialized for one algorithm and digit count.
+ *
+ * Digest size, truncation offset position and modulus are compile time
+ * constants, so each instantiation is a straight sequence of two hash
+ * blocks, a load and a fixed division without any runtime switches.
+ */
+template<OTPToken::Algorithm Algo, std::uint8_t Digits>
+struct Hotp
+{
+    static_assert(Digits >= 1 && Digits <= MAX_TOKEN_LENGTH, "unsupported digit count");
+
+    static constexpr std::size_t DigestSize = digest_size(Algo);
+    static constexpr std::uint64_t Modulus = DIGITS_POWER[Digits];
+
+    // writes the code for the counter into out and returns its length, no null terminator is written
+    static std::size_t generate(const OTPToken::KeyContext &ctx, std::uint64_t counter, char *out)
+    {
+        unsigned char hmac[DigestSize];
+        hmac_compute<Algo>(ctx, counter, hmac);
+
+        // dynamic truncation, RFC 4226 section 5.3
+        const auto offset = hmac[DigestSize - 1] & 0x0f;
+        const std::uint64_t bin_code = load_be32(hmac + offset) & 0x7fffffff;
+
+        write_digits<Digits>(out, bin_code % Modulus);
+        return Digits;
+    }
+};
+
+// Steam codes always use SHA-1 and their own alphabet
+struct SteamHotp
+{
+    static std::size_t generate(const OTPToken::KeyContext &ctx, std::uint64_t counter, char *out)
+    {
+        unsigned char hmac[SHA1_DIGEST_SIZE];
+        hmac_compute<OTPToken::SHA1>(ctx, counter, hmac);
+
+        const auto offset = hmac[SHA1_DIGEST_SIZE - 1] & 0x0f;
+        write_steam_code(out, static_cast<int>(load_be32(hmac + offset) & 0x7fffffff));
+        return STEAM_DIGITS;
+    }
+};
+
+// a specialized code generator, see Hotp::generate
+using TokenGenerator = std::size_t (*)(const OTPToken::KeyContext &ctx, std::uint64_t counter, char *out);
+
+// generators of one algorithm indexed by digit count, index 0 is unused
+template<OTPToken::Algorithm Algo, std::size_t... Index>
+static constexpr std::array<TokenGenerator, MAX_TOKEN_LENGTH + 1> make_generators(std::index_sequence<Index...>)
+{
+    return {nullptr, &Hotp<Algo, static_cast<std::uint8_t>(Index + 1)>::generate...};
+}
+
+// generator table indexed by [algorithm - 1][digits]
+static constexpr std::array<std::array<TokenGenerator, MAX_TOKEN_LENGTH + 1>, 3> TOKEN_GENERATORS = {
+    make_generators<OTPToken::SHA1>(std::make_index_sequence<MAX_TOKEN_LENGTH>()),
+    make_generators<OTPToken::SHA256>(std::make_index_sequence<MAX_TOKEN_LENGTH>()),
+    make_generators<OTPToken::SHA512>(std::make_index_sequence<MAX_TOKEN_LENGTH>()),
+};
+
+/**
+ * Picks the specialized generator for the given token properties.
+ * Returns nullptr when there is none, for example on invalid digit counts.
+ */
+static inline TokenGenerator select_generator(const OTPToken::Type &type,
+                                              const OTPToken::Algorithm &algo,
+                                              const std::uint8_t &digits)
+{
+    if (type == OTPToken::Steam)
+    {
+        return &SteamHotp::generate;
+    }
+
+    if (algo < OTPToken::SHA1 || algo > OTPToken::SHA512 || !check_otp_length(digits))
+    {
+        return nullptr;
+    }
+
+    return TOKEN_GENERATORS[algo - 1][digits];
+}
+
+} // anonymous namespace
+
+#endif // CORE_PRIVATE_HOTP_HPP
@@ -0,0 +1,238 @@
+#ifndef CORE_PRIVATE_JOURNAL_HPP
+#define CORE_PRIVATE_JOURNAL_HPP
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/aes.h>
+#include <cryptopp/gcm.h>
+#include <cryptopp/hkdf.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/secblock.h>
+#include <cryptopp/sha.h>
+
+/**
+ * Encrypted change journal of the token store.
+ *
+ * The journal lives next to the store file and holds the changes made
+ * since the store file (the snapshot) was last written. All integers
+ * are little endian.
+ *
+ *   header:  "OTPJ", version, 3 reserved bytes, SHA-256 of the snapshot,
+ *            nonce and tag authenticating the preceding header bytes
+ *   records: ciphertext length (u32), nonce, AES-GCM ciphertext, tag
+ *
+ * Every record holds the changes of one commit. The snapshot hash and
+ * the record sequence number are authenticated with each record, so
+ * records can't be reordered, dropped in between or replayed against
+ * another snapshot. A journal whose snapshot hash doesn't match is left
+ * over from before the snapshot was rewritten and is ignored.
+ */
+
+namespace
+{
+    static const constexpr char JOURNAL_MAGIC[4] = {'O', 'T', 'P', 'J'};
+    static const constexpr std::uint8_t JOURNAL_VERSION = 1;
+
+    static const constexpr std::size_t JOURNAL_HASH_SIZE = CryptoPP::SHA256::DIGESTSIZE;
+    static const constexpr std::size_t JOURNAL_KEY_SIZE = CryptoPP::AES::MAX_KEYLENGTH;
+    static const constexpr std::size_t JOURNAL_NONCE_SIZE = 12;
+    static const constexpr std::size_t JOURNAL_TAG_SIZE = 16;
+
+    static const constexpr std::size_t JOURNAL_HEADER_SIZE = 8 + JOURNAL_HASH_SIZE + JOURNAL_NONCE_SIZE + JOURNAL_TAG_SIZE;
+    static const constexpr std::size_t JOURNAL_RECORD_OVERHEAD = 4 + JOURNAL_NONCE_SIZE + JOURNAL_TAG_SIZE;
+
+    // change operations within a record
+    enum JournalOp : std::uint8_t
+    {
+        JournalAdd = 1,
+        JournalRemove,
+        JournalUpdate,
+        JournalClear,
+    };
+
+    enum JournalHeaderState
+    {
+        JournalHeaderValid,
+        JournalHeaderStale,         // torn, unknown version or belongs to another snapshot
+        JournalHeaderForged,        // authentication failed, wrong password or tampered
+    };
+
+    enum JournalRecordState
+    {
+        JournalRecordValid,
+        JournalRecordTorn,          // incomplete final record of an interrupted append
+        JournalRecordForged,        // complete but doesn't authenticate, wrong password or tampered
+    };
+
+    using JournalHash = std::array<unsigned char, JOURNAL_HASH_SIZE>;
+
+    static JournalHash journal_hash(std::string_view snapshot)
+    {
+        JournalHash hash;
+        CryptoPP::SHA256().CalculateDigest(hash.data(), reinterpret_cast<const unsigned char*>(snapshot.data()), snapshot.size());
+        return hash;
+    }
+
+    static CryptoPP::SecByteBlock journal_key(const std::string &password)
+    {
+        static const constexpr char salt[] = "otpgen journal";
+
+        CryptoPP::SecByteBlock key(JOURNAL_KEY_SIZE);
+        CryptoPP::HKDF<CryptoPP::SHA256> hkdf;
+        hkdf.DeriveKey(key, key.size(),
+                       reinterpret_cast<const unsigned char*>(password.data()), password.size(),
+                       reinterpret_cast<const unsigned char*>(salt), sizeof(salt) - 1, nullptr, 0);
+        return key;
+    }
+
+    static void journal_put_u32(unsigned char *out, std::uint32_t value)
+    {
+        for (std::size_t i = 0; i < 4; ++i)
+        {
+            out[i] = static_cast<unsigned char>(value >> (8 * i));
+        }
+    }
+
+    static std::uint32_t journal_get_u32(const unsigned char *in)
+    {
+        std::uint32_t value = 0;
+        for (std::size_t i = 0; i < 4; ++i)
+        {
+            value |= static_cast<std::uint32_t>(in[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    // associated data of a record: snapshot hash and sequence number
+    static std::array<unsigned char, JOURNAL_HASH_SIZE + 8> journal_record_aad(const JournalHash &snapshot, std::uint64_t sequence)
+    {
+        std::array<unsigned char, JOURNAL_HASH_SIZE + 8> aad;
+        std::memcpy(aad.data(), snapshot.data(), snapshot.size());
+        for (std::size_t i = 0; i < 8; ++i)
+        {
+            aad[JOURNAL_HASH_SIZE + i] = static_cast<unsigned char>(sequence >> (8 * i));
+        }
+        return aad;
+    }
+
+    static std::string journal_header(const CryptoPP::SecByteBlock &key, const JournalHash &snapshot)
+    {
+        std::string header(JOURNAL_HEADER_SIZE, '\0');
+        auto *out = reinterpret_cast<unsigned char*>(header.data());
+
+        std::memcpy(out, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        out[4] = JOURNAL_VERSION;
+        std::memcpy(out + 8, snapshot.data(), snapshot.size());
+
+        auto *nonce = out + 8 + JOURNAL_HASH_SIZE;
+        CryptoPP::AutoSeededRandomPool rng;
+        rng.GenerateBlock(nonce, JOURNAL_NONCE_SIZE);
+
+        // empty message, the tag only authenticates the header
+        CryptoPP::GCM<CryptoPP::AES>::Encryption gcm;
+        gcm.SetKeyWithIV(key, key.size(), nonce, JOURNAL_NONCE_SIZE);
+        gcm.EncryptAndAuthenticate(nullptr, nonce + JOURNAL_NONCE_SIZE, JOURNAL_TAG_SIZE,
+                                   nonce, JOURNAL_NONCE_SIZE, out, 8 + JOURNAL_HASH_SIZE, nullptr, 0);
+        return header;
+    }
+
+    static JournalHeaderState journal_check_header(const CryptoPP::SecByteBlock &key, std::string_view journal, const JournalHash &snapshot)
+    {
+        if (journal.size() < JOURNAL_HEADER_SIZE)
+        {
+            return JournalHeaderStale;
+        }
+
+        const auto *in = reinterpret_cast<const unsigned char*>(journal.data());
+        if (std::memcmp(in, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 || in[4] != JOURNAL_VERSION ||
+            std::memcmp(in + 8, snapshot.data(), snapshot.size()) != 0)
+        {
+            return JournalHeaderStale;
+        }
+
+        const auto *nonce = in + 8 + JOURNAL_HASH_SIZE;
+        CryptoPP::GCM<CryptoPP::AES>::Decryption gcm;
+        gcm.SetKeyWithIV(key, key.size(), nonce, JOURNAL_NONCE_SIZE);
+        if (!gcm.DecryptAndVerify(nullptr, nonce + JOURNAL_NONCE_SIZE, JOURNAL_TAG_SIZE,
+                                  nonce, JOURNAL_NONCE_SIZE, in, 8 + JOURNAL_HASH_SIZE, nullptr, 0))
+        {
+            return JournalHeaderForged;
+        }
+        return JournalHeaderValid;
+    }
+
+    // encrypts the changes of one commit into a record
+    static std::string journal_seal(const CryptoPP::SecByteBlock &key, const JournalHash &snapshot,
+                                    std::uint64_t sequence, const std::string &changes)
+    {
+        std::string record(JOURNAL_RECORD_OVERHEAD + changes.size(), '\0');
+        auto *out = reinterpret_cast<unsigned char*>(record.data());
+
+        journal_put_u32(out, static_cast<std::uint32_t>(changes.size() + JOURNAL_TAG_SIZE));
+
+        auto *nonce = out + 4;
+        auto *ciphertext = nonce + JOURNAL_NONCE_SIZE;
+        CryptoPP::AutoSeededRandomPool rng;
+        rng.GenerateBlock(nonce, JOURNAL_NONCE_SIZE);
+
+        const auto aad = journal_record_aad(snapshot, sequence);
+        CryptoPP::GCM<CryptoPP::AES>::Encryption gcm;
+        gcm.SetKeyWithIV(key, key.size(), nonce, JOURNAL_NONCE_SIZE);
+        gcm.EncryptAndAuthenticate(ciphertext, ciphertext + changes.size(), JOURNAL_TAG_SIZE,
+                                   nonce, JOURNAL_NONCE_SIZE, aad.data(), aad.size(),
+                                   reinterpret_cast<const unsigned char*>(changes.data()), changes.size());
+        return record;
+    }
+
+    // decrypts the record at the given offset and moves the offset to the next record
+    //
+    // only a record which runs past the end of the journal is torn, an append
+    // never leaves anything behind it. A complete record which doesn't
+    // authenticate is forged, no matter if more records follow it.
+    static JournalRecordState journal_open(const CryptoPP::SecByteBlock &key, const JournalHash &snapshot, std::uint64_t sequence,
+                                           std::string_view journal, std::size_t &offset, std::string &changes)
+    {
+        const auto remaining = journal.size() - offset;
+        if (remaining < 4)
+        {
+            return JournalRecordTorn;
+        }
+
+        const auto *in = reinterpret_cast<const unsigned char*>(journal.data()) + offset;
+        const std::size_t length = journal_get_u32(in);
+        if (length < JOURNAL_TAG_SIZE)
+        {
+            return JournalRecordForged;
+        }
+        else if (remaining < 4 + JOURNAL_NONCE_SIZE + length)
+        {
+            return JournalRecordTorn;
+        }
+
+        const auto *nonce = in + 4;
+        const auto *ciphertext = nonce + JOURNAL_NONCE_SIZE;
+        const auto size = length - JOURNAL_TAG_SIZE;
+        changes.resize(size);
+
+        const auto aad = journal_record_aad(snapshot, sequence);
+        CryptoPP::GCM<CryptoPP::AES>::Decryption gcm;
+        gcm.SetKeyWithIV(key, key.size(), nonce, JOURNAL_NONCE_SIZE);
+        if (!gcm.DecryptAndVerify(reinterpret_cast<unsigned char*>(changes.data()), ciphertext + size, JOURNAL_TAG_SIZE,
+                                  nonce, JOURNAL_NONCE_SIZE, aad.data(), aad.size(), ciphertext, size))
+        {
+            changes.clear();
+            return JournalRecordForged;
+        }
+
+        offset += 4 + JOURNAL_NONCE_SIZE + length;
+        return JournalRecordValid;
+    }
+}
+
+#endif // CORE_PRIVATE_JOURNAL_HPP
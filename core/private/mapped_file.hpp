@@ -0,0 +1,168 @@
+#ifndef CORE_PRIVATE_MAPPED_FILE_HPP
+#define CORE_PRIVATE_MAPPED_FILE_HPP
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+    // smaller files are read, setting up a mapping costs more than copying them
+    static const constexpr std::size_t MAP_THRESHOLD = 64 * 1024;
+
+    // read-only view of an entire file, memory mapped where possible so
+    // reading doesn't copy the contents into a buffer first
+    //
+    // files are replaced by renaming, so a mapped file never changes while
+    // it is mapped, truncating it would make reading the mapping fail
+    class MappedFile final
+    {
+    public:
+        MappedFile() = default;
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator= (const MappedFile &) = delete;
+
+        ~MappedFile()
+        {
+            this->close();
+        }
+
+        bool open(const std::string &filePath)
+        {
+            this->close();
+
+#if defined(_WIN32)
+            std::ifstream file(filePath, std::ios_base::binary | std::ios_base::ate);
+            if (!file.is_open())
+            {
+                return false;
+            }
+
+            this->_buffer.resize(static_cast<std::size_t>(file.tellg()));
+            file.seekg(0, std::ios_base::beg);
+            file.read(this->_buffer.data(), static_cast<std::streamsize>(this->_buffer.size()));
+            if (file.fail())
+            {
+                this->_buffer.clear();
+                return false;
+            }
+
+            this->_data = this->_buffer.data();
+            this->_size = this->_buffer.size();
+#else
+            const auto fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return false;
+            }
+
+            struct stat info;
+            if (::fstat(fd, &info) != 0)
+            {
+                ::close(fd);
+                return false;
+            }
+
+            // empty files can't be mapped and don't need to be
+            this->_size = static_cast<std::size_t>(info.st_size);
+            if (this->_size > 0 && this->_size < MAP_THRESHOLD)
+            {
+                const auto read = this->readAll(fd);
+                ::close(fd);
+                return read;
+            }
+            else if (this->_size > 0)
+            {
+                auto *mapping = ::mmap(nullptr, this->_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapping == MAP_FAILED)
+                {
+                    // file systems without mmap support are read the usual way
+                    const auto read = this->readAll(fd);
+                    ::close(fd);
+                    return read;
+                }
+
+                ::madvise(mapping, this->_size, MADV_SEQUENTIAL);
+                this->_data = static_cast<const char*>(mapping);
+                this->_mapped = true;
+            }
+
+            // the mapping stays valid without the descriptor
+            ::close(fd);
+#endif
+
+            this->_open = true;
+            return true;
+        }
+
+        void close()
+        {
+#if !defined(_WIN32)
+            if (this->_mapped)
+            {
+                ::munmap(const_cast<char*>(this->_data), this->_size);
+            }
+#endif
+
+            this->_buffer.clear();
+            this->_buffer.shrink_to_fit();
+            this->_data = nullptr;
+            this->_size = 0;
+            this->_mapped = false;
+            this->_open = false;
+        }
+
+        inline bool isOpen() const
+        {
+            return this->_open;
+        }
+
+        inline std::string_view data() const
+        {
+            return std::string_view(this->_data, this->_size);
+        }
+
+    private:
+#if !defined(_WIN32)
+        bool readAll(int fd)
+        {
+            this->_buffer.resize(this->_size);
+
+            std::size_t offset = 0;
+            while (offset < this->_size)
+            {
+                const auto count = ::read(fd, this->_buffer.data() + offset, this->_size - offset);
+                if (count <= 0)
+                {
+                    this->_buffer.clear();
+                    this->_size = 0;
+                    return false;
+                }
+                offset += static_cast<std::size_t>(count);
+            }
+
+            this->_data = this->_buffer.data();
+            this->_open = true;
+            return true;
+        }
+#endif
+
+        const char *_data = nullptr;
+        std::size_t _size = 0;
+        bool _mapped = false;
+        bool _open = false;
+        std::string _buffer;    // holds small files and files which can't be mapped
+    };
+}
+
+#endif // CORE_PRIVATE_MAPPED_FILE_HPP
@@ -1,26 +1,31 @@
 #ifndef CORE_PRIVATE_OTPGEN_HPP
 #define CORE_PRIVATE_OTPGEN_HPP
 
-#include <cryptopp/filters.h>
-#include <cryptopp/base32.h>
-#include <cryptopp/base64.h>
-#include <cryptopp/hmac.h>
-#include <cryptopp/sha.h>
+#include "hmac.hpp"
+#include "basen.hpp"
+#include "steam.hpp"
 
 #include <otptoken.hpp>
 
-#include <cstdlib>
+#include <string_view>
+#include <vector>
 #include <cstdint>
+#include <cstring>
 #include <ctime>
 
 namespace
 {
 
-static const CryptoPP::byte ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+// longest possible token, see check_otp_length
+static const constexpr std::size_t MAX_TOKEN_LENGTH = OTPToken::MaxTokenLength;
 
-static const constexpr auto SHA1_DIGEST_SIZE = 20;
-static const constexpr auto SHA256_DIGEST_SIZE = 32;
-static const constexpr auto SHA512_DIGEST_SIZE = 64;
+// two-digit lookup table for the token formatting
+static const constexpr char DIGIT_PAIRS[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
 
 static const constexpr std::uint64_t DIGITS_POWER[] = {
     1,
@@ -36,198 +41,152 @@ static const constexpr std::uint64_t DIGITS_POWER[] = {
     10000000000,
 };
 
-static const std::string normalize_secret(const std::string &secret)
+// secrets up to this size are decoded on the stack
+static const constexpr std::size_t SECRET_STACK_BUFFER_SIZE = 256;
+
+// decodes the token secret and precomputes the HMAC midstates for it
+static inline const OTPToken::KeyContext make_key_context(std::string_view key, const OTPToken::Algorithm &algo)
 {
-    auto nK = static_cast<char*>(std::calloc(1, secret.size() + 1));
+    OTPToken::KeyContext ctx;
+    ctx.algorithm = algo;
 
-    std::size_t i = 0, j = 0;
-    while (secret[i] != '\0')
+    // hmac_prepare and hmac_compute only know these
+    if (algo != OTPToken::SHA1 && algo != OTPToken::SHA256 && algo != OTPToken::SHA512)
     {
-        if (secret[i] != ' ')
-        {
-            if (secret[i] >= 'a' && secret[i] <= 'z')
-            {
-                nK[j++] = static_cast<char>( (secret[i] - 32) );
-            }
-            else
-            {
-                nK[j++] = secret[i];
-            }
-        }
-        i++;
+        ctx.error = OTPToken::InvalidAlgorithm;
+        return ctx;
     }
 
-    std::string normalized(nK, nK + strlen(nK));
-    std::free(nK);
-    return normalized;
-}
+    unsigned char stack_buffer[SECRET_STACK_BUFFER_SIZE];
+    std::vector<unsigned char> heap_buffer;
+    unsigned char *secret = stack_buffer;
 
-static const std::string base32_rfc4648_decode(const std::string &key)
-{
-    if (key.empty())
+    const auto max_size = BaseN::base32DecodedSize(key.size());
+    if (max_size > sizeof(stack_buffer))
     {
-        return {};
+        heap_buffer.resize(max_size);
+        secret = heap_buffer.data();
     }
 
-    // create an RFC 4648 base-32 decoder
-    // crypto++ uses DUDE by default which isn't TOTP compatible
-    auto decoder = new CryptoPP::Base32Decoder();
-
-    static int lookup[256];
-
-    static const auto init = ([&]{
-        CryptoPP::Base64Decoder::InitializeDecodingLookupArray(lookup, ALPHABET, 32, true);
-        return 0;
-    })();
-    (void) init;
-
-    static const CryptoPP::AlgorithmParameters params = CryptoPP::MakeParameters(
-                                                        CryptoPP::Name::DecodingLookupArray(),
-                                                        static_cast<const int*>(lookup));
-    decoder->IsolatedInitialize(params);
-
-    // raw pointers are automatically deleted by crypto++
-    std::string base32;
-    decoder->Attach(new CryptoPP::StringSink(base32));
+    // normalize and decode secret in one pass
+    const auto size = BaseN::base32Decode(key, secret);
 
-    // result may be binary (unsigned char)
-    try {
-        CryptoPP::StringSource(key, true, decoder);
-    } catch (...) {
-        return {};
+    // don't continue on empty secret
+    if (size == 0)
+    {
+        ctx.error = OTPToken::InvalidBase32Input;
+        return ctx;
     }
 
-    return base32;
+    hmac_prepare(ctx, secret, size, algo);
+
+    // don't leave key material behind
+    std::memset(secret, 0, size);
+    return ctx;
 }
 
-// template helper function to compute HMAC's of different SHA algorithms
-template<class CryptoPPHMacClass>
-static inline const std::string compute_hmac_helper(const std::string &key, unsigned char value[8])
+static inline int compute_bin_code(const unsigned char *hmac, unsigned long offset)
 {
-    CryptoPPHMacClass cryptoHmac(reinterpret_cast<const unsigned char*>(key.data()), key.size());
-
-    std::string hmac;
-    CryptoPP::StringSource(value, 8, true,
-        new CryptoPP::HashFilter(cryptoHmac,
-            new CryptoPP::StringSink(hmac)));
-
-    return hmac;
+    // starting from the offset, take the successive 4 bytes while stripping
+    // the topmost bit to prevent it being handled as a signed integer
+    return
+        ((hmac[offset] & 0x7f) << 24) |
+        ((hmac[offset + 1] & 0xff) << 16) |
+        ((hmac[offset + 2] & 0xff) << 8) |
+        ((hmac[offset + 3] & 0xff));
 }
 
-static const std::string compute_hmac(const std::string &key, long C, const OTPToken::Algorithm &algo)
+static inline int truncate(const unsigned char *hmac, std::size_t hmac_size, const std::uint8_t &digit_length)
 {
-    // normalize and decode secret
-    const auto normalized_key = normalize_secret(key);
-    const auto secret = base32_rfc4648_decode(normalized_key);
+    // take the lower four bits of the last byte
+    const unsigned long offset = (hmac[hmac_size-1] & 0x0f);
 
-    // don't continue on empty secret
-    if (secret.empty())
-    {
-        return {};
-    }
+    auto bin_code = compute_bin_code(hmac, offset);
+    int token = bin_code % DIGITS_POWER[digit_length];
+    return token;
+}
 
-    // calculate reverse byte order of C
-    unsigned char C_reverse_byte_order[8];
-    int j, i;
-    for (j = 0, i = 7; j < 8 && i >= 0; ++j, --i)
+// writes the zero padded token digits into out without a null terminator
+static inline void write_digits(char *out, const std::uint8_t &digit_length, std::uint64_t token)
+{
+    auto i = digit_length;
+    while (i >= 2)
     {
-        C_reverse_byte_order[i] = (reinterpret_cast<unsigned char*>(&C))[j];
+        const auto pair = (token % 100) * 2;
+        token /= 100;
+        out[i - 1] = DIGIT_PAIRS[pair + 1];
+        out[i - 2] = DIGIT_PAIRS[pair];
+        i -= 2;
     }
 
-    // compute the HMAC and store it into a string
-    std::string hmac;
-    switch (algo)
+    if (i == 1)
     {
-        case OTPToken::SHA1:   hmac = compute_hmac_helper<CryptoPP::HMAC<CryptoPP::SHA1>>(secret, C_reverse_byte_order); break;
-        case OTPToken::SHA256: hmac = compute_hmac_helper<CryptoPP::HMAC<CryptoPP::SHA256>>(secret, C_reverse_byte_order); break;
-        case OTPToken::SHA512: hmac = compute_hmac_helper<CryptoPP::HMAC<CryptoPP::SHA512>>(secret, C_reverse_byte_order); break;
+        out[0] = static_cast<char>('0' + token % 10);
     }
+}
 
-    // validate HMAC
-    if (hmac.empty())
+// writes the steam token into out without a null terminator
+static inline void write_steam_code(char *out, int bin_code)
+{
+    for (auto i = 0; i < STEAM_DIGITS; ++i)
     {
-        return {};
+        const auto mod = bin_code % STEAM_ALPHABET_SIZE;
+        bin_code = bin_code / STEAM_ALPHABET_SIZE;
+        out[i] = STEAM_ALPHABET[mod];
     }
-
-    return hmac;
 }
 
-static const std::string finalize(const std::uint8_t &digit_length, int tk)
+// formats the token from the computed HMAC into out and returns its length, no null terminator is written
+static inline std::size_t format_token(const unsigned char *hmac,
+                                       std::size_t hmac_size,
+                                       const OTPToken::Type &type,
+                                       const std::uint8_t &digits,
+                                       char *out)
 {
-    auto token = static_cast<char*>(std::malloc(digit_length + 1));
-
-    int extra_char = digit_length < 10 ? 0 : 1;
-    auto fmt = static_cast<char*>(std::calloc(1, 5 + extra_char));
-    std::memcpy(fmt, "%.", 2);
-    std::snprintf(fmt + 2, 2 + extra_char, "%d", digit_length);
-    std::memcpy(fmt + 3 + extra_char, "d", 2);
-    std::snprintf(token, digit_length + 1, fmt, tk);
-    std::free(fmt);
-
-    std::string tokenStr(token, token + strlen(token));
-    std::free(token);
-    return tokenStr;
-}
+    if (type == OTPToken::Steam)
+    {
+        const unsigned long offset = (hmac[hmac_size-1] & 0x0f);
+        write_steam_code(out, compute_bin_code(hmac, offset));
+        return STEAM_DIGITS;
+    }
 
-static int compute_bin_code(const std::string &hmac, unsigned long offset)
-{
-    // starting from the offset, take the successive 4 bytes while stripping
-    // the topmost bit to prevent it being handled as a signed integer
-    return
-        ((hmac[offset] & 0x7f) << 24) |
-        ((hmac[offset + 1] & 0xff) << 16) |
-        ((hmac[offset + 2] & 0xff) << 8) |
-        ((hmac[offset + 3] & 0xff));
+    write_digits(out, digits, truncate(hmac, hmac_size, digits));
+    return digits;
 }
 
-static int truncate(const std::string &hmac, const std::uint8_t &digit_length, const OTPToken::Algorithm algo)
+/**
+ * Computes the token for the given counter into out and returns its length.
+ * The out buffer must have room for at least MAX_TOKEN_LENGTH characters,
+ * no null terminator is written. The key context must be valid.
+ */
+static inline std::size_t write_token(const OTPToken::KeyContext &ctx,
+                                      const OTPToken::Type &type,
+                                      const std::uint64_t &counter,
+                                      const std::uint8_t &digits,
+                                      char *out)
 {
-    // take the lower four bits of the last byte
-    unsigned long offset = 0;
-    switch (algo)
-    {
-        case OTPToken::SHA1:
-            offset = (hmac[SHA1_DIGEST_SIZE-1] & 0x0f);
-            break;
-        case OTPToken::SHA256:
-            offset = (hmac[SHA256_DIGEST_SIZE-1] & 0x0f);
-            break;
-        case OTPToken::SHA512:
-            offset = (hmac[SHA512_DIGEST_SIZE-1] & 0x0f);
-            break;
-    }
-
-    auto bin_code = compute_bin_code(hmac, offset);
-    int token = bin_code % DIGITS_POWER[digit_length];
-    return token;
+    unsigned char hmac[HMAC_MAX_DIGEST_SIZE];
+    const auto hmac_size = hmac_compute(ctx, counter, hmac);
+    return format_token(hmac, hmac_size, type, digits, out);
 }
 
-static const std::string hotp_helper(const std::string &base32_secret,
-                                     const std::time_t &counter,
-                                     const std::uint8_t &digits,
-                                     const OTPToken::Algorithm &algo,
-                                     OTPToken::Error *error = nullptr)
+// compares two buffers of the same length without data dependent branches
+static inline bool constant_time_equals(const char *a, const char *b, std::size_t length)
 {
-    const auto hmac = compute_hmac(base32_secret, counter, algo);
-    if (hmac.empty())
+    unsigned char diff = 0;
+    for (std::size_t i = 0; i < length; ++i)
     {
-        if (error)
-        {
-            (*error) = OTPToken::InvalidBase32Input;
-        }
-        return {};
+        diff |= static_cast<unsigned char>(a[i] ^ b[i]);
     }
-
-    auto tk = truncate(hmac, digits, algo);
-    return finalize(digits, tk);
+    return diff == 0;
 }
 
-static bool check_period(const std::uint32_t &period)
+static inline bool check_period(const std::uint32_t &period)
 {
     return !(period <= 0 || period > 120);
 }
 
-static bool check_otp_length(const std::uint8_t &digit_length)
+static inline bool check_otp_length(const std::uint8_t &digit_length)
 {
     return !(digit_length < 1 || digit_length > 10);
 }
@@ -0,0 +1,156 @@
+#ifndef CORE_PRIVATE_PARALLEL_HPP
+#define CORE_PRIVATE_PARALLEL_HPP
+
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+/**
+ * Helpers spreading the work of reading and writing a store file across
+ * threads. The calling thread always takes part, so a single thread runs
+ * everything on the calling thread without starting any threads.
+ */
+
+namespace
+{
+    // number of threads to use, 0 uses one thread per core
+    static unsigned worker_threads(unsigned requested)
+    {
+        return requested > 0 ? requested : std::max(1U, std::thread::hardware_concurrency());
+    }
+
+    // runs the worker on the given number of threads, the calling thread
+    // runs it with `true`, the others with `false`
+    template<typename Worker>
+    static void run_parallel(unsigned threads, Worker worker)
+    {
+        std::vector<std::thread> workers;
+        workers.reserve(threads > 1 ? threads - 1 : 0);
+        for (auto i = 1U; i < threads; ++i)
+        {
+            workers.emplace_back(worker, false);
+        }
+        worker(true);
+        for (auto&& thread : workers)
+        {
+            thread.join();
+        }
+    }
+
+    // produces the given number of items on several threads and passes them
+    // to the consumer on the calling thread in order
+    //
+    // every thread creates its own producer, `bool(std::size_t index, Item &item)`,
+    // with `makeProducer()`. At most two items per thread are produced ahead
+    // of the consumer, `bool(std::size_t index, Item &item)`, so memory stays
+    // bounded however many items there are. Items are reused, producers have
+    // to reset them. Returns false as soon as a producer or the consumer fails.
+    template<typename Item, typename MakeProducer, typename Consume>
+    static bool run_ordered(unsigned threads, std::size_t count, MakeProducer makeProducer, Consume consume)
+    {
+        threads = static_cast<unsigned>(std::min<std::size_t>(std::max(1U, threads), std::max<std::size_t>(count, 1)));
+        const auto window = std::size_t(threads) * 2;
+        std::vector<Item> items(std::min(window, count));
+        std::vector<char> produced(items.size(), false);
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::size_t next = 0;       // next item to produce
+        std::size_t consumed = 0;   // items handed to the consumer
+        bool failed = false;
+
+        // claims the next item within the window, the mutex must be held
+        const auto claim = [&](std::size_t &index) {
+            if (failed || next == count || next == consumed + window)
+            {
+                return false;
+            }
+            index = next++;
+            return true;
+        };
+
+        // produces an item without holding the mutex
+        const auto produce = [&](auto &producer, std::unique_lock<std::mutex> &lock, std::size_t index) {
+            lock.unlock();
+            bool ok = false;
+            try {
+                ok = producer(index, items[index % window]);
+            } catch (...) {
+            }
+            lock.lock();
+            produced[index % window] = true;
+            failed = failed || !ok;
+            changed.notify_all();
+        };
+
+        run_parallel(threads, [&](bool caller) {
+            std::unique_lock<std::mutex> lock(mutex);
+            try {
+                lock.unlock();
+                auto producer = makeProducer();
+                lock.lock();
+
+                if (!caller)
+                {
+                    while (true)
+                    {
+                        std::size_t index;
+                        bool claimed = false;
+                        changed.wait(lock, [&]{ return failed || next == count || (claimed = claim(index)); });
+                        if (!claimed)
+                        {
+                            return;
+                        }
+                        produce(producer, lock, index);
+                    }
+                }
+
+                // the calling thread helps producing while waiting for the next item
+                while (consumed < count && !failed)
+                {
+                    const auto slot = consumed % window;
+                    if (!produced[slot])
+                    {
+                        std::size_t index;
+                        if (claim(index))
+                        {
+                            produce(producer, lock, index);
+                        }
+                        else
+                        {
+                            changed.wait(lock);
+                        }
+                        continue;
+                    }
+
+                    lock.unlock();
+                    const auto ok = consume(consumed, items[slot]);
+                    lock.lock();
+                    produced[slot] = false;
+                    ++consumed;
+                    failed = failed || !ok;
+                    changed.notify_all();
+                }
+            } catch (...) {
+                if (!lock.owns_lock())
+                {
+                    lock.lock();
+                }
+                failed = true;
+            }
+
+            if (caller)
+            {
+                failed = failed || consumed < count;
+            }
+            changed.notify_all();
+        });
+
+        return !failed;
+    }
+}
+
+#endif // CORE_PRIVATE_PARALLEL_HPP
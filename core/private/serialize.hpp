@@ -21,7 +21,7 @@ void save(Archive &archive, const OTPToken &token)
         token._counter,
         token._type,
         token._algorithm,
-        token._icon
+        token.icon()
     );
 }
 
@@ -31,6 +31,7 @@ void load(Archive &archive, OTPToken &token)
     // TODO: version check
 
     std::uint32_t version;
+    OTPToken::Data icon;
     archive(
         version,
         token._label,
@@ -40,8 +41,119 @@ void load(Archive &archive, OTPToken &token)
         token._counter,
         token._type,
         token._algorithm,
-        token._icon
+        icon
     );
+    token.setIcon(icon);
+
+    // properties changed, drop any cached key state
+    token._keyContext.reset();
+    token._fingerprint.reset();
 }
 
+// token records of store files which keep icons in a separate section
+struct StoredToken
+{
+    // version 3 record, which references the icon by its position in the
+    // icon section and its digest, tokens sharing an icon reference the
+    // same position; only read, newer stores seal every record on its own
+    template<class Archive>
+    static void load(Archive &archive, OTPToken &token, const std::shared_ptr<const OTPToken::IconSource> &icons)
+    {
+        std::uint32_t version;
+        std::uint64_t iconOffset;
+        std::uint32_t iconLength;
+        OTPToken::IconDigest iconDigest;
+        archive(
+            version,
+            token._label,
+            token._secret,
+            token._digits,
+            token._period,
+            token._counter,
+            token._type,
+            token._algorithm,
+            iconOffset,
+            iconLength,
+            cereal::binary_data(iconDigest.data(), iconDigest.size())
+        );
+
+        // the icon is loaded on first access, unless the pool already has it
+        token._icon = iconLength > 0 ? OTPToken::Icon::intern(iconDigest, icons, iconOffset, iconLength) : nullptr;
+
+        token._keyContext.reset();
+        token._fingerprint.reset();
+    }
+
+    // record sealed on its own, which references the icon by its digest
+    // only, so it doesn't depend on the layout of the icon section
+    template<class Archive>
+    static void saveRecord(Archive &archive, const OTPToken &token)
+    {
+        static const OTPToken::IconDigest none{};
+        const auto &iconDigest = token._icon ? token._icon->digest : none;
+
+        archive(
+            OTPToken::VERSION,
+            token._label,
+            token._secret,
+            token._digits,
+            token._period,
+            token._counter,
+            token._type,
+            token._algorithm,
+            static_cast<std::uint32_t>(token.iconSize()),
+            cereal::binary_data(iconDigest.data(), iconDigest.size())
+        );
+    }
+
+    // the caller looks up the icon by its digest
+    template<class Archive>
+    static void loadRecord(Archive &archive, OTPToken &token, std::uint32_t &iconLength, OTPToken::IconDigest &iconDigest)
+    {
+        std::uint32_t version;
+        archive(
+            version,
+            token._label,
+            token._secret,
+            token._digits,
+            token._period,
+            token._counter,
+            token._type,
+            token._algorithm,
+            iconLength,
+            cereal::binary_data(iconDigest.data(), iconDigest.size())
+        );
+
+        token._icon = nullptr;
+        token._keyContext.reset();
+        token._fingerprint.reset();
+    }
+
+    // record of version 2 store files, which reference the icon by its
+    // position and content hash, the caller loads the icon
+    template<class Archive>
+    static void loadUnpooled(Archive &archive, OTPToken &token, std::uint64_t &iconOffset, std::uint32_t &iconLength)
+    {
+        std::uint32_t version;
+        std::uint64_t iconHash;
+        archive(
+            version,
+            token._label,
+            token._secret,
+            token._digits,
+            token._period,
+            token._counter,
+            token._type,
+            token._algorithm,
+            iconOffset,
+            iconLength,
+            iconHash
+        );
+
+        token._icon = nullptr;
+        token._keyContext.reset();
+        token._fingerprint.reset();
+    }
+};
+
 #endif // CORE_PRIVATE_SERIALIZE_HPP
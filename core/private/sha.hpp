@@ -0,0 +1,322 @@
+#ifndef CORE_PRIVATE_SHA_HPP
+#define CORE_PRIVATE_SHA_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/**
+ * Scalar SHA-1, SHA-256 and SHA-512 block functions.
+ *
+ * The HMAC code only needs direct access to the compression functions
+ * to keep precomputed key midstates around, which the crypto++ hash
+ * classes don't expose. Full message hashing is only used for keys
+ * which are longer than one block.
+ */
+
+namespace
+{
+
+static const constexpr std::size_t SHA1_BLOCK_SIZE = 64;
+static const constexpr std::size_t SHA256_BLOCK_SIZE = 64;
+static const constexpr std::size_t SHA512_BLOCK_SIZE = 128;
+
+static const constexpr std::uint32_t SHA1_INIT[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+static const constexpr std::uint32_t SHA256_INIT[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const constexpr std::uint64_t SHA512_INIT[8] = {
+    0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
+    0x510e527fade682d1, 0x9b05688c2b3e6c1f, 0x1f83d9abfb41bd6b, 0x5be0cd19137e2179,
+};
+
+static const constexpr std::uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const constexpr std::uint64_t SHA512_K[80] = {
+    0x428a2f98d728ae22, 0x7137449123ef65cd, 0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc,
+    0x3956c25bf348b538, 0x59f111f1b605d019, 0x923f82a4af194f9b, 0xab1c5ed5da6d8118,
+    0xd807aa98a3030242, 0x12835b0145706fbe, 0x243185be4ee4b28c, 0x550c7dc3d5ffb4e2,
+    0x72be5d74f27b896f, 0x80deb1fe3b1696b1, 0x9bdc06a725c71235, 0xc19bf174cf692694,
+    0xe49b69c19ef14ad2, 0xefbe4786384f25e3, 0x0fc19dc68b8cd5b5, 0x240ca1cc77ac9c65,
+    0x2de92c6f592b0275, 0x4a7484aa6ea6e483, 0x5cb0a9dcbd41fbd4, 0x76f988da831153b5,
+    0x983e5152ee66dfab, 0xa831c66d2db43210, 0xb00327c898fb213f, 0xbf597fc7beef0ee4,
+    0xc6e00bf33da88fc2, 0xd5a79147930aa725, 0x06ca6351e003826f, 0x142929670a0e6e70,
+    0x27b70a8546d22ffc, 0x2e1b21385c26c926, 0x4d2c6dfc5ac42aed, 0x53380d139d95b3df,
+    0x650a73548baf63de, 0x766a0abb3c77b2a8, 0x81c2c92e47edaee6, 0x92722c851482353b,
+    0xa2bfe8a14cf10364, 0xa81a664bbc423001, 0xc24b8b70d0f89791, 0xc76c51a30654be30,
+    0xd192e819d6ef5218, 0xd69906245565a910, 0xf40e35855771202a, 0x106aa07032bbd1b8,
+    0x19a4c116b8d2d0c8, 0x1e376c085141ab53, 0x2748774cdf8eeb99, 0x34b0bcb5e19b48a8,
+    0x391c0cb3c5c95a63, 0x4ed8aa4ae3418acb, 0x5b9cca4f7763e373, 0x682e6ff3d6b2b8a3,
+    0x748f82ee5defb2fc, 0x78a5636f43172f60, 0x84c87814a1f0ab72, 0x8cc702081a6439ec,
+    0x90befffa23631e28, 0xa4506cebde82bde9, 0xbef9a3f7b2c67915, 0xc67178f2e372532b,
+    0xca273eceea26619c, 0xd186b8c721c0c207, 0xeada7dd6cde0eb1e, 0xf57d4f7fee6ed178,
+    0x06f067aa72176fba, 0x0a637dc5a2c898a6, 0x113f9804bef90dae, 0x1b710b35131c471b,
+    0x28db77f523047d84, 0x32caab7b40c72493, 0x3c9ebe0a15c9bebc, 0x431d67c49c100d4c,
+    0x4cc5d4becb3e42b6, 0x597f299cfc657e2a, 0x5fcb6fab3ad6faec, 0x6c44198c4a475817,
+};
+
+static inline std::uint32_t rotl32(std::uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static inline std::uint32_t rotr32(std::uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline std::uint64_t rotr64(std::uint64_t x, int n)
+{
+    return (x >> n) | (x << (64 - n));
+}
+
+static inline std::uint32_t load_be32(const unsigned char *p)
+{
+    return
+        (static_cast<std::uint32_t>(p[0]) << 24) |
+        (static_cast<std::uint32_t>(p[1]) << 16) |
+        (static_cast<std::uint32_t>(p[2]) << 8) |
+        (static_cast<std::uint32_t>(p[3]));
+}
+
+static inline std::uint64_t load_be64(const unsigned char *p)
+{
+    return (static_cast<std::uint64_t>(load_be32(p)) << 32) | load_be32(p + 4);
+}
+
+static inline void store_be32(unsigned char *p, std::uint32_t v)
+{
+    p[0] = static_cast<unsigned char>(v >> 24);
+    p[1] = static_cast<unsigned char>(v >> 16);
+    p[2] = static_cast<unsigned char>(v >> 8);
+    p[3] = static_cast<unsigned char>(v);
+}
+
+static inline void store_be64(unsigned char *p, std::uint64_t v)
+{
+    store_be32(p, static_cast<std::uint32_t>(v >> 32));
+    store_be32(p + 4, static_cast<std::uint32_t>(v));
+}
+
+static inline void sha1_compress(std::uint32_t state[5], const unsigned char block[64])
+{
+    std::uint32_t w[80];
+    for (auto i = 0; i < 16; ++i)
+    {
+        w[i] = load_be32(block + i * 4);
+    }
+    for (auto i = 16; i < 80; ++i)
+    {
+        w[i] = rotl32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    }
+
+    std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+    for (auto i = 0; i < 80; ++i)
+    {
+        std::uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+
+        const std::uint32_t t = rotl32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl32(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+static inline void sha256_compress(std::uint32_t state[8], const unsigned char block[64])
+{
+    std::uint32_t w[64];
+    for (auto i = 0; i < 16; ++i)
+    {
+        w[i] = load_be32(block + i * 4);
+    }
+    for (auto i = 16; i < 64; ++i)
+    {
+        const std::uint32_t s0 = rotr32(w[i-15], 7) ^ rotr32(w[i-15], 18) ^ (w[i-15] >> 3);
+        const std::uint32_t s1 = rotr32(w[i-2], 17) ^ rotr32(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    std::uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (auto i = 0; i < 64; ++i)
+    {
+        const std::uint32_t S1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+        const std::uint32_t ch = (e & f) ^ (~e & g);
+        const std::uint32_t t1 = h + S1 + ch + SHA256_K[i] + w[i];
+        const std::uint32_t S0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+        const std::uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        const std::uint32_t t2 = S0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static inline void sha512_compress(std::uint64_t state[8], const unsigned char block[128])
+{
+    std::uint64_t w[80];
+    for (auto i = 0; i < 16; ++i)
+    {
+        w[i] = load_be64(block + i * 8);
+    }
+    for (auto i = 16; i < 80; ++i)
+    {
+        const std::uint64_t s0 = rotr64(w[i-15], 1) ^ rotr64(w[i-15], 8) ^ (w[i-15] >> 7);
+        const std::uint64_t s1 = rotr64(w[i-2], 19) ^ rotr64(w[i-2], 61) ^ (w[i-2] >> 6);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    std::uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+    std::uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (auto i = 0; i < 80; ++i)
+    {
+        const std::uint64_t S1 = rotr64(e, 14) ^ rotr64(e, 18) ^ rotr64(e, 41);
+        const std::uint64_t ch = (e & f) ^ (~e & g);
+        const std::uint64_t t1 = h + S1 + ch + SHA512_K[i] + w[i];
+        const std::uint64_t S0 = rotr64(a, 28) ^ rotr64(a, 34) ^ rotr64(a, 39);
+        const std::uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+        const std::uint64_t t2 = S0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+// hashes an entire message of arbitrary length with the given block function,
+// the length field is appended in big-endian bits as the last LengthSize bytes
+template<std::size_t BlockSize, std::size_t LengthSize, class Word, std::size_t Words, class Compress>
+static inline void sha_digest(Word (&state)[Words], const unsigned char *data, std::size_t length, Compress compress)
+{
+    std::size_t remaining = length;
+    while (remaining >= BlockSize)
+    {
+        compress(state, data);
+        data += BlockSize;
+        remaining -= BlockSize;
+    }
+
+    unsigned char block[BlockSize * 2] = {};
+    std::memcpy(block, data, remaining);
+    block[remaining] = 0x80;
+
+    const std::size_t blocks = (remaining + 1 + LengthSize > BlockSize) ? 2 : 1;
+    store_be64(block + blocks * BlockSize - 8, static_cast<std::uint64_t>(length) * 8);
+
+    compress(state, block);
+    if (blocks == 2)
+    {
+        compress(state, block + BlockSize);
+    }
+}
+
+static inline void sha1_digest(const unsigned char *data, std::size_t length, unsigned char out[20])
+{
+    std::uint32_t state[5];
+    std::memcpy(state, SHA1_INIT, sizeof(state));
+    sha_digest<SHA1_BLOCK_SIZE, 8>(state, data, length, sha1_compress);
+    for (auto i = 0; i < 5; ++i)
+    {
+        store_be32(out + i * 4, state[i]);
+    }
+}
+
+static inline void sha256_digest(const unsigned char *data, std::size_t length, unsigned char out[32])
+{
+    std::uint32_t state[8];
+    std::memcpy(state, SHA256_INIT, sizeof(state));
+    sha_digest<SHA256_BLOCK_SIZE, 8>(state, data, length, sha256_compress);
+    for (auto i = 0; i < 8; ++i)
+    {
+        store_be32(out + i * 4, state[i]);
+    }
+}
+
+static inline void sha512_digest(const unsigned char *data, std::size_t length, unsigned char out[64])
+{
+    std::uint64_t state[8];
+    std::memcpy(state, SHA512_INIT, sizeof(state));
+    sha_digest<SHA512_BLOCK_SIZE, 16>(state, data, length, sha512_compress);
+    for (auto i = 0; i < 8; ++i)
+    {
+        store_be64(out + i * 8, state[i]);
+    }
+}
+
+} // anonymous namespace
+
+#endif // CORE_PRIVATE_SHA_HPP
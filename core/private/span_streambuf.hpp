@@ -0,0 +1,85 @@
+#ifndef CORE_PRIVATE_SPAN_STREAMBUF_HPP
+#define CORE_PRIVATE_SPAN_STREAMBUF_HPP
+
+#include <streambuf>
+#include <string>
+#include <string_view>
+
+namespace
+{
+    // input stream buffer reading from existing memory without copying it,
+    // lets cereal deserialize straight from a decrypted buffer
+    class SpanStreambuf final : public std::streambuf
+    {
+    public:
+        SpanStreambuf(std::string_view data)
+        {
+            auto *begin = const_cast<char*>(data.data());
+            this->setg(begin, begin, begin + data.size());
+        }
+
+    protected:
+        pos_type seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+        {
+            if (!(which & std::ios_base::in))
+            {
+                return pos_type(off_type(-1));
+            }
+
+            off_type position = offset;
+            if (dir == std::ios_base::cur)
+            {
+                position += this->gptr() - this->eback();
+            }
+            else if (dir == std::ios_base::end)
+            {
+                position += this->egptr() - this->eback();
+            }
+
+            if (position < 0 || position > this->egptr() - this->eback())
+            {
+                return pos_type(off_type(-1));
+            }
+
+            this->setg(this->eback(), this->eback() + position, this->egptr());
+            return pos_type(position);
+        }
+
+        pos_type seekpos(pos_type position, std::ios_base::openmode which) override
+        {
+            return this->seekoff(off_type(position), std::ios_base::beg, which);
+        }
+    };
+
+    // output stream buffer appending to an existing string, which can be
+    // cleared and reused to serialize one record after another
+    class StringStreambuf final : public std::streambuf
+    {
+    public:
+        StringStreambuf(std::string &data)
+            : _data(data)
+        {
+        }
+
+    protected:
+        std::streamsize xsputn(const char *data, std::streamsize size) override
+        {
+            this->_data.append(data, static_cast<std::size_t>(size));
+            return size;
+        }
+
+        int_type overflow(int_type ch) override
+        {
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            {
+                this->_data.push_back(traits_type::to_char_type(ch));
+            }
+            return traits_type::not_eof(ch);
+        }
+
+    private:
+        std::string &_data;
+    };
+}
+
+#endif // CORE_PRIVATE_SPAN_STREAMBUF_HPP
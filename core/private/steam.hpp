@@ -0,0 +1,20 @@
+#ifndef CORE_PRIVATE_STEAM_HPP
+#define CORE_PRIVATE_STEAM_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace
+{
+
+// steam token alphabet
+static const constexpr char STEAM_ALPHABET[] = "23456789BCDFGHJKMNPQRTVWXY";
+static const constexpr std::size_t STEAM_ALPHABET_SIZE = sizeof(STEAM_ALPHABET) - 1;
+
+// hardcoded steam token properties besides default handling
+static const constexpr std::uint8_t STEAM_DIGITS = 5;
+static const constexpr std::uint32_t STEAM_PERIOD = 30;
+
+} // anonymous namespace
+
+#endif // CORE_PRIVATE_STEAM_HPP
@@ -0,0 +1,335 @@
+#ifndef CORE_PRIVATE_STORE_FORMAT_HPP
+#define CORE_PRIVATE_STORE_FORMAT_HPP
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/aes.h>
+#include <cryptopp/gcm.h>
+#include <cryptopp/hkdf.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/secblock.h>
+#include <cryptopp/sha.h>
+
+#include <otptoken.hpp>
+
+/**
+ * Layout of the store file. All integers are little endian.
+ *
+ *   header:  "OTPS", version, 3 reserved bytes, size of the icon section (u64)
+ *   icons:   every distinct icon sealed on its own: nonce, AES-GCM ciphertext, tag,
+ *            followed by the thumbnails of the icons sealed the same way
+ *   tokens:  every token record sealed on its own, followed by the trailer
+ *            up to the end of the file
+ *
+ * Records and the trailer are framed the same way: length of ciphertext
+ * and tag (u32), nonce, AES-GCM ciphertext, tag. The record type is
+ * authenticated as associated data. The trailer holds the number of
+ * token records, the SHA-256 of the nonces and tags of all records in
+ * their order, the offsets of the icons by digest and the thumbnail
+ * index. Records can't be dropped, reordered or replaced without the
+ * trailer failing to authenticate, but each one is opened on its own,
+ * so unlocking opens them in parallel and a snapshot copies the sealed
+ * records of unchanged tokens as they are.
+ *
+ * Token records reference their icon by its SHA-256 digest, which is
+ * authenticated as associated data of the sealed icon. Unlocking a store
+ * only opens the token records, icons are decrypted when they are
+ * accessed. Sealed icons don't depend on their position, a snapshot
+ * copies icons which weren't loaded as they are.
+ *
+ * Every entry of the thumbnail index holds the icon digest, the
+ * thumbnail size, its dimensions and the position of its pixels. Digest
+ * and size are authenticated with the pixels.
+ *
+ * Version 3 files encrypt all token records as one AES-CBC stream and
+ * the records reference their icon by offset and digest. The thumbnail
+ * index follows the records, unless the file was written before
+ * thumbnails were stored.
+ *
+ * Version 2 files have no digests, every token has its own copy of its
+ * icon and the records reference it by offset and content hash instead.
+ * Their icons are decrypted on unlock and added to the icon pool.
+ *
+ * Store files without the header are from before icons were split off,
+ * the entire file is the token section and the records include the icons.
+ */
+
+namespace
+{
+    static const constexpr char STORE_MAGIC[4] = {'O', 'T', 'P', 'S'};
+    static const constexpr std::uint8_t STORE_VERSION = 4;
+    static const constexpr std::uint8_t STORE_VERSION_CBC = 3;
+    static const constexpr std::uint8_t STORE_VERSION_UNPOOLED = 2;
+    static const constexpr std::uint8_t STORE_VERSION_HEADERLESS = 0;
+
+    static const constexpr std::size_t STORE_HEADER_SIZE = 16;
+    static const constexpr std::size_t ICON_KEY_SIZE = CryptoPP::AES::MAX_KEYLENGTH;
+    static const constexpr std::size_t ICON_NONCE_SIZE = 12;
+    static const constexpr std::size_t ICON_TAG_SIZE = 16;
+    static const constexpr std::size_t ICON_OVERHEAD = ICON_NONCE_SIZE + ICON_TAG_SIZE;
+
+    static const constexpr std::size_t RECORD_KEY_SIZE = CryptoPP::AES::MAX_KEYLENGTH;
+    static const constexpr std::size_t RECORD_NONCE_SIZE = 12;
+    static const constexpr std::size_t RECORD_TAG_SIZE = 16;
+    static const constexpr std::size_t RECORD_OVERHEAD = 4 + RECORD_NONCE_SIZE + RECORD_TAG_SIZE;
+
+    // authenticated with every record, a token can't pass as the trailer
+    enum RecordType : unsigned char
+    {
+        TokenRecord = 1,
+        TrailerRecord,
+    };
+
+    using RecordHash = std::array<unsigned char, CryptoPP::SHA256::DIGESTSIZE>;
+
+    // nonces of the records or icons sealed by one snapshot: a random prefix
+    // and the index of the sealed item, so the random number generator runs
+    // once per snapshot and items can be sealed in any order
+    class SnapshotNonces final
+    {
+    public:
+        SnapshotNonces()
+        {
+            CryptoPP::AutoSeededRandomPool rng;
+            rng.GenerateBlock(this->_prefix, sizeof(this->_prefix));
+        }
+
+        void get(std::uint32_t index, unsigned char *nonce) const
+        {
+            std::memcpy(nonce, this->_prefix, sizeof(this->_prefix));
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                nonce[sizeof(this->_prefix) + i] = static_cast<unsigned char>(index >> (8 * i));
+            }
+        }
+
+    private:
+        static_assert(RECORD_NONCE_SIZE == ICON_NONCE_SIZE);
+        unsigned char _prefix[RECORD_NONCE_SIZE - 4];
+    };
+
+    static std::string store_header(std::uint64_t iconSectionSize)
+    {
+        std::string header(STORE_HEADER_SIZE, '\0');
+        std::memcpy(header.data(), STORE_MAGIC, sizeof(STORE_MAGIC));
+        header[4] = static_cast<char>(STORE_VERSION);
+        for (std::size_t i = 0; i < 8; ++i)
+        {
+            header[8 + i] = static_cast<char>(iconSectionSize >> (8 * i));
+        }
+        return header;
+    }
+
+    // returns false for files without a header
+    static bool parse_store_header(std::string_view file, std::uint8_t &version, std::uint64_t &iconSectionSize)
+    {
+        if (file.size() < STORE_HEADER_SIZE || std::memcmp(file.data(), STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 ||
+            file[4] < static_cast<char>(STORE_VERSION_UNPOOLED) || file[4] > static_cast<char>(STORE_VERSION) ||
+            file[5] != 0 || file[6] != 0 || file[7] != 0)
+        {
+            return false;
+        }
+
+        version = static_cast<std::uint8_t>(file[4]);
+        iconSectionSize = 0;
+        for (std::size_t i = 0; i < 8; ++i)
+        {
+            iconSectionSize |= static_cast<std::uint64_t>(static_cast<unsigned char>(file[8 + i])) << (8 * i);
+        }
+        return iconSectionSize <= file.size() - STORE_HEADER_SIZE;
+    }
+
+    static CryptoPP::SecByteBlock icon_key(const std::string &password)
+    {
+        static const constexpr char salt[] = "otpgen icons";
+
+        CryptoPP::SecByteBlock key(ICON_KEY_SIZE);
+        CryptoPP::HKDF<CryptoPP::SHA256> hkdf;
+        hkdf.DeriveKey(key, key.size(),
+                       reinterpret_cast<const unsigned char*>(password.data()), password.size(),
+                       reinterpret_cast<const unsigned char*>(salt), sizeof(salt) - 1, nullptr, 0);
+        return key;
+    }
+
+    static CryptoPP::SecByteBlock record_key(const std::string &password)
+    {
+        static const constexpr char salt[] = "otpgen records";
+
+        CryptoPP::SecByteBlock key(RECORD_KEY_SIZE);
+        CryptoPP::HKDF<CryptoPP::SHA256> hkdf;
+        hkdf.DeriveKey(key, key.size(),
+                       reinterpret_cast<const unsigned char*>(password.data()), password.size(),
+                       reinterpret_cast<const unsigned char*>(salt), sizeof(salt) - 1, nullptr, 0);
+        return key;
+    }
+
+    // keys the cipher once, every record or icon sets its own nonce
+    template<typename Cipher>
+    static void record_cipher(Cipher &gcm, const CryptoPP::SecByteBlock &key)
+    {
+        const unsigned char nonce[RECORD_NONCE_SIZE] = {};
+        gcm.SetKeyWithIV(key, key.size(), nonce, RECORD_NONCE_SIZE);
+    }
+
+    // appends the sealed record to the output
+    static void record_seal(CryptoPP::GCM<CryptoPP::AES>::Encryption &gcm, const SnapshotNonces &nonces, std::uint32_t index,
+                            RecordType type, std::string_view plaintext, std::string &out)
+    {
+        const auto offset = out.size();
+        out.resize(offset + RECORD_OVERHEAD + plaintext.size());
+        auto *frame = reinterpret_cast<unsigned char*>(out.data() + offset);
+
+        const auto length = static_cast<std::uint32_t>(plaintext.size() + RECORD_TAG_SIZE);
+        for (std::size_t i = 0; i < 4; ++i)
+        {
+            frame[i] = static_cast<unsigned char>(length >> (8 * i));
+        }
+
+        auto *nonce = frame + 4;
+        auto *ciphertext = nonce + RECORD_NONCE_SIZE;
+        nonces.get(index, nonce);
+
+        const unsigned char aad = type;
+        gcm.EncryptAndAuthenticate(ciphertext, ciphertext + plaintext.size(), RECORD_TAG_SIZE,
+                                   nonce, RECORD_NONCE_SIZE, &aad, 1,
+                                   reinterpret_cast<const unsigned char*>(plaintext.data()), plaintext.size());
+    }
+
+    // returns the size of the record at the given offset, 0 when it is truncated
+    static std::size_t record_size(std::string_view section, std::size_t offset)
+    {
+        if (section.size() - offset < RECORD_OVERHEAD)
+        {
+            return 0;
+        }
+
+        const auto *in = reinterpret_cast<const unsigned char*>(section.data()) + offset;
+        std::size_t length = 0;
+        for (std::size_t i = 0; i < 4; ++i)
+        {
+            length |= static_cast<std::size_t>(in[i]) << (8 * i);
+        }
+
+        if (length < RECORD_TAG_SIZE || section.size() - offset - 4 - RECORD_NONCE_SIZE < length)
+        {
+            return 0;
+        }
+        return 4 + RECORD_NONCE_SIZE + length;
+    }
+
+    // nonce and tag of a record, hashed into the trailer
+    static void record_hash_update(CryptoPP::SHA256 &hash, std::string_view record)
+    {
+        const auto *in = reinterpret_cast<const unsigned char*>(record.data());
+        hash.Update(in + 4, RECORD_NONCE_SIZE);
+        hash.Update(in + record.size() - RECORD_TAG_SIZE, RECORD_TAG_SIZE);
+    }
+
+    static bool record_open(CryptoPP::GCM<CryptoPP::AES>::Decryption &gcm, RecordType type,
+                            std::string_view record, std::string &plaintext)
+    {
+        const auto *nonce = reinterpret_cast<const unsigned char*>(record.data()) + 4;
+        const auto *ciphertext = nonce + RECORD_NONCE_SIZE;
+        const auto size = record.size() - RECORD_OVERHEAD;
+        plaintext.resize(size);
+
+        const unsigned char aad = type;
+        return gcm.DecryptAndVerify(reinterpret_cast<unsigned char*>(plaintext.data()), ciphertext + size, RECORD_TAG_SIZE,
+                                    nonce, RECORD_NONCE_SIZE, &aad, 1, ciphertext, size);
+    }
+
+    // appends the data sealed with AES-GCM to the output, the associated data
+    // is authenticated only
+    static void section_seal(CryptoPP::GCM<CryptoPP::AES>::Encryption &gcm, const SnapshotNonces &nonces, std::uint32_t index,
+                             const unsigned char *aad, std::size_t aadSize, const void *data, std::size_t size, std::string &out)
+    {
+        const auto offset = out.size();
+        out.resize(offset + ICON_OVERHEAD + size);
+        auto *nonce = reinterpret_cast<unsigned char*>(out.data() + offset);
+        auto *ciphertext = nonce + ICON_NONCE_SIZE;
+        nonces.get(index, nonce);
+
+        gcm.EncryptAndAuthenticate(ciphertext, ciphertext + size, ICON_TAG_SIZE,
+                                   nonce, ICON_NONCE_SIZE, aad, aadSize,
+                                   static_cast<const unsigned char*>(data), size);
+    }
+
+    // opens sealed data into the output, which holds the sealed size minus the overhead
+    static bool section_open(const CryptoPP::SecByteBlock &key, const unsigned char *aad, std::size_t aadSize,
+                             std::string_view sealed, void *out)
+    {
+        if (sealed.size() < ICON_OVERHEAD)
+        {
+            return false;
+        }
+
+        const auto *nonce = reinterpret_cast<const unsigned char*>(sealed.data());
+        const auto *ciphertext = nonce + ICON_NONCE_SIZE;
+        const auto size = sealed.size() - ICON_OVERHEAD;
+
+        CryptoPP::GCM<CryptoPP::AES>::Decryption gcm;
+        gcm.SetKeyWithIV(key, key.size(), nonce, ICON_NONCE_SIZE);
+        return gcm.DecryptAndVerify(static_cast<unsigned char*>(out), ciphertext + size, ICON_TAG_SIZE,
+                                    nonce, ICON_NONCE_SIZE, aad, aadSize, ciphertext, size);
+    }
+
+    static void icon_seal(CryptoPP::GCM<CryptoPP::AES>::Encryption &gcm, const SnapshotNonces &nonces, std::uint32_t index,
+                          const OTPToken::IconDigest &digest, const OTPToken::Data &icon, std::string &out)
+    {
+        section_seal(gcm, nonces, index, digest.data(), digest.size(), icon.data(), icon.size(), out);
+    }
+
+    // icons of version 2 files are sealed without a digest
+    static bool icon_open(const CryptoPP::SecByteBlock &key, const OTPToken::IconDigest *digest, std::string_view sealed, OTPToken::Data &icon)
+    {
+        icon.resize(sealed.size() < ICON_OVERHEAD ? 0 : sealed.size() - ICON_OVERHEAD);
+        if (!section_open(key, digest ? digest->data() : nullptr, digest ? digest->size() : 0, sealed, icon.data()))
+        {
+            icon.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // thumbnails are bound to their icon and size
+    using ThumbnailAad = std::array<unsigned char, sizeof(OTPToken::IconDigest) + 2>;
+
+    static ThumbnailAad thumbnail_aad(const OTPToken::IconDigest &digest, std::uint16_t size)
+    {
+        ThumbnailAad aad;
+        std::memcpy(aad.data(), digest.data(), digest.size());
+        aad[digest.size()] = static_cast<unsigned char>(size);
+        aad[digest.size() + 1] = static_cast<unsigned char>(size >> 8);
+        return aad;
+    }
+
+    static void thumbnail_seal(CryptoPP::GCM<CryptoPP::AES>::Encryption &gcm, const SnapshotNonces &nonces, std::uint32_t index,
+                               const OTPToken::IconDigest &digest, std::uint16_t size, const std::vector<std::uint8_t> &pixels,
+                               std::string &out)
+    {
+        const auto aad = thumbnail_aad(digest, size);
+        section_seal(gcm, nonces, index, aad.data(), aad.size(), pixels.data(), pixels.size(), out);
+    }
+
+    static bool thumbnail_open(const CryptoPP::SecByteBlock &key, const OTPToken::IconDigest &digest, std::uint16_t size,
+                               std::string_view sealed, std::vector<std::uint8_t> &pixels)
+    {
+        const auto aad = thumbnail_aad(digest, size);
+        pixels.resize(sealed.size() < ICON_OVERHEAD ? 0 : sealed.size() - ICON_OVERHEAD);
+        if (!section_open(key, aad.data(), aad.size(), sealed, pixels.data()))
+        {
+            pixels.clear();
+            return false;
+        }
+        return true;
+    }
+}
+
+#endif // CORE_PRIVATE_STORE_FORMAT_HPP
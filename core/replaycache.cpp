@@ -0,0 +1,128 @@
+#include "replaycache.hpp"
+#include "private/steam.hpp"
+#include "private/hash.hpp"
+
+#include <algorithm>
+
+ReplayCache::ReplayCache(std::size_t capacity)
+{
+    // round up to whole buckets per shard
+    const auto perShard = (capacity + Shards - 1) / Shards;
+    this->_bucketsPerShard = std::max<std::size_t>(1, (perShard + Ways - 1) / Ways);
+
+    this->_shards = std::make_unique<Shard[]>(Shards);
+    for (std::size_t i = 0; i < Shards; ++i)
+    {
+        this->_shards[i].buckets = std::make_unique<Bucket[]>(this->_bucketsPerShard);
+    }
+}
+
+std::uint64_t ReplayCache::identity(const OTPToken &token)
+{
+    const std::uint8_t properties[] = {
+        static_cast<std::uint8_t>(token.type()),
+        static_cast<std::uint8_t>(token.algorithm()),
+        token.digits(),
+    };
+    const auto period = token.period();
+
+    // the lengths are part of the chained hashes, fields can't run into each other
+    auto hash = murmur_hash64a(properties, sizeof(properties), 0);
+    hash = murmur_hash64a(&period, sizeof(period), hash);
+    hash = murmur_hash64a(token.label().data(), token.label().size(), hash);
+    hash = murmur_hash64a(token.secret().data(), token.secret().size(), hash);
+    return hash;
+}
+
+std::pair<ReplayCache::Shard*, ReplayCache::Bucket*> ReplayCache::locate(std::uint64_t tokenId, std::uint64_t step) const
+{
+    const auto hash = mix64(tokenId ^ mix64(step));
+    auto *shard = &this->_shards[hash % Shards];
+    auto *bucket = &shard->buckets[(hash / Shards) % this->_bucketsPerShard];
+    return {shard, bucket};
+}
+
+bool ReplayCache::markUsed(std::uint64_t tokenId, std::uint64_t step, const std::time_t &expires, const std::time_t &now)
+{
+    auto [shard, bucket] = this->locate(tokenId, step);
+    std::lock_guard<std::mutex> lock(shard->mutex);
+
+    Entry *free = nullptr;
+    for (auto &entry : bucket->entries)
+    {
+        if (entry.expires > now)
+        {
+            if (entry.tokenId == tokenId && entry.step == step)
+            {
+                return false;
+            }
+        }
+        else if (!free)
+        {
+            free = &entry;
+        }
+    }
+
+    // evicting a live entry would allow replaying its code, reject instead
+    if (!free)
+    {
+        this->_rejections.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    free->tokenId = tokenId;
+    free->step = step;
+    free->expires = expires;
+    return true;
+}
+
+bool ReplayCache::isUsed(std::uint64_t tokenId, std::uint64_t step, const std::time_t &now) const
+{
+    auto [shard, bucket] = this->locate(tokenId, step);
+    std::lock_guard<std::mutex> lock(shard->mutex);
+
+    for (const auto &entry : bucket->entries)
+    {
+        if (entry.expires > now && entry.tokenId == tokenId && entry.step == step)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::optional<int> ReplayCache::verify(const OTPToken &token, std::string_view code, const std::time_t &now,
+                                       int windowBefore, int windowAfter)
+{
+    if (token.type() == OTPToken::HOTP)
+    {
+        return {};
+    }
+
+    const auto offset = token.verify(code, now, windowBefore, windowAfter);
+    if (!offset)
+    {
+        return {};
+    }
+
+    // the window is accepted until it falls out of the windowBefore range
+    const std::time_t period = token.type() == OTPToken::Steam ? STEAM_PERIOD : token.period();
+    const auto step = now / period + *offset;
+    const auto expires = (step + windowBefore + 1) * period;
+
+    if (!this->markUsed(identity(token), static_cast<std::uint64_t>(step), expires, now))
+    {
+        return {};
+    }
+    return offset;
+}
+
+void ReplayCache::clear()
+{
+    for (std::size_t i = 0; i < Shards; ++i)
+    {
+        auto &shard = this->_shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::fill(shard.buckets.get(), shard.buckets.get() + this->_bucketsPerShard, Bucket());
+    }
+}
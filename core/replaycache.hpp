@@ -0,0 +1,133 @@
+#ifndef REPLAYCACHE_HPP
+#define REPLAYCACHE_HPP
+
+#include <string_view>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#include "otptoken.hpp"
+
+/**
+ * Bounded cache of already accepted codes.
+ *
+ * Remembers which (token, time step) pairs were accepted during code
+ * verification, so the same code can't be used twice while its window
+ * is still accepted. Entries expire automatically once their window
+ * rolled past the verification window.
+ *
+ * The memory is allocated once on construction and never grows. The
+ * cache is split into independently locked shards, each shard is a
+ * set-associative table with a fixed number of ways per bucket. Expired
+ * entries are reused, live entries are never evicted. When a bucket is
+ * full of live entries new codes are rejected and counted in
+ * @see rejections, so a full cache denies codes but never lets a replay
+ * through.
+ *
+ * All methods are thread-safe.
+ */
+class ReplayCache
+{
+public:
+    // number of independently locked shards
+    static constexpr std::size_t Shards = 64;
+
+    // entries per bucket
+    static constexpr std::size_t Ways = 8;
+
+    /**
+     * Constructs a cache which can hold at least the given number of entries.
+     */
+    ReplayCache(std::size_t capacity = 1 << 20);
+
+    ReplayCache(const ReplayCache &) = delete;
+    ReplayCache &operator= (const ReplayCache &) = delete;
+
+    /**
+     * Returns an identity for the given token to key cache entries by.
+     * Derived from the label and every property which affects the codes,
+     * the type, algorithm, digits, period and secret of the token.
+     */
+    static std::uint64_t identity(const OTPToken &token);
+
+    /**
+     * Marks the time step of the given token as used.
+     *
+     * Returns false if the step was already marked and didn't expire yet,
+     * which means the code is a replay, or if its bucket is full of live
+     * entries. The entry expires at `expires`.
+     */
+    bool markUsed(std::uint64_t tokenId, std::uint64_t step, const std::time_t &expires, const std::time_t &now);
+
+    /**
+     * Checks if the time step of the given token is marked as used.
+     */
+    bool isUsed(std::uint64_t tokenId, std::uint64_t step, const std::time_t &now) const;
+
+    /**
+     * Verifies the code with @see OTPToken::verify and marks the matched
+     * window as used. Returns the matched window offset, or nothing when
+     * the code is invalid, was already accepted before or can't be marked
+     * because the cache is full.
+     *
+     * HOTP tokens aren't supported, their counter already prevents replays.
+     */
+    std::optional<int> verify(const OTPToken &token, std::string_view code, const std::time_t &now,
+                              int windowBefore = 1, int windowAfter = 1);
+
+    /**
+     * Returns the total number of entries this cache can hold.
+     */
+    inline std::size_t capacity() const
+    {
+        return Shards * this->_bucketsPerShard * Ways;
+    }
+
+    /**
+     * Returns the number of codes rejected because their bucket was full.
+     * Each rejection denies a valid code, size the cache accordingly.
+     */
+    inline std::uint64_t rejections() const
+    {
+        return this->_rejections.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Removes all entries.
+     */
+    void clear();
+
+private:
+    struct Entry
+    {
+        std::uint64_t tokenId = 0;
+        std::uint64_t step = 0;
+        std::time_t expires = 0; // expired entries are free
+    };
+
+    struct Bucket
+    {
+        Entry entries[Ways];
+    };
+
+    struct alignas(64) Shard
+    {
+        mutable std::mutex mutex;
+        std::unique_ptr<Bucket[]> buckets;
+    };
+
+    // returns the shard and bucket of the given key
+    std::pair<Shard*, Bucket*> locate(std::uint64_t tokenId, std::uint64_t step) const;
+
+    std::size_t _bucketsPerShard;
+    std::unique_ptr<Shard[]> _shards;
+    std::atomic<std::uint64_t> _rejections = 0;
+};
+
+#endif // REPLAYCACHE_HPP
@@ -0,0 +1,75 @@
+#include "thumbnail.hpp"
+
+#if THUMBNAIL_SUPPORT
+#define MAGICKCORE_QUANTUM_DEPTH 8
+#define MAGICKCORE_HDRI_ENABLE 1
+#include <Magick++.h>
+
+#include <limits>
+#endif
+
+#include <utility>
+
+bool Thumbnail::supported()
+{
+#if THUMBNAIL_SUPPORT
+    return true;
+#else
+    return false;
+#endif
+}
+
+Thumbnail Thumbnail::create(const OTPToken::Data &image, std::uint16_t size)
+{
+    if (!supported() || image.empty() || size == 0)
+    {
+        return {};
+    }
+
+#if THUMBNAIL_SUPPORT
+
+    try {
+        Magick::Image magick;
+        magick.read(Magick::Blob(image.data(), image.size()));
+        if (!magick.isValid())
+        {
+            return {};
+        }
+
+        // fits the image into the square, keeping its aspect ratio
+        magick.filterType(Magick::LanczosFilter);
+        magick.resize(Magick::Geometry(size, size));
+
+        const auto width = magick.columns();
+        const auto height = magick.rows();
+        if (width == 0 || height == 0 || width > std::numeric_limits<std::uint16_t>::max() ||
+            height > std::numeric_limits<std::uint16_t>::max())
+        {
+            return {};
+        }
+
+        // extract raw 8-bit RGBA pixels
+        Magick::Blob blob;
+        magick.write(&blob, "RGBA", 8);
+        const auto *raw = static_cast<const std::uint8_t*>(blob.data());
+
+        return Thumbnail(static_cast<std::uint16_t>(width), static_cast<std::uint16_t>(height),
+                         Pixels(raw, raw + blob.length()));
+    } catch (...) {
+        return {};
+    }
+
+#else
+    return {};
+#endif
+}
+
+Thumbnail::Thumbnail(std::uint16_t width, std::uint16_t height, Pixels pixels)
+{
+    if (width > 0 && height > 0 && pixels.size() == std::size_t(width) * height * 4)
+    {
+        this->_width = width;
+        this->_height = height;
+        this->_pixels = std::move(pixels);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef THUMBNAIL_HPP
+#define THUMBNAIL_HPP
+
+#include <vector>
+#include <cstdint>
+
+#include "otptoken.hpp"
+
+/**
+ * Icon scaled down to the size it is displayed at.
+ *
+ * Pixels are RGBA with 8 bits per channel, stored row by row from top
+ * to bottom without padding, so frontends can wrap them as they are
+ * instead of decoding and resampling the icon themselves.
+ */
+class Thumbnail
+{
+public:
+    using Pixels = std::vector<std::uint8_t>;
+
+    /**
+     * Checks if the library was built with thumbnail support.
+     * If this function returns false, @see create always returns an
+     * empty thumbnail.
+     */
+    static bool supported();
+
+    /**
+     * Decodes the given image and scales it to fit into a square of the
+     * given size, keeping its aspect ratio. Returns an empty thumbnail
+     * when the image can't be decoded.
+     */
+    static Thumbnail create(const OTPToken::Data &image, std::uint16_t size);
+
+    /**
+     * Constructs an empty thumbnail.
+     */
+    Thumbnail() = default;
+
+    /**
+     * Constructs a thumbnail from RGBA pixels.
+     * Mismatching dimensions result in an empty thumbnail.
+     */
+    Thumbnail(std::uint16_t width, std::uint16_t height, Pixels pixels);
+
+    constexpr inline std::uint16_t width() const
+    {
+        return this->_width;
+    }
+
+    constexpr inline std::uint16_t height() const
+    {
+        return this->_height;
+    }
+
+    inline const Pixels &pixels() const
+    {
+        return this->_pixels;
+    }
+
+    inline bool isEmpty() const
+    {
+        return this->_pixels.empty();
+    }
+
+private:
+    std::uint16_t _width = 0;
+    std::uint16_t _height = 0;
+    Pixels _pixels;
+};
+
+#endif // THUMBNAIL_HPP
@@ -1,11 +1,27 @@
 #include "tokenstore.hpp"
 #include "private/serialize.hpp"
+#include "private/otpgen.hpp"
+#include "private/hmac_batch.hpp"
+#include "private/journal.hpp"
+#include "private/durable_file.hpp"
+#include "private/mapped_file.hpp"
+#include "private/span_streambuf.hpp"
+#include "private/cipher_streambuf.hpp"
+#include "private/store_format.hpp"
+#include "private/parallel.hpp"
 
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
 #include <memory>
+#include <tuple>
+#include <utility>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include <cryptopp/cryptlib.h>
 #include <cryptopp/algparam.h>
@@ -30,63 +46,30 @@
 namespace
 {
 
-static bool loadFileContents(const std::string filePath, std::string &contents, bool createMode = false)
-{
-    // ensure the given string is empty
-    contents.clear();
-
-    const auto base_flags = std::ios_base::binary;
+// the journal is compacted once it outgrows the snapshot and this size
+static const constexpr std::size_t JOURNAL_COMPACT_SIZE = 64 * 1024;
 
-    if (createMode)
-    {
-        std::fstream file;
-        file.open(filePath, base_flags | std::ios_base::out | std::ios_base::trunc);
-        if (file.is_open())
-        {
-            file.close();
-            return true;
-        }
-        else
-        {
-            return false;
-        }
-    }
+// lower bound of the serialized size of a token, the token count read from
+// a snapshot isn't trusted to reserve more memory than the snapshot can fill
+static const constexpr std::size_t SERIALIZED_TOKEN_MIN_SIZE = 32;
 
-    std::fstream file;
-    file.open(filePath, base_flags | std::ios_base::in | std::ios_base::ate);
-    if (file.is_open())
-    {
-        // get file size
-        const auto size = file.tellg();
-        file.seekg(0, std::ios::beg);
+// serialized size of an entry of the thumbnail index
+static const constexpr std::size_t THUMBNAIL_INDEX_ENTRY_SIZE = 32 + 2 + 2 + 2 + 8;
 
-        // read entire file
-        std::vector<char> buffer(size);
-        file.read(&buffer[0], size);
-        file.close();
+// serialized size of an entry of the icon table
+static const constexpr std::size_t ICON_TABLE_ENTRY_SIZE = 32 + 8;
 
-        // convert to std::string
-        contents = std::string(buffer.data(), buffer.size());
-        return true;
-    }
+// records are opened in blocks, a thread claims one block at a time
+static const constexpr std::size_t RECORD_BLOCK = 256;
 
-    return false;
-}
+// smaller stores are opened on the calling thread, starting threads costs more
+static const constexpr std::size_t RECORD_PARALLEL_THRESHOLD = 4 * RECORD_BLOCK;
 
-static bool writeFile(const std::string &filePath, const std::string &contents)
-{
-    std::fstream file;
-    file.open(filePath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
-    if (file.is_open())
-    {
-        file.write(contents.data(), contents.size());
-        file.flush();
-        file.close();
-        return true;
-    }
+// smaller icon sections are decrypted on the calling thread
+static const constexpr std::size_t ICON_PARALLEL_THRESHOLD = 256 * 1024;
 
-    return false;
-}
+// icons and thumbnails are sealed and written in segments of at least this size
+static const constexpr std::size_t SNAPSHOT_SEGMENT_SIZE = 64 * 1024;
 
 static CryptoPP::SecByteBlock makeKey(const std::string &password)
 {
@@ -102,64 +85,281 @@ static CryptoPP::SecByteBlock makeKey(const std::string &password)
     return key;
 }
 
-static bool encryptData(const std::ostringstream &input, const std::string &password, std::string &output)
+// decrypts only the last block, which CBC allows, so an incorrect password
+// is detected by its padding before anything is parsed
+static bool hasValidPadding(std::string_view encrypted, const CryptoPP::SecByteBlock &key, const std::string &password)
 {
-    output.clear();
+    const auto aes_blocksize = CryptoPP::AES::BLOCKSIZE;
+    if (encrypted.empty() || encrypted.size() % aes_blocksize != 0)
+    {
+        return false;
+    }
 
-    try {
+    const auto *last = reinterpret_cast<const unsigned char*>(encrypted.data()) + encrypted.size() - aes_blocksize;
+    const auto *iv = encrypted.size() > aes_blocksize ? last - aes_blocksize : reinterpret_cast<const unsigned char*>(password.data());
+
+    CryptoPP::AES::Decryption aesDecryption(key, CryptoPP::AES::DEFAULT_KEYLENGTH);
+    CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, iv);
 
-        const std::string inputData = input.str();
-        const auto key = makeKey(password);
+    unsigned char block[aes_blocksize];
+    cbcDecryption.ProcessData(block, last, aes_blocksize);
+    return pkcs7_padding(block) != 0;
+}
 
-        CryptoPP::AES::Encryption aesEncryption(key, CryptoPP::AES::DEFAULT_KEYLENGTH);
-        CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(aesEncryption, reinterpret_cast<const unsigned char*>(password.data()));
+struct DigestHash
+{
+    std::size_t operator() (const OTPToken::IconDigest &digest) const
+    {
+        std::size_t hash;
+        std::memcpy(&hash, digest.data(), sizeof(hash));
+        return hash;
+    }
+};
 
-        CryptoPP::StreamTransformationFilter stfEncryptor(cbcEncryption, new CryptoPP::StringSink(output));
-        stfEncryptor.Put(reinterpret_cast<const unsigned char*>(inputData.data()), inputData.size());
-        stfEncryptor.MessageEnd();
+// size of the pixels of a stored thumbnail
+static constexpr std::uint64_t thumbnailLength(std::uint16_t width, std::uint16_t height)
+{
+    return std::uint64_t(width) * height * 4;
+}
 
-        return true;
+// reads the thumbnail index, entries which aren't accepted are dropped
+template<class Archive, class Cache, class Accept>
+static void load_thumbnail_index(Archive &archive, std::size_t sizeHint, Cache &thumbnails, Accept accept)
+{
+    cereal::size_type count;
+    archive(cereal::make_size_tag(count));
 
-    } catch (...) {
-        output.clear();
+    thumbnails.clear();
+    thumbnails.reserve(std::min<cereal::size_type>(count, sizeHint / THUMBNAIL_INDEX_ENTRY_SIZE));
+    for (cereal::size_type i = 0; i < count; ++i)
+    {
+        typename Cache::key_type key;
+        typename Cache::mapped_type entry;
+        entry.stored = true;
+        archive(cereal::binary_data(key.digest.data(), key.digest.size()), key.size, entry.width, entry.height, entry.offset);
+        if (accept(entry))
+        {
+            thumbnails.emplace(key, entry);
+        }
     }
+}
 
-    return false;
+template<class Archive, class Cache>
+static void save_thumbnail_index(Archive &archive, const Cache &thumbnails)
+{
+    archive(cereal::make_size_tag(static_cast<cereal::size_type>(thumbnails.size())));
+    for (auto&& thumbnail : thumbnails)
+    {
+        archive(cereal::binary_data(thumbnail.key->digest.data(), thumbnail.key->digest.size()),
+                thumbnail.key->size, thumbnail.width, thumbnail.height, thumbnail.offset);
+    }
 }
 
-static bool decryptData(const std::string &encrypted, const std::string &password, std::string &decrypted)
+} // anonymous namespace
+
+/**
+ * Icon section of the loaded store file.
+ *
+ * Keeps the file mapped while tokens referencing its icons exist, also
+ * after the store is gone or the file was replaced by a newer snapshot.
+ * The store keeps it as well while it has sealed records or thumbnails
+ * to copy into the next snapshot, after a snapshot it moves on to the
+ * written file.
+ */
+class TokenStore::LoadedFile final : public OTPToken::IconSource
 {
-    decrypted.clear();
+public:
+    inline MappedFile &file()
+    {
+        return this->_file;
+    }
 
-    try {
+    // the key is only derived for files which have icons
+    void setSection(std::string_view section, const std::string &password)
+    {
+        this->_section = section;
+        this->_key = icon_key(password);
+    }
 
-        const auto key = makeKey(password);
+    // icons sealed with the same key are copied into snapshots as they are
+    bool sealedWith(const CryptoPP::SecByteBlock &key) const
+    {
+        return this->_key.size() > 0 && this->_key == key;
+    }
 
-        CryptoPP::AES::Decryption aesDecryption(key, CryptoPP::AES::DEFAULT_KEYLENGTH);
-        CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, reinterpret_cast<const unsigned char*>(password.data()));
+    // part of the file, empty when out of bounds
+    std::string_view contents(std::uint64_t offset, std::uint64_t size) const
+    {
+        const auto data = this->_file.data();
+        if (offset > data.size() || data.size() - offset < size)
+        {
+            return {};
+        }
+        return data.substr(static_cast<std::size_t>(offset), static_cast<std::size_t>(size));
+    }
 
-        CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, new CryptoPP::StringSink(decrypted));
-        stfDecryptor.Put(reinterpret_cast<const unsigned char*>(encrypted.data()), encrypted.size());
-        stfDecryptor.MessageEnd();
+    // sealed icon as stored in the section, empty when out of bounds
+    std::string_view sealed(std::uint64_t offset, std::uint64_t length) const
+    {
+        const auto size = length + ICON_OVERHEAD;
+        if (offset > this->_section.size() || this->_section.size() - offset < size)
+        {
+            return {};
+        }
+        return this->_section.substr(static_cast<std::size_t>(offset), static_cast<std::size_t>(size));
+    }
 
-        return true;
+    bool loadIcon(const OTPToken::IconDigest &digest, std::uint64_t offset, std::uint32_t length, OTPToken::Data &icon) const override
+    {
+        return this->loadIcon(&digest, offset, length, icon);
+    }
 
-    } catch (...) {
-        decrypted.clear();
+    bool loadIcon(const OTPToken::IconDigest *digest, std::uint64_t offset, std::uint32_t length, OTPToken::Data &icon) const
+    {
+        const auto sealed = this->sealed(offset, length);
+        return !sealed.empty() && icon_open(this->_key, digest, sealed, icon);
     }
 
-    return false;
-}
+    std::shared_ptr<const Thumbnail> loadThumbnail(const ThumbnailKey &key, const CachedThumbnail &entry) const
+    {
+        const auto sealed = this->sealed(entry.offset, thumbnailLength(entry.width, entry.height));
+        Thumbnail::Pixels pixels;
+        if (sealed.empty() || !thumbnail_open(this->_key, key.digest, key.size, sealed, pixels))
+        {
+            return nullptr;
+        }
+        return std::make_shared<const Thumbnail>(entry.width, entry.height, std::move(pixels));
+    }
 
-} // anonymous namespace
+private:
+    CryptoPP::SecByteBlock _key;
+    MappedFile _file;
+    std::string_view _section;
+};
+
+/**
+ * Background thread of @see TokenStore::commitAsync.
+ *
+ * Holds at most one queued job. Commits submitted while the previous
+ * write is in progress are merged into the queued job, so a burst of
+ * commits results in one more write, whose result all of them receive.
+ */
+class TokenStore::CommitWriter final
+{
+public:
+    CommitWriter(TokenStore &store)
+        : _store(store),
+          _thread(&CommitWriter::run, this)
+    {
+    }
+
+    ~CommitWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            this->_stop = true;
+        }
+        this->_wake.notify_one();
+        this->_thread.join();
+    }
+
+    void submit(CommitJob &&job)
+    {
+        // released after unlocking, freeing a large snapshot takes a while
+        std::shared_ptr<const std::vector<OTPToken>> replaced;
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            if (!this->_queued)
+            {
+                this->_queued = std::make_unique<CommitJob>(std::move(job));
+            }
+            else
+            {
+                // a newer snapshot contains all earlier changes
+                if (job.tokens)
+                {
+                    replaced = std::exchange(this->_queued->tokens, std::move(job.tokens));
+                    this->_queued->records = std::move(job.records);
+                    this->_queued->thumbnails = std::move(job.thumbnails);
+                    this->_queued->file = std::move(job.file);
+                    this->_queued->changes.clear();
+                }
+                this->_queued->changes.insert(this->_queued->changes.end(),
+                    std::make_move_iterator(job.changes.begin()), std::make_move_iterator(job.changes.end()));
+                for (auto&& result : job.results)
+                {
+                    this->_queued->results.emplace_back(std::move(result));
+                }
+            }
+        }
+        this->_wake.notify_one();
+    }
+
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(this->_mutex);
+        this->_idle.wait(lock, [this]{ return !this->_queued && !this->_busy; });
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(this->_mutex);
+        for (;;)
+        {
+            // queued jobs are still written when stopping
+            this->_wake.wait(lock, [this]{ return this->_queued || this->_stop; });
+            if (!this->_queued)
+            {
+                return;
+            }
+
+            const auto job = std::move(this->_queued);
+            this->_busy = true;
+            lock.unlock();
+
+            const auto result = this->_store.writeCommit(*job);
+            for (auto&& promise : job->results)
+            {
+                promise.set_value(result);
+            }
+
+            lock.lock();
+            this->_busy = false;
+            this->_idle.notify_all();
+        }
+    }
+
+    TokenStore &_store;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    std::unique_ptr<CommitJob> _queued;
+    bool _busy = false;
+    bool _stop = false;
+    std::thread _thread;
+};
+
+std::size_t TokenStore::ThumbnailKeyHash::operator() (const ThumbnailKey &key) const
+{
+    return DigestHash()(key.digest) ^ key.size;
+}
 
 void TokenStore::deletePassword(std::string *password)
 {
     std::fill(password->begin(), password->end(), 0);
 }
 
-TokenStore::TokenStore(const std::string &filePath, const std::string &password)
-    : _filePath(filePath)
+TokenStore::TokenStore()
+{
+}
+
+TokenStore::TokenStore(const std::string &filePath, const std::string &password, StorageMode mode,
+                       ProgressCallback progress, unsigned threads)
+    : _filePath(filePath),
+      _mode(mode),
+      _progress(std::move(progress)),
+      _threads(threads)
 {
     // store password in hashed form and use that for the actual token store password
     if (!password.empty())
@@ -180,32 +380,46 @@ TokenStore::TokenStore(const std::string &filePath, const std::string &password)
     const bool exists = std::filesystem::exists(filePath);
     const bool is_reg = std::filesystem::is_regular_file(filePath);
 
-    std::string fileContents;
+    // the ciphertext is decrypted right from the mapped file, which stays
+    // mapped for loading icons on demand
+    auto icons = std::make_shared<LoadedFile>();
+    auto &file = icons->file();
+    std::string_view fileContents;
 
     if (exists && is_reg)
     {
         // attempt to use existing file
-        if (loadFileContents(this->_filePath, fileContents))
+        if (!file.open(this->_filePath))
+        {
+            this->_state = PermissionDenied;
+            return;
+        }
+        fileContents = file.data();
+
+        std::uint8_t version;
+        std::uint64_t iconSectionSize;
+        if (parse_store_header(fileContents, version, iconSectionSize))
         {
-            if (!fileContents.empty())
+            if (iconSectionSize > 0)
             {
-                std::string decrypted;
-                if (decryptData(fileContents, this->_password, decrypted))
-                {
-                    this->deserializeData(decrypted);
-                    return;
-                }
-                else
-                {
-                    this->_state = DecryptionError;
-                    return;
-                }
+                icons->setSection(fileContents.substr(STORE_HEADER_SIZE, iconSectionSize), this->_password);
+            }
+
+            if (version == STORE_VERSION)
+            {
+                this->_loadedFile = icons;
+                this->loadRecords(fileContents.substr(STORE_HEADER_SIZE + iconSectionSize));
+            }
+            else
+            {
+                this->_loadedFile = iconSectionSize > 0 ? icons : nullptr;
+                this->loadSnapshot(fileContents.substr(STORE_HEADER_SIZE + iconSectionSize), version);
             }
         }
-        else
+        else if (!fileContents.empty())
         {
-            this->_state = PermissionDenied;
-            return;
+            // store file from before icons were split off
+            this->loadSnapshot(fileContents, STORE_VERSION_HEADERLESS);
         }
     }
     else if (exists)
@@ -217,18 +431,39 @@ TokenStore::TokenStore(const std::string &filePath, const std::string &password)
     else
     {
         // attempt to create a new file
-        if (!loadFileContents(this->_filePath, fileContents, true))
+        if (!create_private_file(this->_filePath))
         {
             this->_state = PermissionDenied;
             return;
         }
+
+        // a journal left behind by a deleted store doesn't belong to the new one
+        std::error_code ec;
+        std::filesystem::remove(this->journalPath(), ec);
+    }
+
+    if (this->isValid())
+    {
+        this->replayJournal(fileContents);
     }
 
-    this->_state = NoError;
+    // without icons, thumbnails or records to load or copy later on the file isn't needed anymore
+    if (this->_loadedFile && this->_thumbnails.empty() &&
+        std::all_of(this->_tokens.begin(), this->_tokens.end(), [](const OTPToken &token) { return token.iconLoaded(); }) &&
+        std::all_of(this->_tokenRecords.begin(), this->_tokenRecords.end(), [](const StoredRecord &record) { return record.size == 0; }))
+    {
+        this->_loadedFile.reset();
+    }
+
+    // changes are only recorded once the store is loaded
+    this->_journaling = this->isValid() && this->_mode == Journaled;
 }
 
 TokenStore::~TokenStore()
 {
+    // finish pending background commits
+    this->_writer.reset();
+
     // zero fill hashed password on destruction
     TokenStore::deletePassword(&this->_password);
 }
@@ -240,81 +475,1581 @@ bool TokenStore::addToken(const OTPToken &newToken)
         return false;
     }
 
-    // check if token already exists in store
-    for (auto&& token : this->_tokens)
+    this->insertToken(newToken);
+    return true;
+}
+
+std::size_t TokenStore::addTokens(std::span<const OTPToken> tokens)
+{
+    if (this->_indexDirty)
+    {
+        this->rebuildIndex();
+    }
+
+    this->_tokens.reserve(this->_tokens.size() + tokens.size());
+    this->_tokenSlots.reserve(this->_tokens.size() + tokens.size());
+    this->_tokenRecords.reserve(this->_tokens.size() + tokens.size());
+    this->_index.reserve(this->_tokens.size() + tokens.size());
+
+    std::size_t added = 0;
+    for (auto&& token : tokens)
     {
-        if (token == newToken)
+        if (token.canGenerateTokens() && this->insertToken(token))
         {
-            return true;
+            ++added;
         }
     }
+    return added;
+}
+
+void TokenStore::removeToken(const OTPToken &token)
+{
+    const auto index = this->lookup(token);
+    if (index != this->_tokens.size())
+    {
+        this->eraseToken(index);
+    }
+}
+
+bool TokenStore::removeToken(Handle handle)
+{
+    const auto index = this->indexOf(handle);
+    if (index == this->_tokens.size())
+    {
+        return false;
+    }
+
+    // the index is only built on demand after loading
+    if (this->_indexDirty)
+    {
+        this->rebuildIndex();
+    }
 
-    this->_tokens.emplace_back(newToken);
+    this->eraseToken(index);
     return true;
 }
 
-void TokenStore::removeToken(const OTPToken &token)
+bool TokenStore::updateToken(Handle handle, const OTPToken &token)
+{
+    const auto index = this->indexOf(handle);
+    if (index == this->_tokens.size() || !token.canGenerateTokens())
+    {
+        return false;
+    }
+
+    const auto existing = this->lookup(token);
+    if (existing != this->_tokens.size() && existing != index)
+    {
+        return false;
+    }
+
+    this->replaceToken(index, token);
+    return true;
+}
+
+TokenStore::Handle TokenStore::handle(std::size_t index) const
+{
+    if (index >= this->_tokens.size())
+    {
+        return InvalidHandle;
+    }
+
+    const auto slot = this->_tokenSlots[index];
+    return (static_cast<Handle>(this->_slots[slot].generation) << 32) | slot;
+}
+
+TokenStore::Handle TokenStore::handleOf(const OTPToken &token) const
+{
+    return this->handle(this->lookup(token));
+}
+
+const OTPToken *TokenStore::token(Handle handle) const
+{
+    const auto index = this->indexOf(handle);
+    return index == this->_tokens.size() ? nullptr : &this->_tokens[index];
+}
+
+std::size_t TokenStore::indexOf(Handle handle) const
+{
+    const auto slot = static_cast<std::uint32_t>(handle);
+    const auto generation = static_cast<std::uint32_t>(handle >> 32);
+
+    if (slot >= this->_slots.size() || this->_slots[slot].generation != generation)
+    {
+        return this->_tokens.size();
+    }
+    return this->_slots[slot].index;
+}
+
+const OTPToken *TokenStore::find(const OTPToken &token) const
+{
+    const auto index = this->lookup(token);
+    return index == this->_tokens.size() ? nullptr : &this->_tokens[index];
+}
+
+void TokenStore::clear()
+{
+    for (auto&& slot : this->_tokenSlots)
+    {
+        this->releaseSlot(slot);
+    }
+
+    this->_tokens.clear();
+    this->_tokenSlots.clear();
+    this->_tokenRecords.clear();
+    this->_index.clear();
+    this->_indexDirty = false;
+    this->_labels.clear();
+    this->_labelsDirty = false;
+    this->_groupsDirty = true;
+
+    // earlier changes don't matter anymore
+    if (this->_journaling)
+    {
+        this->_journal.clear();
+        this->_journal.emplace_back(JournalEntry{JournalClear, 0, OTPToken()});
+    }
+}
+
+std::vector<TokenStore::Handle> TokenStore::findByLabel(std::string_view query, LabelMatch match) const
 {
-    for (auto i = 0; i < this->_tokens.size(); ++i)
+    if (this->_labelsDirty)
     {
-        if (this->_tokens.at(i) == token)
+        this->_labels.clear();
+        this->_labels.reserve(this->_slots.size());
+        for (std::size_t i = 0; i < this->_tokens.size(); ++i)
         {
-            this->_tokens.erase(this->_tokens.begin() + i);
-            break;
+            this->_labels.insert(this->_tokenSlots[i], this->_tokens[i].label());
         }
+        this->_labelsDirty = false;
+    }
+
+    std::vector<std::uint32_t> slots;
+    switch (match)
+    {
+        case ExactLabel:     slots = this->_labels.exact(query); break;
+        case LabelPrefix:    slots = this->_labels.prefix(query); break;
+        case LabelSubstring: slots = this->_labels.substring(query); break;
+    }
+
+    std::vector<Handle> handles;
+    handles.reserve(slots.size());
+    for (auto&& slot : slots)
+    {
+        handles.emplace_back((static_cast<Handle>(this->_slots[slot].generation) << 32) | slot);
     }
+    return handles;
 }
 
-const std::string_view TokenStore::error_code() const
+std::size_t TokenStore::lookup(const OTPToken &token) const
 {
-    return magic_enum::enum_name(this->_state);
+    if (this->_indexDirty)
+    {
+        this->rebuildIndex();
+    }
+
+    const auto range = this->_index.equal_range(token.fingerprint());
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (this->_tokens[it->second] == token)
+        {
+            return it->second;
+        }
+    }
+    return this->_tokens.size();
 }
 
-TokenStore::ErrorCode TokenStore::commit()
+bool TokenStore::insertToken(const OTPToken &token)
 {
-    // refuse to commit a invalid state
-    if (!this->isValid())
+    if (this->lookup(token) != this->_tokens.size())
     {
-        return this->_state;
+        return false;
     }
 
-    // serialize the entire thing
-    std::ostringstream serializedTokensBuf;
-    cereal::PortableBinaryOutputArchive archive(serializedTokensBuf);
-    archive(this->_tokens);
+    const auto slot = this->acquireSlot(this->_tokens.size());
+    this->_index.emplace(token.fingerprint(), this->_tokens.size());
+    this->_tokenSlots.emplace_back(slot);
+    this->_tokenRecords.emplace_back();
+    this->_tokens.emplace_back(token);
+    if (!this->_labelsDirty)
+    {
+        this->_labels.insert(slot, token.label());
+    }
+    this->_groupsDirty = true;
 
-    // encrypt the serialized data
-    std::string encryptedData;
-    if (!encryptData(serializedTokensBuf, this->_password, encryptedData))
+    if (this->_journaling)
     {
-        return EncryptionError;
+        this->_journal.emplace_back(JournalEntry{JournalAdd, 0, token});
+    }
+    return true;
+}
+
+void TokenStore::eraseToken(std::size_t index)
+{
+    if (this->_journaling)
+    {
+        this->_journal.emplace_back(JournalEntry{JournalRemove, static_cast<std::uint32_t>(index), OTPToken()});
     }
 
-    // write file to disk
-    if (!writeFile(this->_filePath, encryptedData))
+    this->eraseIndexEntry(this->_tokens[index].fingerprint(), index);
+    this->_labels.erase(this->_tokenSlots[index]);
+    this->releaseSlot(this->_tokenSlots[index]);
+
+    // move the last token into the gap instead of shifting everything behind it
+    const auto last = this->_tokens.size() - 1;
+    if (index != last)
     {
-        return PermissionDenied;
+        const auto fingerprint = this->_tokens[last].fingerprint();
+        this->eraseIndexEntry(fingerprint, last);
+        this->_tokens[index] = std::move(this->_tokens[last]);
+        this->_tokenSlots[index] = this->_tokenSlots[last];
+        this->_tokenRecords[index] = this->_tokenRecords[last];
+        this->_slots[this->_tokenSlots[index]].index = static_cast<std::uint32_t>(index);
+        this->_index.emplace(fingerprint, index);
     }
 
-    return NoError;
+    this->_tokens.pop_back();
+    this->_tokenSlots.pop_back();
+    this->_tokenRecords.pop_back();
+    this->_groupsDirty = true;
 }
 
-void TokenStore::deserializeData(const std::string &fileContents)
+void TokenStore::replaceToken(std::size_t index, const OTPToken &token)
 {
-    std::istringstream buffer(fileContents);
+    if (this->_journaling)
+    {
+        this->_journal.emplace_back(JournalEntry{JournalUpdate, static_cast<std::uint32_t>(index), token});
+    }
 
-    cereal::PortableBinaryInputArchive archive(buffer);
-    try {
-        archive(this->_tokens);
-        for (auto&& token : this->_tokens)
+    this->eraseIndexEntry(this->_tokens[index].fingerprint(), index);
+    this->_tokens[index] = token;
+    this->_tokenRecords[index] = {};
+    this->_index.emplace(this->_tokens[index].fingerprint(), index);
+    if (!this->_labelsDirty)
+    {
+        this->_labels.insert(this->_tokenSlots[index], token.label());
+    }
+    this->_groupsDirty = true;
+}
+
+void TokenStore::eraseIndexEntry(std::uint64_t fingerprint, std::size_t index)
+{
+    const auto range = this->_index.equal_range(fingerprint);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == index)
         {
-            if (!token._secret.empty())
-            {
-                token.valid = true;
-            }
+            this->_index.erase(it);
+            return;
         }
-    } catch (cereal::Exception &e) {
-        this->_tokens.clear();
+    }
+}
+
+void TokenStore::rebuildIndex() const
+{
+    this->_index.clear();
+    this->_index.reserve(this->_tokens.size());
+    for (std::size_t i = 0; i < this->_tokens.size(); ++i)
+    {
+        this->_index.emplace(this->_tokens[i].fingerprint(), i);
+    }
+    this->_indexDirty = false;
+}
+
+void TokenStore::assignSlots()
+{
+    for (auto&& slot : this->_tokenSlots)
+    {
+        this->releaseSlot(slot);
+    }
+
+    this->_tokenSlots.resize(this->_tokens.size());
+    for (std::size_t i = 0; i < this->_tokens.size(); ++i)
+    {
+        this->_tokenSlots[i] = this->acquireSlot(i);
+    }
+}
+
+std::uint32_t TokenStore::acquireSlot(std::size_t index)
+{
+    if (this->_freeSlots == NoSlot)
+    {
+        this->_slots.emplace_back(Slot{static_cast<std::uint32_t>(index), 1});
+        return static_cast<std::uint32_t>(this->_slots.size() - 1);
+    }
+
+    const auto slot = this->_freeSlots;
+    this->_freeSlots = this->_slots[slot].index;
+    this->_slots[slot].index = static_cast<std::uint32_t>(index);
+    return slot;
+}
+
+void TokenStore::releaseSlot(std::uint32_t slot)
+{
+    // a new generation invalidates all handles to this slot, 0 is reserved for InvalidHandle
+    auto &entry = this->_slots[slot];
+    entry.generation = entry.generation == UINT32_MAX ? 1 : entry.generation + 1;
+    entry.index = this->_freeSlots;
+    this->_freeSlots = slot;
+}
+
+static_assert(TokenStore::GeneratedCodes::SlotSize > MAX_TOKEN_LENGTH);
+
+void TokenStore::generateAll(const std::time_t &time, GeneratedCodes &output)
+{
+    if (this->_groupsDirty)
+    {
+        this->updateGenerationGroups();
+    }
+
+    // only reallocates when the store grew since the last call
+    output.codes.resize(this->_tokens.size() * GeneratedCodes::SlotSize);
+    output.errors.resize(this->_tokens.size());
+
+    // tokens waiting to be hashed side by side, groups are sorted by algorithm
+    // so a batch can span multiple groups as long as the algorithm doesn't change
+    struct Pending
+    {
+        std::size_t index;
+        const GenerationGroup *group;
+    };
+    Pending pending[BatchHMAC::LANES];
+    const OTPToken::KeyContext *contexts[BatchHMAC::LANES];
+    std::uint64_t counters[BatchHMAC::LANES];
+    unsigned char digests[BatchHMAC::LANES * BatchHMAC::STRIDE];
+    std::size_t pendingCount = 0;
+
+    const auto flush = [&]{
+        if (pendingCount == 0)
+        {
+            return;
+        }
+
+        BatchHMAC::compute(contexts, counters, pendingCount, digests);
+        const auto hmac_size = digest_size(contexts[0]->algorithm);
+
+        for (std::size_t i = 0; i < pendingCount; ++i)
+        {
+            char *slot = &output.codes[pending[i].index * GeneratedCodes::SlotSize];
+            const auto length = format_token(digests + i * BatchHMAC::STRIDE, hmac_size,
+                                             pending[i].group->type, pending[i].group->digits, slot);
+            slot[length] = '\0';
+        }
+
+        pendingCount = 0;
+    };
+
+    for (auto&& group : this->_groups)
+    {
+        // invalid parameters fail the entire group
+        OTPToken::Error groupError = OTPToken::Valid;
+        if (group.type != OTPToken::Steam && !check_otp_length(group.digits))
+        {
+            groupError = OTPToken::InvalidDigits;
+        }
+        else if (group.type == OTPToken::TOTP && !check_period(group.period))
+        {
+            groupError = OTPToken::InvalidPeriod;
+        }
+
+        // derive the time counter once for the entire group
+        std::uint64_t counter = 0;
+        if (group.type == OTPToken::TOTP && groupError == OTPToken::Valid)
+        {
+            counter = static_cast<std::uint64_t>(time / group.period);
+        }
+        else if (group.type == OTPToken::Steam)
+        {
+            counter = static_cast<std::uint64_t>(time / STEAM_PERIOD);
+        }
+
+        for (auto i = group.begin; i < group.end; ++i)
+        {
+            const auto index = this->_groupOrder[i];
+            const auto &token = this->_tokens[index];
+            auto &error = output.errors[index];
+
+            output.codes[index * GeneratedCodes::SlotSize] = '\0';
+            error = groupError;
+
+            if (error != OTPToken::Valid)
+            {
+                continue;
+            }
+
+            if (!token.isValid())
+            {
+                error = OTPToken::InvalidOTP;
+                continue;
+            }
+
+            const auto &ctx = token.keyContext();
+            if (ctx.error != OTPToken::Valid)
+            {
+                error = ctx.error;
+                continue;
+            }
+
+            if (pendingCount == BatchHMAC::LANES ||
+                (pendingCount > 0 && contexts[0]->algorithm != ctx.algorithm))
+            {
+                flush();
+            }
+
+            pending[pendingCount] = Pending{index, &group};
+            contexts[pendingCount] = &ctx;
+            counters[pendingCount] = group.type == OTPToken::HOTP ? token._counter : counter;
+            ++pendingCount;
+        }
+    }
+
+    flush();
+}
+
+const std::string_view TokenStore::error_code() const
+{
+    return magic_enum::enum_name(this->_state);
+}
+
+TokenStore::ErrorCode TokenStore::commit()
+{
+    // refuse to commit a invalid state
+    if (!this->isValid())
+    {
+        return this->_state;
+    }
+
+    // background commits were started earlier and must land first
+    this->flush();
+
+    if (this->_mode == Snapshot || this->_snapshotDue || this->_thumbnailsDirty)
+    {
+        this->_journal.clear();
+        this->_thumbnailsDirty = false;
+        return this->writeSnapshot();
+    }
+
+    const auto changes = std::move(this->_journal);
+    this->_journal.clear();
+    return this->writeChanges(changes, &this->_tokens);
+}
+
+std::future<TokenStore::ErrorCode> TokenStore::commitAsync()
+{
+    std::promise<ErrorCode> result;
+    auto future = result.get_future();
+
+    // refuse to commit a invalid state
+    if (!this->isValid())
+    {
+        result.set_value(this->_state);
+        return future;
+    }
+
+    // only the copy happens on the calling thread, serialization, encryption
+    // and I/O are left to the writer
+    this->adoptWrittenSnapshot();
+    CommitJob job;
+    if (this->_mode == Snapshot || this->_snapshotDue || this->_thumbnailsDirty)
+    {
+        job.tokens = std::make_shared<const std::vector<OTPToken>>(this->_tokens);
+        job.records = std::make_shared<const std::vector<StoredRecord>>(this->_tokenRecords);
+        job.thumbnails = std::make_shared<const ThumbnailCache>(this->_thumbnails);
+        job.file = this->_loadedFile;
+        this->_thumbnailsDirty = false;
+    }
+    else
+    {
+        job.changes = std::move(this->_journal);
+    }
+    this->_journal.clear();
+    job.results.emplace_back(std::move(result));
+
+    if (!this->_writer)
+    {
+        this->_writer = std::make_unique<CommitWriter>(*this);
+    }
+    this->_writer->submit(std::move(job));
+    return future;
+}
+
+void TokenStore::flush()
+{
+    if (this->_writer)
+    {
+        this->_writer->flush();
+    }
+    this->adoptWrittenSnapshot();
+}
+
+void TokenStore::prefetchIcons() const
+{
+    // every distinct icon is decrypted once, large icon sections on all cores
+    std::vector<const OTPToken::Icon*> icons;
+    std::unordered_set<const OTPToken::Icon*> seen;
+    std::size_t size = 0;
+    for (auto&& token : this->_tokens)
+    {
+        const auto *icon = token._icon.get();
+        if (icon && !icon->loaded() && seen.emplace(icon).second)
+        {
+            icons.emplace_back(icon);
+            size += icon->size();
+        }
+    }
+
+    std::atomic<std::size_t> next = 0;
+    const auto threads = size < ICON_PARALLEL_THRESHOLD ? 1 :
+        static_cast<unsigned>(std::min<std::size_t>(worker_threads(this->_threads), icons.size()));
+    run_parallel(threads, [&](bool) {
+        for (auto i = next++; i < icons.size(); i = next++)
+        {
+            icons[i]->data();
+        }
+    });
+}
+
+std::shared_ptr<const Thumbnail> TokenStore::thumbnail(Handle handle, std::uint16_t size) const
+{
+    const auto *token = this->token(handle);
+    if (!token || !token->_icon || size == 0)
+    {
+        return nullptr;
+    }
+
+    const ThumbnailKey key{token->_icon->digest, size};
+    auto it = this->_thumbnails.find(key);
+    if (it != this->_thumbnails.end() && !it->second.thumbnail)
+    {
+        auto thumbnail = this->_loadedFile ? this->_loadedFile->loadThumbnail(key, it->second) : nullptr;
+        if (thumbnail)
+        {
+            it->second.thumbnail = std::move(thumbnail);
+        }
+        else
+        {
+            // corrupt thumbnails are scaled again
+            this->_thumbnails.erase(it);
+            it = this->_thumbnails.end();
+        }
+    }
+
+    if (it == this->_thumbnails.end())
+    {
+        // without support only stored thumbnails are available
+        if (!Thumbnail::supported())
+        {
+            return nullptr;
+        }
+
+        // icons which can't be scaled are remembered, but not stored
+        auto thumbnail = std::make_shared<const Thumbnail>(Thumbnail::create(token->icon(), size));
+        this->_thumbnailsDirty = this->_thumbnailsDirty || !thumbnail->isEmpty();
+        it = this->_thumbnails.emplace(key, CachedThumbnail{std::move(thumbnail)}).first;
+    }
+
+    return it->second.thumbnail->isEmpty() ? nullptr : it->second.thumbnail;
+}
+
+void TokenStore::setProgressCallback(ProgressCallback progress)
+{
+    // the writer thread may be using the current callback
+    this->flush();
+    this->_progress = std::move(progress);
+}
+
+TokenStore::ErrorCode TokenStore::writeCommit(const CommitJob &job)
+{
+    if (job.tokens)
+    {
+        auto written = std::make_unique<WrittenSnapshot>();
+        const auto result = this->writeSnapshot(*job.tokens, *job.records, *job.thumbnails, job.file, *written);
+        if (result != NoError)
+        {
+            return result;
+        }
+
+        // the store's tokens may have changed meanwhile, it adopts the file on its own thread
+        written->copied = job.records;
+        std::lock_guard<std::mutex> lock(this->_writtenMutex);
+        this->_written = std::move(written);
+    }
+
+    return this->writeChanges(job.changes, nullptr);
+}
+
+TokenStore::ErrorCode TokenStore::writeChanges(const std::vector<JournalEntry> &changes, const std::vector<OTPToken> *tokens)
+{
+    if (changes.empty())
+    {
+        return NoError;
+    }
+
+    // serialize the changes since the last commit
+    std::ostringstream serializedChangesBuf;
+    {
+        cereal::PortableBinaryOutputArchive archive(serializedChangesBuf);
+        archive(static_cast<std::uint32_t>(changes.size()));
+        for (auto&& entry : changes)
+        {
+            archive(entry.op, entry.index);
+            if (entry.op == JournalAdd || entry.op == JournalUpdate)
+            {
+                archive(entry.token);
+            }
+        }
+    }
+
+    const auto serializedChanges = serializedChangesBuf.str();
+
+    // replaying a journal larger than the snapshot costs more than loading a new snapshot
+    const auto journalSize = this->_journalSize + serializedChanges.size() + JOURNAL_RECORD_OVERHEAD;
+    if (journalSize > std::max(JOURNAL_COMPACT_SIZE, this->_snapshotSize))
+    {
+        if (tokens)
+        {
+            return this->writeSnapshot();
+        }
+
+        // the writer thread can't see the tokens, the next commit takes a snapshot
+        this->_snapshotDue = true;
+    }
+
+    return this->appendJournal(serializedChanges);
+}
+
+TokenStore::ErrorCode TokenStore::writeSnapshot()
+{
+    WrittenSnapshot written;
+    const auto result = this->writeSnapshot(this->_tokens, this->_tokenRecords, this->_thumbnails, this->_loadedFile, written);
+    if (result == NoError)
+    {
+        this->adoptSnapshot(std::move(written));
+    }
+    return result;
+}
+
+TokenStore::ErrorCode TokenStore::writeSnapshot(const std::vector<OTPToken> &tokens, const std::vector<StoredRecord> &records,
+                                                const ThumbnailCache &thumbnails, const std::shared_ptr<LoadedFile> &source,
+                                                WrittenSnapshot &written)
+{
+    const auto journaled = this->_mode == Journaled;
+    CryptoPP::SHA256 snapshotHash;
+    std::size_t snapshotSize = 0;
+    bool writeFailed = false;
+
+    // every distinct icon is written once, in the order of its first token
+    std::vector<const OTPToken::Icon*> icons;
+    std::unordered_map<const OTPToken::Icon*, std::uint64_t> iconPositions;
+    std::uint64_t iconSectionSize = 0;
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+    {
+        const auto *icon = tokens[i]._icon.get();
+        if (!icon)
+        {
+            continue;
+        }
+
+        const auto [it, inserted] = iconPositions.try_emplace(icon, iconSectionSize);
+        if (inserted)
+        {
+            icons.emplace_back(icon);
+            iconSectionSize += icon->size() + ICON_OVERHEAD;
+        }
+    }
+
+    // thumbnails follow the icons, only those of written icons are kept
+    std::unordered_set<OTPToken::IconDigest, DigestHash> iconDigests;
+    iconDigests.reserve(icons.size());
+    for (auto&& icon : icons)
+    {
+        iconDigests.emplace(icon->digest);
+    }
+
+    struct StoredThumbnail
+    {
+        const ThumbnailKey *key;
+        const CachedThumbnail *entry;
+        std::uint16_t width;
+        std::uint16_t height;
+        std::uint64_t offset;
+    };
+
+    std::vector<StoredThumbnail> storedThumbnails;
+    for (auto&& [key, entry] : thumbnails)
+    {
+        const auto stored = entry.stored && source;
+        const auto &thumbnail = entry.thumbnail;
+        if ((!stored && (!thumbnail || thumbnail->isEmpty())) || !iconDigests.count(key.digest))
+        {
+            continue;
+        }
+
+        const auto width = stored ? entry.width : thumbnail->width();
+        const auto height = stored ? entry.height : thumbnail->height();
+        storedThumbnails.emplace_back(StoredThumbnail{&key, &entry, width, height, iconSectionSize});
+        iconSectionSize += thumbnailLength(width, height) + ICON_OVERHEAD;
+    }
+
+    // icons, thumbnails and token records are sealed in segments, which
+    // are sealed on all cores and written in order by the calling thread
+    enum SegmentType
+    {
+        IconSegment,
+        ThumbnailSegment,
+        RecordSegment,
+    };
+
+    struct Segment
+    {
+        SegmentType type;
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    std::vector<Segment> segments;
+    const auto addSegments = [&segments](SegmentType type, std::size_t count, auto &&length) {
+        for (std::size_t begin = 0, end = 0; begin < count; begin = end)
+        {
+            for (std::size_t size = 0; end < count && size < SNAPSHOT_SEGMENT_SIZE; ++end)
+            {
+                size += length(end);
+            }
+            segments.emplace_back(Segment{type, begin, end});
+        }
+    };
+    addSegments(IconSegment, icons.size(), [&icons](std::size_t i) {
+        return icons[i]->size() + ICON_OVERHEAD;
+    });
+    addSegments(ThumbnailSegment, storedThumbnails.size(), [&storedThumbnails](std::size_t i) {
+        return thumbnailLength(storedThumbnails[i].width, storedThumbnails[i].height) + ICON_OVERHEAD;
+    });
+    for (std::size_t begin = 0; begin < tokens.size(); begin += RECORD_BLOCK)
+    {
+        segments.emplace_back(Segment{RecordSegment, begin, std::min(begin + RECORD_BLOCK, tokens.size())});
+    }
+
+    // every thread seals with its own ciphers
+    struct SegmentSealer
+    {
+        SegmentSealer(const CryptoPP::SecByteBlock &iconKey, const CryptoPP::SecByteBlock &recordKey)
+        {
+            if (iconKey.size() > 0)
+            {
+                record_cipher(this->iconGcm, iconKey);
+            }
+            record_cipher(this->recordGcm, recordKey);
+        }
+
+        CryptoPP::GCM<CryptoPP::AES>::Encryption iconGcm;
+        CryptoPP::GCM<CryptoPP::AES>::Encryption recordGcm;
+        std::string plaintext;
+        StringStreambuf streambuf{plaintext};
+        std::ostream stream{&streambuf};
+    };
+
+    // position of every record in the written file
+    std::vector<StoredRecord> writtenRecords(tokens.size());
+
+    // tokens are serialized, sealed and written segment by segment, so the
+    // plaintext of the entire store is never in memory at once
+    const auto replaced = replace_file_with(this->_filePath, [&](auto &&write) {
+        const auto emit = [&](const char *data, std::size_t size) {
+            if (journaled)
+            {
+                snapshotHash.Update(reinterpret_cast<const unsigned char*>(data), size);
+            }
+            snapshotSize += size;
+            writeFailed = !write(data, size);
+            return !writeFailed;
+        };
+
+        try {
+            const auto header = store_header(iconSectionSize);
+            if (!emit(header.data(), header.size()))
+            {
+                return false;
+            }
+
+            const auto iconKey = icons.empty() ? CryptoPP::SecByteBlock() : icon_key(this->_password);
+            const auto recordKey = record_key(this->_password);
+            const SnapshotNonces iconNonces;
+            const SnapshotNonces recordNonces;
+            const auto *loadedFile = source.get();
+
+            const auto sealIcons = [&](SegmentSealer &sealer, const Segment &segment, std::string &sealed) {
+                for (auto i = segment.begin; i < segment.end; ++i)
+                {
+                    // icons which weren't loaded from a file of this store are copied sealed
+                    const auto *icon = icons[i];
+                    const auto *file = dynamic_cast<const LoadedFile*>(icon->source.get());
+                    if (!icon->loaded() && file && file->sealedWith(iconKey))
+                    {
+                        const auto stored = file->sealed(icon->offset, icon->length);
+                        if (stored.empty())
+                        {
+                            return false;
+                        }
+                        sealed.append(stored);
+                        continue;
+                    }
+
+                    const auto &data = icon->data();
+                    if (data.size() != icon->length)
+                    {
+                        return false;
+                    }
+                    icon_seal(sealer.iconGcm, iconNonces, static_cast<std::uint32_t>(i), icon->digest, data, sealed);
+                }
+                return true;
+            };
+
+            const auto sealThumbnails = [&](SegmentSealer &sealer, const Segment &segment, std::string &sealed) {
+                for (auto i = segment.begin; i < segment.end; ++i)
+                {
+                    // thumbnails from this store's file are copied sealed as well
+                    const auto &thumbnail = storedThumbnails[i];
+                    if (thumbnail.entry->stored && loadedFile)
+                    {
+                        const auto stored = loadedFile->sealed(thumbnail.entry->offset, thumbnailLength(thumbnail.width, thumbnail.height));
+                        if (stored.empty())
+                        {
+                            return false;
+                        }
+                        sealed.append(stored);
+                        continue;
+                    }
+
+                    thumbnail_seal(sealer.iconGcm, iconNonces, static_cast<std::uint32_t>(icons.size() + i),
+                                   thumbnail.key->digest, thumbnail.key->size, thumbnail.entry->thumbnail->pixels(), sealed);
+                }
+                return true;
+            };
+
+            const auto sealRecords = [&](SegmentSealer &sealer, const Segment &segment, std::string &sealed) {
+                for (auto i = segment.begin; i < segment.end; ++i)
+                {
+                    // unchanged tokens keep their sealed record
+                    const auto stored = records[i].size > 0 && loadedFile ?
+                        loadedFile->contents(records[i].offset, records[i].size) : std::string_view();
+                    if (!stored.empty())
+                    {
+                        sealed.append(stored);
+                        continue;
+                    }
+
+                    sealer.plaintext.clear();
+                    {
+                        cereal::PortableBinaryOutputArchive archive(sealer.stream);
+                        StoredToken::saveRecord(archive, tokens[i]);
+                    }
+                    record_seal(sealer.recordGcm, recordNonces, static_cast<std::uint32_t>(i), TokenRecord, sealer.plaintext, sealed);
+                }
+                return true;
+            };
+
+            const auto makeSealer = [&]{
+                return [&, sealer = SegmentSealer(iconKey, recordKey)](std::size_t index, std::string &sealed) mutable {
+                    const auto &segment = segments[index];
+                    sealed.clear();
+                    switch (segment.type)
+                    {
+                        case IconSegment:       return sealIcons(sealer, segment, sealed);
+                        case ThumbnailSegment:  return sealThumbnails(sealer, segment, sealed);
+                        case RecordSegment:     return sealRecords(sealer, segment, sealed);
+                    }
+                    return false;
+                };
+            };
+
+            CryptoPP::SHA256 recordHash;
+            const auto written = run_ordered<std::string>(worker_threads(this->_threads), segments.size(), makeSealer,
+                                                          [&](std::size_t index, std::string &sealed) {
+                const auto &segment = segments[index];
+                if (segment.type != RecordSegment)
+                {
+                    return emit(sealed.data(), sealed.size());
+                }
+
+                const std::string_view records(sealed);
+                auto i = segment.begin;
+                for (std::size_t offset = 0; offset < records.size(); ++i)
+                {
+                    const auto size = record_size(records, offset);
+                    if (size == 0 || i == segment.end)
+                    {
+                        return false;
+                    }
+                    record_hash_update(recordHash, records.substr(offset, size));
+                    writtenRecords[i] = StoredRecord{snapshotSize + offset, static_cast<std::uint32_t>(size)};
+                    offset += size;
+                }
+                if (!emit(sealed.data(), sealed.size()))
+                {
+                    return false;
+                }
+
+                if (this->_progress)
+                {
+                    for (auto i = segment.begin; i < segment.end; ++i)
+                    {
+                        this->_progress(i + 1, tokens.size());
+                    }
+                }
+                return true;
+            });
+            if (!written)
+            {
+                return false;
+            }
+
+            // the trailer authenticates the records as a whole
+            RecordHash hash;
+            recordHash.Final(hash.data());
+
+            std::string plaintext;
+            StringStreambuf streambuf(plaintext);
+            std::ostream stream(&streambuf);
+            {
+                cereal::PortableBinaryOutputArchive archive(stream);
+                archive(static_cast<std::uint64_t>(tokens.size()), cereal::binary_data(hash.data(), hash.size()));
+
+                archive(cereal::make_size_tag(static_cast<cereal::size_type>(icons.size())));
+                for (auto&& icon : icons)
+                {
+                    archive(cereal::binary_data(icon->digest.data(), icon->digest.size()), iconPositions[icon]);
+                }
+
+                save_thumbnail_index(archive, storedThumbnails);
+            }
+
+            CryptoPP::GCM<CryptoPP::AES>::Encryption gcm;
+            record_cipher(gcm, recordKey);
+            std::string trailer;
+            record_seal(gcm, recordNonces, static_cast<std::uint32_t>(tokens.size()), TrailerRecord, plaintext, trailer);
+
+            return emit(trailer.data(), trailer.size());
+        } catch (...) {
+            return false;
+        }
+    });
+
+    // a failed snapshot leaves changes unwritten which aren't journaled anymore,
+    // so the next commit has to take a snapshot as well
+    if (!replaced)
+    {
+        this->_snapshotDue = true;
+        return writeFailed ? PermissionDenied : EncryptionError;
+    }
+
+    // the snapshot contains all journaled changes now, a journal which can't
+    // be removed is still ignored on load as it doesn't match the new snapshot
+    std::error_code ec;
+    std::filesystem::remove(this->journalPath(), ec);
+
+    if (journaled)
+    {
+        snapshotHash.Final(this->_snapshotHash.data());
+        this->_snapshotSize = snapshotSize;
+    }
+    this->_journalSize = 0;
+    this->_journalSequence = 0;
+    this->_snapshotDue = false;
+
+    // the written file takes the place of the loaded one, later snapshots
+    // copy unchanged records and thumbnails from it
+    written.source = source;
+    written.records = std::move(writtenRecords);
+    written.thumbnails.reserve(storedThumbnails.size());
+    for (auto&& thumbnail : storedThumbnails)
+    {
+        written.thumbnails.emplace_back(*thumbnail.key, CachedThumbnail{nullptr, true, thumbnail.width, thumbnail.height, thumbnail.offset});
+    }
+
+    auto file = std::make_shared<LoadedFile>();
+    std::uint8_t version;
+    std::uint64_t writtenSectionSize;
+    if (file->file().open(this->_filePath) && file->file().data().size() == snapshotSize &&
+        parse_store_header(file->file().data(), version, writtenSectionSize) &&
+        version == STORE_VERSION && writtenSectionSize == iconSectionSize)
+    {
+        if (iconSectionSize > 0)
+        {
+            file->setSection(file->file().data().substr(STORE_HEADER_SIZE, iconSectionSize), this->_password);
+        }
+        written.file = std::move(file);
+    }
+
+    return NoError;
+}
+
+void TokenStore::adoptSnapshot(WrittenSnapshot &&snapshot)
+{
+    // snapshots copied from a file the store doesn't use anymore are outdated
+    if (snapshot.source != this->_loadedFile)
+    {
+        return;
+    }
+
+    if (!snapshot.file)
+    {
+        std::fill(this->_tokenRecords.begin(), this->_tokenRecords.end(), StoredRecord());
+    }
+    else if (!snapshot.copied)
+    {
+        this->_tokenRecords = std::move(snapshot.records);
+    }
+    else
+    {
+        // records the tokens had when the background snapshot was taken
+        std::unordered_map<std::uint64_t, StoredRecord> moved;
+        moved.reserve(snapshot.copied->size());
+        for (std::size_t i = 0; i < snapshot.copied->size(); ++i)
+        {
+            if ((*snapshot.copied)[i].size > 0)
+            {
+                moved.emplace((*snapshot.copied)[i].offset, snapshot.records[i]);
+            }
+        }
+
+        for (auto&& record : this->_tokenRecords)
+        {
+            if (record.size > 0)
+            {
+                const auto it = moved.find(record.offset);
+                record = it != moved.end() ? it->second : StoredRecord();
+            }
+        }
+    }
+
+    // stored thumbnails which weren't written are dropped unless loaded
+    std::unordered_map<ThumbnailKey, const CachedThumbnail*, ThumbnailKeyHash> stored;
+    if (snapshot.file)
+    {
+        stored.reserve(snapshot.thumbnails.size());
+        for (auto&& [key, entry] : snapshot.thumbnails)
+        {
+            stored.emplace(key, &entry);
+        }
+    }
+
+    for (auto it = this->_thumbnails.begin(); it != this->_thumbnails.end();)
+    {
+        auto &entry = it->second;
+        const auto written = stored.find(it->first);
+        if (written != stored.end())
+        {
+            entry.stored = true;
+            entry.width = written->second->width;
+            entry.height = written->second->height;
+            entry.offset = written->second->offset;
+        }
+        else if (entry.stored)
+        {
+            entry.stored = false;
+            if (!entry.thumbnail)
+            {
+                it = this->_thumbnails.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+
+    this->_loadedFile = std::move(snapshot.file);
+}
+
+void TokenStore::adoptWrittenSnapshot()
+{
+    std::unique_ptr<WrittenSnapshot> written;
+    {
+        std::lock_guard<std::mutex> lock(this->_writtenMutex);
+        written = std::move(this->_written);
+    }
+
+    if (written)
+    {
+        this->adoptSnapshot(std::move(*written));
+    }
+}
+
+TokenStore::ErrorCode TokenStore::appendJournal(const std::string &changes)
+{
+    // a failed append leaves changes unwritten, the next commit takes a snapshot instead
+    std::string data;
+    try {
+        const auto key = journal_key(this->_password);
+
+        // a new journal starts with a header binding it to the current snapshot
+        if (this->_journalSize == 0)
+        {
+            data = journal_header(key, this->_snapshotHash);
+        }
+        data += journal_seal(key, this->_snapshotHash, this->_journalSequence, changes);
+    } catch (...) {
+        this->_snapshotDue = true;
+        return EncryptionError;
+    }
+
+    // appending after the intact part also drops a torn record
+    if (!write_file_synced(this->journalPath(), this->_journalSize, data))
+    {
+        this->_snapshotDue = true;
+        return PermissionDenied;
+    }
+
+    this->_journalSize += data.size();
+    ++this->_journalSequence;
+    return NoError;
+}
+
+void TokenStore::replayJournal(std::string_view snapshot)
+{
+    MappedFile file;
+    std::error_code ec;
+    const auto journalFound = std::filesystem::is_regular_file(this->journalPath(), ec) &&
+                              file.open(this->journalPath()) && !file.data().empty();
+    const auto journal = file.data();
+
+    if (!journalFound && this->_mode != Journaled)
+    {
+        return;
+    }
+
+    this->_snapshotHash = journal_hash(snapshot);
+    this->_snapshotSize = snapshot.size();
+    if (!journalFound)
+    {
+        return;
+    }
+
+    try {
+        const auto key = journal_key(this->_password);
+        const auto header = journal_check_header(key, journal, this->_snapshotHash);
+        if (header == JournalHeaderForged)
+        {
+            this->clear();
+            this->_state = DecryptionError;
+            return;
+        }
+        else if (header == JournalHeaderStale)
+        {
+            // written before the current snapshot, the next commit replaces it
+            return;
+        }
+
+        // a torn record can only be the last one, the next commit overwrites it
+        auto offset = JOURNAL_HEADER_SIZE;
+        std::string changes;
+        while (offset < journal.size())
+        {
+            const auto record = journal_open(key, this->_snapshotHash, this->_journalSequence, journal, offset, changes);
+            if (record == JournalRecordTorn)
+            {
+                break;
+            }
+            else if (record == JournalRecordForged)
+            {
+                // keep the journal untouched, an invalid store isn't committed
+                this->clear();
+                this->_state = DecryptionError;
+                return;
+            }
+
+            if (!this->applyJournal(changes))
+            {
+                this->clear();
+                this->_state = DeserializationError;
+                return;
+            }
+
+            ++this->_journalSequence;
+        }
+
+        this->_journalSize = offset;
+    } catch (...) {
+        this->clear();
+        this->_state = DecryptionError;
+    }
+}
+
+bool TokenStore::applyJournal(std::string_view changes)
+{
+    SpanStreambuf streambuf(changes);
+    std::istream buffer(&streambuf);
+
+    cereal::PortableBinaryInputArchive archive(buffer);
+    try {
+        std::uint32_t count;
+        archive(count);
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            std::uint8_t op;
+            std::uint32_t index;
+            archive(op, index);
+
+            OTPToken token;
+            if (op == JournalAdd || op == JournalUpdate)
+            {
+                archive(token);
+                token.valid = !token._secret.empty();
+            }
+
+            // indices are only meaningful when all earlier changes were applied in order
+            if ((op == JournalRemove || op == JournalUpdate) && index >= this->_tokens.size())
+            {
+                return false;
+            }
+
+            switch (op)
+            {
+                case JournalAdd:    this->insertToken(token); break;
+                case JournalRemove: this->eraseToken(index); break;
+                case JournalUpdate: this->replaceToken(index, token); break;
+                case JournalClear:  this->clear(); break;
+                default:            return false;
+            }
+        }
+    } catch (cereal::Exception &e) {
+        return false;
+    }
+
+    return true;
+}
+
+void TokenStore::updateGenerationGroups()
+{
+    const auto group_key = [this](std::size_t index) {
+        const auto &token = this->_tokens[index];
+        // algorithm first so tokens sharing it are adjacent for batched hashing
+        return std::make_tuple(token._algorithm, token._type, token._period, token._digits);
+    };
+
+    this->_groupOrder.resize(this->_tokens.size());
+    for (std::size_t i = 0; i < this->_groupOrder.size(); ++i)
+    {
+        this->_groupOrder[i] = i;
+    }
+
+    std::stable_sort(this->_groupOrder.begin(), this->_groupOrder.end(), [&](std::size_t a, std::size_t b) {
+        return group_key(a) < group_key(b);
+    });
+
+    this->_groups.clear();
+    for (std::size_t i = 0; i < this->_groupOrder.size(); ++i)
+    {
+        const auto &token = this->_tokens[this->_groupOrder[i]];
+        if (i == 0 || group_key(this->_groupOrder[i - 1]) != group_key(this->_groupOrder[i]))
+        {
+            this->_groups.emplace_back(GenerationGroup{token._type, token._algorithm, token._period, token._digits, i, i});
+        }
+        this->_groups.back().end = i + 1;
+    }
+
+    this->_groupsDirty = false;
+}
+
+void TokenStore::loadRecords(std::string_view section)
+{
+    const auto *file = this->_loadedFile->file().data().data();
+
+    // records are framed in the clear, finding them doesn't decrypt anything
+    std::vector<StoredRecord> records;
+    records.reserve(section.size() / (RECORD_OVERHEAD + SERIALIZED_TOKEN_MIN_SIZE));
+    for (std::size_t offset = 0; offset < section.size();)
+    {
+        const auto size = record_size(section, offset);
+        if (size == 0)
+        {
+            this->_state = DecryptionError;
+            return;
+        }
+
+        records.emplace_back(StoredRecord{static_cast<std::uint64_t>(section.data() + offset - file), static_cast<std::uint32_t>(size)});
+        offset += size;
+    }
+
+    // the last record is the trailer
+    if (records.empty())
+    {
+        this->_state = DecryptionError;
+        return;
+    }
+    const auto trailer = records.back();
+    records.pop_back();
+
+    const auto record = [file](const StoredRecord &record) {
+        return std::string_view(file + record.offset, record.size);
+    };
+
+    const auto key = record_key(this->_password);
+    CryptoPP::GCM<CryptoPP::AES>::Decryption gcm;
+    record_cipher(gcm, key);
+
+    // an incorrect password is detected before any token is opened
+    std::string plaintext;
+    if (!record_open(gcm, TrailerRecord, record(trailer), plaintext))
+    {
+        this->_state = DecryptionError;
+        return;
+    }
+
+    std::uint64_t count;
+    RecordHash expectedHash;
+    std::unordered_map<OTPToken::IconDigest, std::uint64_t, DigestHash> iconOffsets;
+    try {
+        SpanStreambuf streambuf(plaintext);
+        std::istream stream(&streambuf);
+        cereal::PortableBinaryInputArchive archive(stream);
+        archive(count, cereal::binary_data(expectedHash.data(), expectedHash.size()));
+
+        cereal::size_type icons;
+        archive(cereal::make_size_tag(icons));
+        iconOffsets.reserve(std::min<cereal::size_type>(icons, plaintext.size() / ICON_TABLE_ENTRY_SIZE));
+        for (cereal::size_type i = 0; i < icons; ++i)
+        {
+            OTPToken::IconDigest digest;
+            std::uint64_t offset;
+            archive(cereal::binary_data(digest.data(), digest.size()), offset);
+            iconOffsets.emplace(digest, offset);
+        }
+
+        load_thumbnail_index(archive, plaintext.size(), this->_thumbnails, [this](const CachedThumbnail &entry) {
+            return this->acceptThumbnail(entry);
+        });
+    } catch (std::exception &e) {
+        this->_thumbnails.clear();
+        this->_state = DeserializationError;
+        return;
+    }
+
+    // dropped, reordered or replaced records don't match the trailer
+    CryptoPP::SHA256 recordHash;
+    for (auto&& stored : records)
+    {
+        record_hash_update(recordHash, record(stored));
+    }
+    RecordHash hash;
+    recordHash.Final(hash.data());
+    if (count != records.size() || hash != expectedHash)
+    {
+        this->_thumbnails.clear();
+        this->_state = DecryptionError;
+        return;
+    }
+
+    this->_groupsDirty = true;
+    this->_tokens.clear();
+    this->_tokens.resize(records.size());
+
+    // every record is opened on its own, threads claim blocks of records
+    // and the calling thread reports the progress in store order
+    const auto blocks = (records.size() + RECORD_BLOCK - 1) / RECORD_BLOCK;
+    std::vector<std::atomic<bool>> opened(blocks);
+    std::atomic<std::size_t> nextBlock = 0;
+    std::atomic<ErrorCode> error = NoError;
+    const std::shared_ptr<const OTPToken::IconSource> source = this->_loadedFile;
+
+    std::size_t reported = 0;
+    const auto report = [&]{
+        if (!this->_progress)
+        {
+            return;
+        }
+
+        for (; reported < blocks && opened[reported].load(std::memory_order_acquire); ++reported)
+        {
+            const auto end = std::min((reported + 1) * RECORD_BLOCK, records.size());
+            for (auto i = reported * RECORD_BLOCK; i < end; ++i)
+            {
+                this->_progress(i + 1, records.size());
+            }
+        }
+    };
+
+    const auto openBlocks = [&](bool reportProgress) {
+        CryptoPP::GCM<CryptoPP::AES>::Decryption gcm;
+        record_cipher(gcm, key);
+        std::string plaintext;
+        std::istream stream(nullptr);
+
+        while (true)
+        {
+            const auto block = nextBlock.fetch_add(1, std::memory_order_relaxed);
+            if (block >= blocks || error.load(std::memory_order_relaxed) != NoError)
+            {
+                return;
+            }
+
+            const auto end = std::min((block + 1) * RECORD_BLOCK, records.size());
+            for (auto i = block * RECORD_BLOCK; i < end; ++i)
+            {
+                if (!record_open(gcm, TokenRecord, record(records[i]), plaintext))
+                {
+                    error = DecryptionError;
+                    return;
+                }
+
+                auto &token = this->_tokens[i];
+                try {
+                    SpanStreambuf streambuf(plaintext);
+                    stream.rdbuf(&streambuf);
+                    cereal::PortableBinaryInputArchive archive(stream);
+
+                    std::uint32_t iconLength;
+                    OTPToken::IconDigest iconDigest;
+                    StoredToken::loadRecord(archive, token, iconLength, iconDigest);
+                    if (iconLength > 0)
+                    {
+                        const auto icon = iconOffsets.find(iconDigest);
+                        if (icon == iconOffsets.end())
+                        {
+                            error = DeserializationError;
+                            return;
+                        }
+                        token._icon = OTPToken::Icon::intern(iconDigest, source, icon->second, iconLength);
+                    }
+                } catch (std::exception &e) {
+                    error = DeserializationError;
+                    return;
+                }
+
+                if (!token._secret.empty())
+                {
+                    token.valid = true;
+                }
+            }
+
+            opened[block].store(true, std::memory_order_release);
+            if (reportProgress)
+            {
+                report();
+            }
+        }
+    };
+
+    const auto threads = records.size() < RECORD_PARALLEL_THRESHOLD ? 1 :
+        static_cast<unsigned>(std::min<std::size_t>(worker_threads(this->_threads), blocks));
+    run_parallel(threads, openBlocks);
+
+    if (error != NoError)
+    {
+        this->clear();
+        this->_thumbnails.clear();
+        this->_state = error;
+        return;
+    }
+    report();
+
+    this->_tokenRecords = std::move(records);
+    this->_index.clear();
+    this->_indexDirty = true;
+    this->assignSlots();
+    this->_labels.clear();
+    this->_labelsDirty = true;
+}
+
+bool TokenStore::acceptThumbnail(const CachedThumbnail &entry) const
+{
+    // entries pointing outside of the icon section are dropped
+    return this->_loadedFile && entry.width > 0 && entry.height > 0 &&
+           !this->_loadedFile->sealed(entry.offset, thumbnailLength(entry.width, entry.height)).empty();
+}
+
+void TokenStore::loadSnapshot(std::string_view encrypted, std::uint8_t version)
+{
+    try {
+        const auto key = makeKey(this->_password);
+        if (!hasValidPadding(encrypted, key, this->_password))
+        {
+            this->_state = DecryptionError;
+            return;
+        }
+
+        CryptoPP::AES::Decryption aesDecryption(key, CryptoPP::AES::DEFAULT_KEYLENGTH);
+        CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, reinterpret_cast<const unsigned char*>(this->_password.data()));
+
+        // tokens are decoded while the ciphertext is decrypted chunk by chunk,
+        // so the plaintext of the entire store is never in memory at once
+        CipherDecryptStreambuf streambuf(cbcDecryption, encrypted);
+        std::istream stream(&streambuf);
+        this->deserializeData(stream, encrypted.size(), version);
+
+        if (streambuf.failed())
+        {
+            this->clear();
+            this->_state = DecryptionError;
+        }
+    } catch (CryptoPP::Exception &e) {
+        this->clear();
+        this->_state = DecryptionError;
+    }
+}
+
+void TokenStore::deserializeData(std::istream &stream, std::size_t sizeHint, std::uint8_t version)
+{
+    cereal::PortableBinaryInputArchive archive(stream);
+    this->_groupsDirty = true;
+    try {
+        // the layout of a serialized vector, read one token at a time
+        cereal::size_type count;
+        archive(cereal::make_size_tag(count));
+
+        this->_tokens.clear();
+        this->_tokens.reserve(std::min<cereal::size_type>(count, sizeHint / SERIALIZED_TOKEN_MIN_SIZE));
+        for (cereal::size_type i = 0; i < count; ++i)
+        {
+            auto &token = this->_tokens.emplace_back();
+            if (version == STORE_VERSION_CBC)
+            {
+                StoredToken::load(archive, token, this->_loadedFile);
+            }
+            else if (version == STORE_VERSION_UNPOOLED)
+            {
+                std::uint64_t iconOffset;
+                std::uint32_t iconLength;
+                StoredToken::loadUnpooled(archive, token, iconOffset, iconLength);
+
+                OTPToken::Data icon;
+                if (iconLength > 0 && this->_loadedFile && this->_loadedFile->loadIcon(nullptr, iconOffset, iconLength, icon))
+                {
+                    token.setIcon(icon);
+                }
+            }
+            else
+            {
+                archive(token);
+            }
+            if (!token._secret.empty())
+            {
+                token.valid = true;
+            }
+
+            if (this->_progress)
+            {
+                this->_progress(static_cast<std::size_t>(i + 1), static_cast<std::size_t>(count));
+            }
+        }
+
+        // index of the stored thumbnails, missing in files written before
+        if (version == STORE_VERSION_CBC && stream.peek() != std::istream::traits_type::eof())
+        {
+            load_thumbnail_index(archive, sizeHint, this->_thumbnails, [this](const CachedThumbnail &entry) {
+                return this->acceptThumbnail(entry);
+            });
+        }
+
+        // records of older versions are sealed again on the next snapshot
+        this->_tokenRecords.assign(this->_tokens.size(), StoredRecord());
+
+        this->_index.clear();
+        this->_indexDirty = true;
+        this->assignSlots();
+        this->_labels.clear();
+        this->_labelsDirty = true;
+    } catch (std::exception &e) {
+        // corrupt sizes can also fail allocations
+        this->clear();
         this->_state = DeserializationError;
     }
 }
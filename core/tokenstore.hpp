@@ -1,15 +1,58 @@
 #ifndef TOKENSTORE_HPP
 #define TOKENSTORE_HPP
 
+#include <array>
 #include <string>
 #include <string_view>
 #include <vector>
+#include <span>
+#include <memory>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <istream>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
 
 #include "otptoken.hpp"
+#include "thumbnail.hpp"
+#include "clock.hpp"
+#include "labelindex.hpp"
 
 class TokenStore
 {
 public:
+    /**
+     * Stable reference to a stored token.
+     *
+     * Handles stay valid while the store changes, unlike pointers and
+     * indices into @see tokens. Once the token is removed its handle
+     * resolves to nothing, also when its storage is reused by another
+     * token later on.
+     */
+    using Handle = std::uint64_t;
+
+    // handle which never refers to a token
+    static constexpr Handle InvalidHandle = 0;
+
+    enum LabelMatch
+    {
+        ExactLabel,             // the label equals the query
+        LabelPrefix,            // the label starts with the query
+        LabelSubstring,         // the label contains the query
+    };
+
+    /**
+     * How @see commit writes changes to the filesystem.
+     */
+    enum StorageMode
+    {
+        Snapshot,               // every commit rewrites the entire store file
+        Journaled,              // commits append their changes to a journal next to the store file
+    };
 
     enum ErrorCode
     {
@@ -23,6 +66,46 @@ public:
         DeserializationError,   // error occurred during deserialization of the decrypted data
     };
 
+    /**
+     * Reports loading or writing the store file, called once per token
+     * with the number of processed tokens and the total number of tokens.
+     */
+    using ProgressCallback = std::function<void(std::size_t done, std::size_t total)>;
+
+    /**
+     * Output buffer for @see generateAll.
+     *
+     * Codes are stored in store order as fixed-width, null-terminated slots
+     * in one contiguous buffer. The buffer is owned by the caller and meant
+     * to be reused, regenerating codes for a store which didn't grow doesn't
+     * allocate anything.
+     */
+    struct GeneratedCodes
+    {
+        // longest token plus null terminator
+        static constexpr std::size_t SlotSize = 12;
+
+        std::vector<char> codes;
+        std::vector<OTPToken::Error> errors;
+
+        /**
+         * Returns the generated code of the token at the given index.
+         * The code is empty when the error at that index isn't `Valid`.
+         */
+        inline std::string_view code(std::size_t index) const
+        {
+            return std::string_view(&this->codes[index * SlotSize]);
+        }
+
+        /**
+         * Returns the number of generated slots.
+         */
+        inline std::size_t size() const
+        {
+            return this->errors.size();
+        }
+    };
+
     /**
      * Zero fills the given string.
      */
@@ -34,9 +117,7 @@ public:
      * Calling @see isValid always returns false. Explicitly check for
      * the `MemoryOnly` state instead when using this mode.
      */
-    TokenStore()
-    {
-    }
+    TokenStore();
 
     /**
      * Constructs a new token store using the given file path.
@@ -45,9 +126,21 @@ public:
      *
      * Note: missing parent directories are not being created
      *
+     * A journal left next to the file is replayed in any mode, see
+     * @see commit for how the mode affects writing.
+     *
+     * Every token record of the store file is sealed on its own, large
+     * stores are opened on several threads and the entire plaintext is
+     * never held in memory. The optional callback reports the progress of
+     * loading on the calling thread and is kept for @see commit.
+     *
+     * Loading, committing and @see prefetchIcons use up to the given number
+     * of threads, 0 uses one thread per core.
+     *
      * Use @see isValid to check if initialization worked.
      */
-    TokenStore(const std::string &filePath, const std::string &password);
+    TokenStore(const std::string &filePath, const std::string &password, StorageMode mode = Snapshot,
+               ProgressCallback progress = {}, unsigned threads = 0);
 
     /**
      * Destroys the token store.
@@ -85,23 +178,99 @@ public:
      * Exact duplicates won't be added. @see operator==
      * Invalid tokens can't be added to the token store.
      * Returns true when the token already exists in the store.
+     *
+     * Duplicates are found through an index of token fingerprints,
+     * so adding doesn't depend on the number of stored tokens.
      */
     bool addToken(const OTPToken &token);
 
+    /**
+     * Adds all given tokens to the token store, skipping invalid tokens
+     * and duplicates like @see addToken does. Storage and index are grown
+     * once for the entire batch. Returns the number of added tokens.
+     */
+    std::size_t addTokens(std::span<const OTPToken> tokens);
+
     /**
      * Removes an existing token from the token store.
      * If the token didn't previously existed nothing happens.
+     *
+     * The last token takes the place of the removed token, so removing
+     * doesn't shift the remaining tokens but changes their order.
+     * Handles of the remaining tokens stay valid.
      */
     void removeToken(const OTPToken &token);
 
     /**
-     * Clears the token store, removing all tokens from it.
+     * Removes the token referred to by the given handle.
+     * Returns false when the handle doesn't refer to a token.
+     */
+    bool removeToken(Handle handle);
+
+    /**
+     * Replaces the token referred to by the given handle, the handle
+     * stays valid. Use this to persist changed token properties like
+     * the counter of HOTP tokens.
+     * Returns false when the handle doesn't refer to a token, the new
+     * token is invalid or equal to another stored token.
+     */
+    bool updateToken(Handle handle, const OTPToken &token);
+
+    /**
+     * Returns the handle of the token at the given index, or
+     * `InvalidHandle` when the index is out of range.
+     */
+    Handle handle(std::size_t index) const;
+
+    /**
+     * Returns the handle of the stored token equal to the given token,
+     * or `InvalidHandle` when there is none.
+     */
+    Handle handleOf(const OTPToken &token) const;
+
+    /**
+     * Returns the token referred to by the given handle, or nullptr when
+     * it was removed. The pointer is invalidated by changes to the store,
+     * keep the handle instead.
      */
-    constexpr inline void clear()
+    const OTPToken *token(Handle handle) const;
+
+    /**
+     * Returns the current index of the token referred to by the given
+     * handle, or @see size when it was removed.
+     */
+    std::size_t indexOf(Handle handle) const;
+
+    /**
+     * Checks if an equal token exists in the token store. @see operator==
+     */
+    inline bool contains(const OTPToken &token) const
     {
-        this->_tokens.clear();
+        return this->find(token) != nullptr;
     }
 
+    /**
+     * Returns the stored token equal to the given token, or nullptr
+     * when there is none. The pointer is invalidated by changes to the store.
+     */
+    const OTPToken *find(const OTPToken &token) const;
+
+    /**
+     * Returns the handles of all tokens whose label matches the query.
+     * Labels are compared case-insensitive. @see LabelIndex
+     *
+     * Queries run on a label index maintained by the store, which is
+     * built on first use after loading. Prefix matches are ordered by
+     * label, the order of other matches is unspecified.
+     */
+    std::vector<Handle> findByLabel(std::string_view query, LabelMatch match = ExactLabel) const;
+
+    /**
+     * Clears the token store, removing all tokens from it.
+     * All handles are invalidated.
+     */
+    void clear();
+
     /**
      * Returns the number of elements in the token store.
      */
@@ -110,6 +279,30 @@ public:
         return this->_tokens.size();
     }
 
+    /**
+     * Generates the codes of all tokens in the store at the given time.
+     *
+     * Tokens are grouped by type, algorithm, period and digit length
+     * internally, so the counter is derived once per group and the
+     * cached key contexts are reused. Tokens sharing an algorithm are
+     * hashed side by side with the vectorized HMAC kernels when the
+     * CPU supports them. Results are written to the caller-owned output
+     * buffer in store order.
+     *
+     * The grouping is rebuilt lazily after the store changed, which
+     * is why this method isn't const.
+     */
+    void generateAll(const std::time_t &time, GeneratedCodes &output);
+
+    /**
+     * Generates the codes of all tokens in the store at the current time
+     * of the given clock. The clock is read only once for all tokens.
+     */
+    inline void generateAll(const Clock &clock, GeneratedCodes &output)
+    {
+        this->generateAll(clock.now(), output);
+    }
+
     /**
      * Checks if this token store is properly initialized.
      */
@@ -133,18 +326,254 @@ public:
      */
     const std::string_view error_code() const;
 
+    /**
+     * Returns the storage mode used by @see commit.
+     */
+    constexpr inline StorageMode mode() const
+    {
+        return this->_mode;
+    }
+
+    /**
+     * Returns the path of the journal belonging to the store file.
+     */
+    inline std::string journalPath() const
+    {
+        return this->_filePath + ".journal";
+    }
+
+    /**
+     * Loads the icons of all tokens.
+     *
+     * Icons are kept in a separate section of the store file and are only
+     * decrypted on first access. Call this before displaying all icons, so
+     * they don't load one by one while rendering. Large icon sections are
+     * decrypted on several threads.
+     */
+    void prefetchIcons() const;
+
+    /**
+     * Returns the icon of the token scaled to fit into a square of the
+     * given size, or nullptr when the token has no icon or it can't be
+     * scaled. @see Thumbnail
+     *
+     * Thumbnails are cached by icon and size, tokens sharing an icon share
+     * its thumbnails. New thumbnails are stored in the store file with the
+     * next commit, which takes a snapshot for them also in `Journaled`
+     * mode. Stored thumbnails are available without thumbnail support.
+     */
+    std::shared_ptr<const Thumbnail> thumbnail(Handle handle, std::uint16_t size) const;
+
     /**
      * Commit changes to the filesystem.
      * This method must be explicitly called or all unsaved changes are lost.
+     *
+     * In `Snapshot` mode the entire store is rewritten, tokens which didn't
+     * change since loading or the last snapshot keep their sealed record. In `Journaled` mode
+     * only the changes since the last commit are encrypted and appended to
+     * the journal, so the cost of a commit scales with the change instead of
+     * the store size. The journal is compacted into a new snapshot once it
+     * outgrows the store file.
      */
     ErrorCode commit();
 
+    /**
+     * Commits changes in the background, like @see commit does.
+     *
+     * The calling thread only takes the changes since the last commit,
+     * or a copy of the tokens when a snapshot is written. Serialization,
+     * encryption and I/O happen on a writer thread owned by the store.
+     * Commits submitted while a write is in progress are merged, so a
+     * burst of commits results in a single write. The returned future
+     * receives the result of the write containing this commit.
+     *
+     * The store itself must not be used concurrently, only the writing
+     * happens in the background. Pending commits are finished when the
+     * store is destroyed.
+     */
+    std::future<ErrorCode> commitAsync();
+
+    /**
+     * Blocks until all background commits are written.
+     */
+    void flush();
+
+    /**
+     * Sets the callback reporting the progress of writing the store file.
+     * Snapshots written by @see commitAsync report from the writer thread.
+     */
+    void setProgressCallback(ProgressCallback progress);
+
 private:
-    void deserializeData(const std::string &fileContents);
+    void loadSnapshot(std::string_view encrypted, std::uint8_t version);
+    void loadRecords(std::string_view section);
+    void deserializeData(std::istream &stream, std::size_t sizeHint, std::uint8_t version);
+    void replayJournal(std::string_view snapshot);
+    bool applyJournal(std::string_view changes);
+    ErrorCode appendJournal(const std::string &changes);
+    std::size_t lookup(const OTPToken &token) const;
+    bool insertToken(const OTPToken &token);
+    void eraseToken(std::size_t index);
+    void replaceToken(std::size_t index, const OTPToken &token);
+    void eraseIndexEntry(std::uint64_t fingerprint, std::size_t index);
+    void rebuildIndex() const;
+    void assignSlots();
+    std::uint32_t acquireSlot(std::size_t index);
+    void releaseSlot(std::uint32_t slot);
+    void updateGenerationGroups();
+
+    // tokens sharing the same generation parameters
+    struct GenerationGroup
+    {
+        OTPToken::Type type;
+        OTPToken::Algorithm algorithm;
+        std::uint32_t period;
+        std::uint8_t digits;
+        std::size_t begin;  // range in _groupOrder
+        std::size_t end;
+    };
+
+    class LoadedFile;
+
+    // thumbnails by icon digest and size
+    struct ThumbnailKey
+    {
+        OTPToken::IconDigest digest;
+        std::uint16_t size;
+
+        inline bool operator== (const ThumbnailKey &other) const
+        {
+            return this->size == other.size && this->digest == other.digest;
+        }
+    };
+
+    struct ThumbnailKeyHash
+    {
+        std::size_t operator() (const ThumbnailKey &key) const;
+    };
+
+    struct CachedThumbnail
+    {
+        std::shared_ptr<const Thumbnail> thumbnail;     // nullptr until loaded from the store file
+        bool stored = false;                            // sealed in the icon section of the store file
+        std::uint16_t width = 0;
+        std::uint16_t height = 0;
+        std::uint64_t offset = 0;                       // position of the sealed pixels in the icon section
+    };
+
+    using ThumbnailCache = std::unordered_map<ThumbnailKey, CachedThumbnail, ThumbnailKeyHash>;
+
+    bool acceptThumbnail(const CachedThumbnail &entry) const;
+
+    // sealed record of a token in the loaded or last written store file,
+    // snapshots copy it as long as the token is unchanged
+    struct StoredRecord
+    {
+        std::uint64_t offset = 0;   // position in the loaded store file
+        std::uint32_t size = 0;     // 0 when the token changed since then
+    };
+
+    // store file written by a snapshot, which replaces the loaded file once
+    // the store adopts it
+    //
+    // background snapshots keep the records their tokens had in the source,
+    // as the store's tokens may have changed since, they are matched by
+    // their position in the source instead of their index
+    struct WrittenSnapshot
+    {
+        std::shared_ptr<LoadedFile> source;     // file the snapshot copied sealed records from
+        std::shared_ptr<LoadedFile> file;       // nullptr when the written file can't be mapped
+        std::vector<StoredRecord> records;      // records of the snapshot tokens in the written file
+        std::shared_ptr<const std::vector<StoredRecord>> copied;   // nullptr for the store's own tokens
+        std::vector<std::pair<ThumbnailKey, CachedThumbnail>> thumbnails;
+    };
+
+    void adoptSnapshot(WrittenSnapshot &&snapshot);
+    void adoptWrittenSnapshot();
 
     std::string _filePath;
     std::string _password;
     std::vector<OTPToken> _tokens;
+    std::shared_ptr<LoadedFile> _loadedFile;    // store file the tokens were loaded from
+    StorageMode _mode = Snapshot;
+    ProgressCallback _progress;
+    unsigned _threads = 0;                      // 0 uses one thread per core
+
+    // changes since the last commit, recorded in journaled mode only
+    struct JournalEntry
+    {
+        std::uint8_t op;
+        std::uint32_t index;
+        OTPToken token;
+    };
+
+    // work of one or more merged commits
+    struct CommitJob
+    {
+        std::shared_ptr<const std::vector<OTPToken>> tokens;   // snapshot to write first, if any
+        std::shared_ptr<const std::vector<StoredRecord>> records;  // records of the snapshot tokens
+        std::shared_ptr<const ThumbnailCache> thumbnails;       // thumbnails stored with the snapshot
+        std::shared_ptr<LoadedFile> file;                       // file the records refer to
+        std::vector<JournalEntry> changes;                      // changes after the snapshot
+        std::vector<std::promise<ErrorCode>> results;
+    };
+
+    class CommitWriter;
+
+    ErrorCode writeCommit(const CommitJob &job);
+    ErrorCode writeChanges(const std::vector<JournalEntry> &changes, const std::vector<OTPToken> *tokens);
+    ErrorCode writeSnapshot(const std::vector<OTPToken> &tokens, const std::vector<StoredRecord> &records,
+                            const ThumbnailCache &thumbnails, const std::shared_ptr<LoadedFile> &source,
+                            WrittenSnapshot &written);
+    ErrorCode writeSnapshot();
+
+    std::vector<JournalEntry> _journal;
+    bool _journaling = false;
+    std::array<unsigned char, 32> _snapshotHash{};  // binds the journal to the store file
+    std::size_t _snapshotSize = 0;
+    std::size_t _journalSize = 0;                   // bytes of intact journal, 0 when there is none
+    std::uint64_t _journalSequence = 0;             // number of the next journal record
+    std::atomic<bool> _snapshotDue = false;         // the journal can't take the next commit
+
+    // the snapshot and journal state above is only touched by the writer while it is busy
+    std::unique_ptr<CommitWriter> _writer;
+
+    // last snapshot of the writer, adopted by the store's thread
+    std::mutex _writtenMutex;
+    std::unique_ptr<WrittenSnapshot> _written;
+
+    // scaled icons, new thumbnails are written with the next snapshot
+    mutable ThumbnailCache _thumbnails;
+    mutable bool _thumbnailsDirty = false;
+
+    // token indices by fingerprint, collisions are resolved with operator==,
+    // built on first use after loading so unlocking a store doesn't pay for it
+    mutable std::unordered_multimap<std::uint64_t, std::size_t> _index;
+    mutable bool _indexDirty = false;
+
+    // slot map backing the handles, a handle is the slot number in the lower
+    // and the slot generation in the upper 32 bits
+    struct Slot
+    {
+        std::uint32_t index;        // token index while in use, next free slot otherwise
+        std::uint32_t generation;   // changes whenever the slot is released, never 0
+    };
+
+    static constexpr std::uint32_t NoSlot = UINT32_MAX;
+
+    std::vector<Slot> _slots;
+    std::vector<std::uint32_t> _tokenSlots;     // slot of every token, parallel to _tokens
+    std::vector<StoredRecord> _tokenRecords;    // sealed record of every token, parallel to _tokens
+    std::uint32_t _freeSlots = NoSlot;          // head of the free slot list
+
+    // labels by slot, built on first use after loading
+    mutable LabelIndex _labels;
+    mutable bool _labelsDirty = false;
+
+    // token indices sorted by generation group
+    std::vector<std::size_t> _groupOrder;
+    std::vector<GenerationGroup> _groups;
+    bool _groupsDirty = true;
 
     ErrorCode _state = MemoryOnly;
 };
@@ -3,13 +3,15 @@
 #include "tokendelegate.hpp"
 
 #include "otptoken.hpp"
+#include "codeschedule.hpp"
 
 #include <QApplication>
 #include <QClipboard>
 
-ActionsDelegate::ActionsDelegate(const OTPToken *tokenObj, QWidget *parent)
+ActionsDelegate::ActionsDelegate(const TokenStore *store, TokenStore::Handle handle, QWidget *parent)
     : OTPBaseWidget(parent),
-      tokenObj(tokenObj)
+      store(store),
+      handle(handle)
 {
     this->_layout = std::make_shared<QHBoxLayout>();
     this->_layout->setSpacing(3);
@@ -54,6 +56,19 @@ void ActionsDelegate::visibilityChanged(int state)
 
 void ActionsDelegate::copyTokenToClipboard()
 {
+    const auto tokenObj = this->store->token(this->handle);
+    if (!tokenObj)
+    {
+        return;
+    }
+
     auto clipboard = QApplication::clipboard();
-    clipboard->setText(QString::fromStdString(tokenObj->generate()));
+    if (this->schedule)
+    {
+        clipboard->setText(QString::fromStdString(this->schedule->code(this->handle, Clock::system().now())));
+    }
+    else
+    {
+        clipboard->setText(QString::fromStdString(tokenObj->generate()));
+    }
 }
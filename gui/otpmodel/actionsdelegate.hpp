@@ -9,14 +9,25 @@
 
 #include <memory>
 
-class OTPToken;
+#include <tokenstore.hpp>
+
+class CodeSchedule;
 
 class ActionsDelegate : public OTPBaseWidget
 {
     Q_OBJECT
 
 public:
-    ActionsDelegate(const OTPToken *tokenObj, QWidget *parent = nullptr);
+    ActionsDelegate(const TokenStore *store, TokenStore::Handle handle, QWidget *parent = nullptr);
+
+    /**
+     * Reads copied tokens from the given schedule instead of
+     * generating them on the GUI thread.
+     */
+    inline void setCodeSchedule(CodeSchedule *schedule)
+    {
+        this->schedule = schedule;
+    }
 
     inline QCheckBox *visibilityCheckbox() const
     {
@@ -27,8 +38,12 @@ private:
     void visibilityChanged(int);
     void copyTokenToClipboard();
 
-    // pointer to the OTPToken instance
-    const OTPToken *tokenObj = nullptr;
+    // handle of the OTPToken instance, stays valid when the store changes
+    const TokenStore *store = nullptr;
+    TokenStore::Handle handle = TokenStore::InvalidHandle;
+
+    // optional schedule to read precomputed tokens from
+    CodeSchedule *schedule = nullptr;
 
     std::shared_ptr<QHBoxLayout> _layout;
     std::shared_ptr<QCheckBox> _visibilityCb;
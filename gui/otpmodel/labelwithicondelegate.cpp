@@ -43,6 +43,18 @@ LabelWithIconDelegate::LabelWithIconDelegate(const QString &label, const QByteAr
     this->setLayout(this->_layout.get());
 }
 
+LabelWithIconDelegate::LabelWithIconDelegate(const QString &label, const std::shared_ptr<const Thumbnail> &thumbnail, const QSize &iconSize, QWidget *parent)
+    : LabelWithIconDelegate(label, QByteArray(), iconSize, parent)
+{
+    if (thumbnail && !thumbnail->isEmpty())
+    {
+        // wraps the pixels without decoding or scaling, the pixmap holds a copy
+        const QImage icon(thumbnail->pixels().data(), thumbnail->width(), thumbnail->height(),
+                          thumbnail->width() * 4, QImage::Format_RGBA8888);
+        this->_iconWidget->setPixmap(QPixmap::fromImage(icon));
+    }
+}
+
 LabelWithIconDelegate::LabelWithIconDelegate(const QString &label, const QString &iconPath, const QSize &iconSize, QWidget *parent)
     : LabelWithIconDelegate(label, QByteArray(), iconSize, parent)
 {
@@ -60,7 +72,7 @@ LabelWithIconDelegate::LabelWithIconDelegate(const QString &label, const QString
     }
 }
 
-void LabelWithIconDelegate::setClickCallback(const std::function<void(const OTPToken*)> *click_callback)
+void LabelWithIconDelegate::setClickCallback(const std::function<void(TokenStore::Handle)> *click_callback)
 {
     this->click_callback = click_callback;
 }
@@ -74,7 +86,7 @@ void LabelWithIconDelegate::mousePressEvent(QMouseEvent *event)
 {
     if (this->click_callback)
     {
-        (*this->click_callback)(this->rowContainer.obj);
+        (*this->click_callback)(this->rowContainer.handle);
     }
 
     OTPBaseWidget::mousePressEvent(event);
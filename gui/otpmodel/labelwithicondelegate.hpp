@@ -3,6 +3,8 @@
 
 #include "otpbasewidget.hpp"
 
+#include <thumbnail.hpp>
+
 #include <QLayout>
 #include <QLabel>
 #include <QString>
@@ -23,13 +25,20 @@ public:
             const QSize &iconSize = QSize(),
             QWidget *parent = nullptr);
 
+    // the thumbnail is shown as it is, it must be scaled to the icon size already
+    LabelWithIconDelegate(
+            const QString &label,
+            const std::shared_ptr<const Thumbnail> &thumbnail,
+            const QSize &iconSize = QSize(),
+            QWidget *parent = nullptr);
+
     LabelWithIconDelegate(
             const QString &label,
             const QString &iconPath,
             const QSize &iconSize = QSize(),
             QWidget *parent = nullptr);
 
-    void setClickCallback(const std::function<void(const OTPToken*)> *click_callback);
+    void setClickCallback(const std::function<void(TokenStore::Handle)> *click_callback);
 
 protected:
     void resizeEvent(QResizeEvent *event);
@@ -42,7 +51,7 @@ private:
     QSize _iconSize;
     QImage _processedIcon;
 
-    const std::function<void(const OTPToken*)> *click_callback = nullptr;
+    const std::function<void(TokenStore::Handle)> *click_callback = nullptr;
 
     std::shared_ptr<QHBoxLayout> _layout;
     std::shared_ptr<QLabel> _labelWidget;
@@ -29,9 +29,9 @@ static int realHeaderColumn(int column, OTPTokenModel::ViewMode viewMode)
 
 } // anonymous namespace
 
-OTPTokenModel::OTPTokenModel(const std::vector<OTPToken> *tokens, ViewMode viewMode, QObject *parent)
+OTPTokenModel::OTPTokenModel(const TokenStore *store, ViewMode viewMode, QObject *parent)
     : QAbstractTableModel(parent),
-      tokens(tokens),
+      store(store),
       viewMode(viewMode)
 {
 }
@@ -44,13 +44,13 @@ void OTPTokenModel::refresh()
 
 int OTPTokenModel::rowCount(const QModelIndex &parent) const
 {
-    if (!tokens)
+    if (!store)
     {
         return 0;
     }
     else
     {
-        return static_cast<int>(tokens->size());
+        return static_cast<int>(store->size());
     }
 }
 
@@ -71,11 +71,13 @@ int OTPTokenModel::columnCount(const QModelIndex &parent) const
 
 QVariant OTPTokenModel::data(int row, int column, int role) const
 {
-    if (!tokens)
+    if (!store || row < 0 || row >= static_cast<int>(store->size()))
     {
         return {};
     }
 
+    const auto &token = (*store)[row];
+
     // return basic display data about the token
     if (role == Qt::DisplayRole)
     {
@@ -87,11 +89,11 @@ QVariant OTPTokenModel::data(int row, int column, int role) const
 
             // [Type]
             case ColType:
-                return QString::fromStdString(tokens->at(row).typeName());
+                return QString::fromStdString(token.typeName());
 
             // [Icon/Label]
             case ColLabel:
-                return QString::fromStdString(tokens->at(row).label());
+                return QString::fromStdString(token.label());
 
             // [Token]
             case ColToken:
@@ -99,23 +101,23 @@ QVariant OTPTokenModel::data(int row, int column, int role) const
 
             // [Secret]
             case ColSecret:
-                return QString::fromStdString(tokens->at(row).secret());
+                return QString::fromStdString(token.secret());
 
             // [Digits]
             case ColDigits:
-                return tokens->at(row).digits();
+                return token.digits();
 
             // [Period]
             case ColPeriod:
-                return tokens->at(row).period();
+                return token.period();
 
             // [Counter]
             case ColCounter:
-                return tokens->at(row).counter();
+                return token.counter();
 
             // [Algorithm]
             case ColAlgorithm:
-                return QString::fromStdString(tokens->at(row).algorithmName());
+                return QString::fromStdString(token.algorithmName());
 
             // [Delete]
             case ColDelete:
@@ -123,10 +125,10 @@ QVariant OTPTokenModel::data(int row, int column, int role) const
         }
     }
 
-    // return pointer address to the OTPToken instance
+    // return the stable handle of the OTPToken instance
     else if (role == Qt::UserRole)
     {
-        return QVariant::fromValue(reinterpret_cast<std::uintptr_t>(&tokens->at(row)));
+        return QVariant::fromValue(static_cast<quint64>(store->handle(row)));
     }
 
     return {};
@@ -4,8 +4,8 @@
 #include <QAbstractTableModel>
 
 #include <otptoken.hpp>
-
-#include <vector>
+#include <tokenstore.hpp>
+#include <codeschedule.hpp>
 
 class OTPTokenModel : public QAbstractTableModel
 {
@@ -18,7 +18,7 @@ public:
         EditMode,
     };
 
-    OTPTokenModel(const std::vector<OTPToken> *tokens, ViewMode = DisplayMode, QObject *parent = nullptr);
+    OTPTokenModel(const TokenStore *store, ViewMode = DisplayMode, QObject *parent = nullptr);
 
     enum {
         // Display Columns
@@ -43,6 +43,16 @@ public:
      */
     void refresh();
 
+    /**
+     * Sets the schedule the views read generated tokens from.
+     * Without a schedule tokens are generated on demand.
+     */
+    inline void setCodeSchedule(CodeSchedule *schedule)
+    {
+        this->schedule = schedule;
+        this->refresh();
+    }
+
     inline void setViewMode(ViewMode viewMode)
     {
         this->viewMode = viewMode;
@@ -69,8 +79,11 @@ public:
 private:
     friend class OTPTokenWidget;
 
-    // this model may not modify the token list
-    const std::vector<OTPToken> *tokens = nullptr;
+    // this model may not modify the token store, rows are handed out as token handles
+    const TokenStore *store = nullptr;
+
+    // optional precomputed tokens
+    CodeSchedule *schedule = nullptr;
 
     ViewMode viewMode = DisplayMode;
 };
@@ -3,11 +3,11 @@
 
 #include <QWidget>
 
-class OTPToken;
+#include <tokenstore.hpp>
 
 struct OTPTokenRowContainer
 {
-    const OTPToken *obj = nullptr;
+    TokenStore::Handle handle = TokenStore::InvalidHandle;
     QWidget *action = nullptr;
     QWidget *type = nullptr;
     QWidget *label = nullptr;
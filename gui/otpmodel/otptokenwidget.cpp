@@ -10,15 +10,29 @@
 #include <QEvent>
 #include <QClipboard>
 
-static const std::function<void(const OTPToken*)> copy_token_to_clipboard = [](const OTPToken *token){
-    auto clipboard = QApplication::clipboard();
-    clipboard->setText(QString::fromStdString(token->generate()));
-};
-
 OTPTokenWidget::OTPTokenWidget(OTPTokenModel *model, QWidget *parent)
     : QTableWidget(parent),
       model(model)
 {
+    // prefer precomputed tokens from the schedule of the model
+    this->copyTokenToClipboard = [this](TokenStore::Handle handle){
+        const auto token = this->model->store->token(handle);
+        if (!token)
+        {
+            return;
+        }
+
+        auto clipboard = QApplication::clipboard();
+        if (this->model->schedule)
+        {
+            clipboard->setText(QString::fromStdString(this->model->schedule->code(handle, Clock::system().now())));
+        }
+        else
+        {
+            clipboard->setText(QString::fromStdString(token->generate()));
+        }
+    };
+
     // hide vertical header for cosmetics, useless clutter
     // TODO: required for changing the order using drag and drop later unless I figure out something better
     this->verticalHeader()->setDisabled(true);
@@ -166,14 +180,16 @@ void OTPTokenWidget::setupDisplayMode()
     // create cell widgets
     for (auto i = 0; i < model->rowCount(); ++i)
     {
-        const OTPToken *token = reinterpret_cast<const OTPToken*>(model->data(i, 0, Qt::UserRole).value<std::uintptr_t>());
+        const auto handle = static_cast<TokenStore::Handle>(model->data(i, 0, Qt::UserRole).value<quint64>());
+        const OTPToken *token = model->store->token(handle);
 
         OTPTokenRowContainer rowContainer;
-        rowContainer.obj = token;
+        rowContainer.handle = handle;
 
         // token actions
-        this->setCellWidget(i, OTPTokenModel::ColActions,
-                            new ActionsDelegate(token, this));
+        auto actions = new ActionsDelegate(model->store, handle, this);
+        actions->setCodeSchedule(model->schedule);
+        this->setCellWidget(i, OTPTokenModel::ColActions, actions);
 
         // token display type
         QString typeIcon;
@@ -188,18 +204,28 @@ void OTPTokenWidget::setupDisplayMode()
         this->cellWidget(i, OTPTokenModel::ColType)->layout()->setSpacing(8);
         this->cellWidget(i, OTPTokenModel::ColType)->layout()->setContentsMargins(8, 0, 8, 0);
 
-        // token label and icon
-        const QByteArray icon(token->icon().data(), token->icon().size());
-        this->setCellWidget(i, OTPTokenModel::ColLabel,
-                            new LabelWithIconDelegate(model->data(i, OTPTokenModel::ColLabel).toString(), icon, QSize(iconSize, iconSize), this));
+        // token label and icon, scaled icons are cached by the store
+        const auto thumbnail = model->store->thumbnail(handle, static_cast<std::uint16_t>(iconSize));
+        if (thumbnail)
+        {
+            this->setCellWidget(i, OTPTokenModel::ColLabel,
+                                new LabelWithIconDelegate(model->data(i, OTPTokenModel::ColLabel).toString(), thumbnail, QSize(iconSize, iconSize), this));
+        }
+        else
+        {
+            const QByteArray icon(token->icon().data(), token->icon().size());
+            this->setCellWidget(i, OTPTokenModel::ColLabel,
+                                new LabelWithIconDelegate(model->data(i, OTPTokenModel::ColLabel).toString(), icon, QSize(iconSize, iconSize), this));
+        }
 
         // generated token
-        this->setCellWidget(i, OTPTokenModel::ColToken,
-                            new TokenDelegate(token, this));
+        auto generatedToken = new TokenDelegate(model->store, handle, this);
+        generatedToken->setCodeSchedule(model->schedule);
+        this->setCellWidget(i, OTPTokenModel::ColToken, generatedToken);
 
         if (this->touchScreenMode)
         {
-            qobject_cast<LabelWithIconDelegate*>(this->cellWidget(i, OTPTokenModel::ColLabel))->setClickCallback(&copy_token_to_clipboard);
+            qobject_cast<LabelWithIconDelegate*>(this->cellWidget(i, OTPTokenModel::ColLabel))->setClickCallback(&this->copyTokenToClipboard);
             qobject_cast<TokenDelegate*>(this->cellWidget(i, OTPTokenModel::ColToken))->setGeneratedTokenVisibilityOnClick(true);
         }
 
@@ -3,6 +3,8 @@
 
 #include <QTableWidget>
 
+#include <functional>
+
 #include "otptokenmodel.hpp"
 
 class OTPTokenWidget : public QTableWidget
@@ -49,6 +51,9 @@ private:
     void makeAllRowsVisible();
     void updateHeaderLabels();
 
+    // click callback of the label delegates in touch screen mode
+    std::function<void(TokenStore::Handle)> copyTokenToClipboard;
+
     QString filterPattern;
     RowHeight rowHeight = RowHeight::Desktop;
     bool touchScreenMode = false;
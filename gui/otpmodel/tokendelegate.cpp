@@ -2,13 +2,17 @@
 #include "actionsdelegate.hpp"
 
 #include <otptoken.hpp>
+#include <codeschedule.hpp>
 
 #include <QMouseEvent>
 
-TokenDelegate::TokenDelegate(const OTPToken *tokenObj, QWidget *parent)
+TokenDelegate::TokenDelegate(const TokenStore *store, TokenStore::Handle handle, QWidget *parent)
     : OTPBaseWidget(parent),
-      tokenObj(tokenObj)
+      store(store),
+      handle(handle)
 {
+    const auto tokenObj = this->token();
+
     this->_layout = std::make_shared<QVBoxLayout>();
     this->_layout->setSpacing(0);
     this->_layout->setContentsMargins(0, 0, 0, 0);
@@ -126,6 +130,17 @@ void TokenDelegate::setGeneratedTokenVisibilityOnClick(bool enabled)
     }
 }
 
+void TokenDelegate::setCodeSchedule(CodeSchedule *schedule)
+{
+    this->schedule = schedule;
+
+    const auto tokenObj = this->token();
+    if (tokenObj && tokenObj->type() != OTPToken::HOTP)
+    {
+        this->generateToken();
+    }
+}
+
 void TokenDelegate::mousePressEvent(QMouseEvent *event)
 {
     if (this->tokenVisibilityOnClick)
@@ -152,14 +167,33 @@ void TokenDelegate::mouseReleaseEvent(QMouseEvent *event)
 
 void TokenDelegate::restartTimer()
 {
+    const auto tokenObj = this->token();
+    if (!tokenObj)
+    {
+        return;
+    }
+
     this->generateToken();
-    this->tokenTimer->setInterval(tokenObj->remainingTokenValidity() * 1000);
+    // fire 1 second past the window boundary, the clock only has a resolution of seconds
+    this->tokenTimer->setInterval((tokenObj->remainingTokenValidity() + 1) * 1000);
     this->tokenTimer->start();
 }
 
 void TokenDelegate::generateToken()
 {
-    this->_generatedToken->setText(QString::fromStdString(tokenObj->generate()));
+    const auto tokenObj = this->token();
+    if (!tokenObj)
+    {
+        this->_generatedToken->clear();
+    }
+    else if (this->schedule)
+    {
+        this->_generatedToken->setText(QString::fromStdString(this->schedule->code(this->handle, Clock::system().now())));
+    }
+    else
+    {
+        this->_generatedToken->setText(QString::fromStdString(tokenObj->generate()));
+    }
 }
 
 void TokenDelegate::updateProgressBar()
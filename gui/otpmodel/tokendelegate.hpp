@@ -11,14 +11,16 @@
 
 #include <string>
 
-class OTPToken;
+#include <tokenstore.hpp>
+
+class CodeSchedule;
 
 class TokenDelegate : public OTPBaseWidget
 {
     Q_OBJECT
 
 public:
-    TokenDelegate(const OTPToken *tokenObj, QWidget *parent = nullptr);
+    TokenDelegate(const TokenStore *store, TokenStore::Handle handle, QWidget *parent = nullptr);
     ~TokenDelegate();
 
     /**
@@ -28,6 +30,12 @@ public:
 
     void setGeneratedTokenVisibilityOnClick(bool);
 
+    /**
+     * Reads generated tokens from the given schedule instead of
+     * generating them on the GUI thread.
+     */
+    void setCodeSchedule(CodeSchedule *schedule);
+
 protected:
     void mousePressEvent(QMouseEvent *event);
     void mouseReleaseEvent(QMouseEvent *event);
@@ -39,8 +47,19 @@ private:
 
     void updateProgressBarColor(const QString &color);
 
-    // pointer to the OTPToken instance
-    const OTPToken *tokenObj = nullptr;
+    // resolves the handle, nullptr when the token was removed from the store
+    inline const OTPToken *token() const
+    {
+        return this->store->token(this->handle);
+    }
+
+    // the token is only referenced by its handle so the store can change
+    // without invalidating this delegate
+    const TokenStore *store = nullptr;
+    TokenStore::Handle handle = TokenStore::InvalidHandle;
+
+    // optional schedule to read precomputed tokens from
+    CodeSchedule *schedule = nullptr;
 
     bool tokenVisibilityOnClick = false;
     Qt::FocusPolicy lineEditFocusPolicy;
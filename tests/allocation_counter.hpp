@@ -0,0 +1,63 @@
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+/**
+ * Counts heap allocations of the test executable by replacing
+ * the global operator new. Must only be included once.
+ *
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace allocation_counter
+{
+    inline std::atomic<std::size_t> &counter()
+    {
+        static std::atomic<std::size_t> allocations = 0;
+        return allocations;
+    }
+
+    inline std::size_t count()
+    {
+        return counter().load(std::memory_order_relaxed);
+    }
+}
+
+void *operator new(std::size_t size)
+{
+    allocation_counter::counter().fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+#endif // ALLOCATION_COUNTER_HPP
@@ -0,0 +1,82 @@
+#include <bandit/bandit.h>
+#include <benchmark.hpp>
+
+#include <clock.hpp>
+#include <otptoken.hpp>
+#include <tokenstore.hpp>
+
+using namespace snowhouse;
+using namespace bandit;
+
+go_bandit([]{
+    describe("clock", []{
+
+        benchmark_it("[fake clock]", [&]{
+            FakeClock clock(1536573862);
+            AssertThat(clock.now(), Equals(1536573862));
+
+            clock.advance(8);
+            AssertThat(clock.now(), Equals(1536573870));
+
+            clock.setSkew(-10);
+            AssertThat(clock.now(), Equals(1536573860));
+
+            clock.set(59);
+            clock.setSkew(0);
+            AssertThat(clock.now(), Equals(59));
+        });
+
+        benchmark_it("[cached clock]", [&]{
+            FakeClock source(1000);
+            CachedClock clock(source);
+            AssertThat(clock.now(), Equals(1000));
+
+            // only moves on tick
+            source.advance(5);
+            AssertThat(clock.now(), Equals(1000));
+            AssertThat(clock.tick(), Equals(1005));
+            AssertThat(clock.now(), Equals(1005));
+
+            clock.setSkew(2);
+            AssertThat(clock.now(), Equals(1007));
+        });
+
+        benchmark_it("[system clock]", [&]{
+            const auto now = std::time(nullptr);
+            AssertThat(Clock::system().now(), IsGreaterThanOrEqualTo(now - 1));
+            AssertThat(Clock::system().now(), IsLessThanOrEqualTo(now + 1));
+        });
+
+        // seconds into the period, not seconds into the minute
+        benchmark_it("[remaining validity]", [&]{
+            FakeClock clock(1200);
+            AssertThat(clock.remainingValidity(30), Equals(30));
+            AssertThat(clock.remainingValidity(45), Equals(15));
+            AssertThat(clock.remainingValidity(7), Equals(4));
+            AssertThat(clock.remainingValidity(0), Equals(0));
+
+            clock.advance(29);
+            AssertThat(clock.remainingValidity(30), Equals(1));
+
+            OTPToken totp("", "XYZA123456KDDK83D", 8, 45, 0, OTPToken::TOTP, OTPToken::SHA1);
+            AssertThat(totp.remainingTokenValidity(1200), Equals(15));
+            AssertThat(totp.remainingTokenValidity(1214), Equals(1));
+            AssertThat(totp.remainingTokenValidity(1215), Equals(45));
+
+            OTPToken hotp("", "XYZA123456KDDK83D", 6, 0, 0, OTPToken::HOTP, OTPToken::SHA1);
+            AssertThat(hotp.remainingTokenValidity(1200), Equals(0));
+        });
+
+        benchmark_it("[generate all]", [&]{
+            TokenStore tks;
+            tks.addToken(OTPToken("totp", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            tks.addToken(OTPToken("steam", "ABC30WAY33X57CCBU3EAXGDDMX35S39M", OTPToken::Steam));
+
+            FakeClock clock(1536573862);
+            TokenStore::GeneratedCodes codes;
+            tks.generateAll(clock, codes);
+            AssertThat(codes.code(0), Equals(std::string_view("122810")));
+            AssertThat(codes.code(1), Equals(std::string_view("GQTTM")));
+        });
+    });
+});
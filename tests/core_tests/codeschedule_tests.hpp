@@ -0,0 +1,117 @@
+#include <bandit/bandit.h>
+#include <benchmark.hpp>
+
+#include <codeschedule.hpp>
+#include <tokenstore.hpp>
+
+using namespace snowhouse;
+using namespace bandit;
+
+go_bandit([]{
+    describe("codeschedule", []{
+        TokenStore tks;
+        tks.addToken(OTPToken("totp", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+        tks.addToken(OTPToken("hotp", "XYZA123456KDDK83D", 6, 0, 12, OTPToken::HOTP, OTPToken::SHA1));
+        tks.addToken(OTPToken("steam", "ABC30WAY33X57CCBU3EAXGDDMX35S39M", OTPToken::Steam));
+        tks.addToken(OTPToken("authy", "XYZA123456KDDK83D28273", 7, 10, 0, OTPToken::TOTP, OTPToken::SHA1));
+
+        benchmark_it("[refill]", [&]{
+            CodeSchedule schedule(tks, 2);
+            AssertThat(schedule.size(), Equals(3)); // HOTP tokens aren't scheduled
+
+            schedule.refill(1536573862);
+            for (auto i = 0U; i < tks.size(); ++i)
+            {
+                const auto *token = &tks[i];
+                const auto handle = tks.handle(i);
+                const bool scheduled = token->type() != OTPToken::HOTP;
+                AssertThat(schedule.isScheduled(handle, 1536573862), Equals(scheduled));
+                AssertThat(schedule.isScheduled(handle, 1536573862 + 2 * token->period()), Equals(scheduled));
+                AssertThat(schedule.isScheduled(handle, 1536573862 + 3 * token->period()), Equals(false));
+
+                // upcoming windows must match the direct computation
+                for (auto window = 0U; window <= 2; ++window)
+                {
+                    const auto time = 1536573862 + window * token->period();
+                    AssertThat(schedule.code(handle, time), Equals(token->generate(time)));
+                }
+            }
+
+            AssertThat(schedule.code(tks.handle(0), 1536573862), Equals(std::string("122810")));
+            AssertThat(schedule.code(tks.handle(1), 1536573862), Equals(std::string("534003")));
+            AssertThat(schedule.code(tks.handle(2), 1536573862), Equals(std::string("GQTTM")));
+            AssertThat(schedule.code(tks.handle(3), 1536573862), Equals(std::string("8578249")));
+        });
+
+        benchmark_it("[evict]", [&]{
+            CodeSchedule schedule(tks, 1);
+            schedule.refill(1536573862);
+
+            // moving forward replaces the expired windows
+            schedule.refill(1536573862 + 30);
+            AssertThat(schedule.isScheduled(tks.handle(0), 1536573862), Equals(false));
+            AssertThat(schedule.isScheduled(tks.handle(0), 1536573862 + 30), Equals(true));
+            AssertThat(schedule.isScheduled(tks.handle(0), 1536573862 + 60), Equals(true));
+
+            // windows out of range are computed on demand
+            AssertThat(schedule.code(tks.handle(0), 1536573862), Equals(std::string("122810")));
+        });
+
+        benchmark_it("[changed tokens]", [&]{
+            const OTPToken first("first", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1);
+            const OTPToken second("second", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+
+            TokenStore store;
+            store.addToken(first);
+            store.addToken(second);
+
+            CodeSchedule schedule(store);
+            schedule.refill(1536573862);
+            const auto removed = store.handle(0);
+            const auto moved = store.handle(1);
+
+            // the second token moves into the place of the removed one
+            AssertThat(store.removeToken(removed), Equals(true));
+            AssertThat(schedule.isScheduled(removed, 1536573862), Equals(false));
+            AssertThat(schedule.code(removed, 1536573862), Equals(std::string()));
+            AssertThat(schedule.isScheduled(moved, 1536573862), Equals(true));
+            AssertThat(schedule.code(moved, 1536573862), Equals(second.generate(1536573862)));
+
+            // an edited token gets a new snapshot instead of the stale codes
+            const OTPToken edited("second", "XYZA123456KDDK83D28273", 7, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+            AssertThat(store.updateToken(moved, edited), Equals(true));
+            AssertThat(schedule.isScheduled(moved, 1536573862), Equals(false));
+            AssertThat(schedule.code(moved, 1536573862), Equals(edited.generate(1536573862)));
+            AssertThat(schedule.code(moved, 1536573862) != second.generate(1536573862), Equals(true));
+            AssertThat(schedule.isScheduled(moved, 1536573862), Equals(true));
+
+            // a token added into the freed slot isn't mistaken for the removed one
+            const OTPToken added("added", "ABC30WAY33X57CCBU3EAXGDDMX35S39M", 7, 30, 0, OTPToken::TOTP, OTPToken::SHA256);
+            store.addToken(added);
+            AssertThat(store.handle(1) != removed, Equals(true));
+            AssertThat(schedule.isScheduled(store.handle(1), 1536573862), Equals(false));
+            AssertThat(schedule.code(store.handle(1), 1536573862), Equals(added.generate(1536573862)));
+        });
+
+        benchmark_it("[background refill]", [&]{
+            FakeClock clock(1536573862);
+            CodeSchedule schedule(tks, 1);
+            schedule.setClock(clock);
+
+            // the current windows are computed even when stopped right away
+            schedule.start();
+            schedule.stop();
+            AssertThat(schedule.isScheduled(tks.handle(0), 1536573862), Equals(true));
+            AssertThat(schedule.isScheduled(tks.handle(0), 1536573862 + 30), Equals(true));
+            AssertThat(schedule.isScheduled(tks.handle(0), 1536573862 + 60), Equals(false));
+
+            // the refill follows the clock
+            clock.advance(60);
+            schedule.start();
+            schedule.stop();
+            AssertThat(schedule.isScheduled(tks.handle(0), 1536573862), Equals(false));
+            AssertThat(schedule.isScheduled(tks.handle(0), 1536573862 + 60), Equals(true));
+            AssertThat(schedule.code(tks.handle(0), 1536573862 + 60), Equals(tks[0].generate(1536573862 + 60)));
+        });
+    });
+});
@@ -0,0 +1,83 @@
+#include <bandit/bandit.h>
+#include <benchmark.hpp>
+
+#include <labelindex.hpp>
+
+using namespace snowhouse;
+using namespace bandit;
+
+go_bandit([]{
+    describe("labelindex", []{
+        benchmark_it("[fold]", [&]{
+            AssertThat(LabelIndex::fold("GitHub: Alice@Example.COM"), Equals("github: alice@example.com"));
+            AssertThat(LabelIndex::fold("\xc3\x84pfel"), Equals("\xc3\x84pfel"));
+        });
+
+        benchmark_it("[exact and prefix]", [&]{
+            LabelIndex index;
+            index.insert(0, "GitHub");
+            index.insert(1, "GitLab");
+            index.insert(2, "github");
+            index.insert(3, "Google");
+
+            AssertThat(index.size(), Equals(4));
+            AssertThat(index.exact("GITHUB"), Equals(std::vector<std::uint32_t>{0, 2}));
+            AssertThat(index.exact("git"), Equals(std::vector<std::uint32_t>{}));
+            AssertThat(index.prefix("Git"), Equals(std::vector<std::uint32_t>{0, 2, 1}));
+            AssertThat(index.prefix("go"), Equals(std::vector<std::uint32_t>{3}));
+            AssertThat(index.prefix("").size(), Equals(4));
+
+            index.erase(0);
+            index.erase(0);
+            AssertThat(index.size(), Equals(3));
+            AssertThat(index.exact("github"), Equals(std::vector<std::uint32_t>{2}));
+
+            // inserting an existing id replaces its label
+            index.insert(2, "Bitbucket");
+            AssertThat(index.exact("github"), Equals(std::vector<std::uint32_t>{}));
+            AssertThat(index.prefix("bit"), Equals(std::vector<std::uint32_t>{2}));
+        });
+
+        benchmark_it("[substring]", [&]{
+            LabelIndex index;
+            index.insert(0, "alice@example.com");
+            index.insert(1, "Bob (Example)");
+            index.insert(2, "aaaa");
+            index.insert(5, "Steam");
+
+            AssertThat(index.substring("EXAMPLE"), Equals(std::vector<std::uint32_t>{0, 1}));
+            AssertThat(index.substring("x"), Equals(std::vector<std::uint32_t>{0, 1}));
+            AssertThat(index.substring("aa"), Equals(std::vector<std::uint32_t>{2}));
+            AssertThat(index.substring("aaaaa"), Equals(std::vector<std::uint32_t>{}));
+            AssertThat(index.substring("ea"), Equals(std::vector<std::uint32_t>{5}));
+            AssertThat(index.substring("zzz"), Equals(std::vector<std::uint32_t>{}));
+            AssertThat(index.substring(""), Equals(std::vector<std::uint32_t>{0, 1, 2, 5}));
+
+            // stale posting list entries of reused ids are never reported
+            index.erase(0);
+            index.insert(0, "Example Corp");
+            AssertThat(index.substring("example"), Equals(std::vector<std::uint32_t>{0, 1}));
+            AssertThat(index.substring("alice"), Equals(std::vector<std::uint32_t>{}));
+
+            index.clear();
+            AssertThat(index.size(), Equals(0));
+            AssertThat(index.substring("example"), Equals(std::vector<std::uint32_t>{}));
+        });
+
+        benchmark_it("[substring after compaction]", [&]{
+            LabelIndex index;
+            for (std::uint32_t i = 0; i < 10000; ++i)
+            {
+                index.insert(i, "token number " + std::to_string(i));
+            }
+            for (std::uint32_t i = 0; i < 10000; i += 2)
+            {
+                index.erase(i);
+            }
+
+            AssertThat(index.size(), Equals(5000));
+            AssertThat(index.substring("number 99").size(), Equals(56));
+            AssertThat(index.substring("R 123"), Equals(std::vector<std::uint32_t>{123, 1231, 1233, 1235, 1237, 1239}));
+        });
+    });
+});
@@ -1,5 +1,6 @@
 #include <bandit/bandit.h>
 #include <benchmark.hpp>
+#include <allocation_counter.hpp>
 
 #include <otptoken.hpp>
 
@@ -16,6 +17,55 @@ go_bandit([]{
             AssertThat(token, Equals(other));
         });
 
+        benchmark_it("[fingerprint]", [&]{
+            OTPToken other("label", "secret", 7, 50, 0, OTPToken::TOTP, OTPToken::SHA1);
+            AssertThat(other.fingerprint(), Equals(token.fingerprint()));
+
+            other.setLabel("other");
+            AssertThat(other.fingerprint() != token.fingerprint(), Equals(true));
+            other.setLabel("label");
+            AssertThat(other.fingerprint(), Equals(token.fingerprint()));
+
+            other.setIcon({'\x89', 'P', 'N', 'G'});
+            const auto withIcon = other.fingerprint();
+            AssertThat(withIcon != token.fingerprint(), Equals(true));
+
+            // copies keep the cached fingerprint, deserialized tokens compute the same
+            const OTPToken copy(other);
+            AssertThat(copy.fingerprint(), Equals(withIcon));
+            AssertThat(OTPToken(other.serialize()).fingerprint(), Equals(withIcon));
+
+            other.setCounter(1);
+            AssertThat(other.fingerprint() != withIcon, Equals(true));
+        });
+
+        benchmark_it("[icon pool]", [&]{
+            OTPToken first("first", "secret");
+            OTPToken second("second", "secret");
+            AssertThat(first.iconId(), Equals(0));
+
+            // equal icons share one pool entry
+            first.setIcon({'\x89', 'P', 'N', 'G', '1'});
+            second.setIcon({'\x89', 'P', 'N', 'G', '1'});
+            AssertThat(first.iconId() != 0, Equals(true));
+            AssertThat(second.iconId(), Equals(first.iconId()));
+            AssertThat(&second.icon(), Equals(&first.icon()));
+
+            second.setIcon({'\x89', 'P', 'N', 'G', '2'});
+            AssertThat(second.iconId() != first.iconId(), Equals(true));
+            AssertThat(second.icon(), Equals(OTPToken::Data{'\x89', 'P', 'N', 'G', '2'}));
+
+            // the id decides equality
+            second.setLabel("first");
+            AssertThat(second == first, Equals(false));
+            second.setIcon(first.icon());
+            AssertThat(second == first, Equals(true));
+
+            second.setIcon({});
+            AssertThat(second.iconId(), Equals(0));
+            AssertThat(second.icon().empty(), Equals(true));
+        });
+
         benchmark_it("[serialize]", [&]{
             serialized = token.serialize();
 
@@ -77,6 +127,208 @@ go_bandit([]{
             AssertThat(tkn.generate(1536573862), Equals(std::string("GQTTM")));
         });
 
+        // RFC 6238 Appendix B test vectors
+        benchmark_it("[compute TOTP RFC 6238]", [&]{
+            const std::string sha1 = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ";
+            const std::string sha256 = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZA";
+            const std::string sha512 = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ"
+                                       "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNA=";
+
+            OTPToken tkn1("", sha1, 8, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+            OTPToken tkn256("", sha256, 8, 30, 0, OTPToken::TOTP, OTPToken::SHA256);
+            OTPToken tkn512("", sha512, 8, 30, 0, OTPToken::TOTP, OTPToken::SHA512);
+
+            AssertThat(tkn1.generate(59), Equals(std::string("94287082")));
+            AssertThat(tkn256.generate(59), Equals(std::string("46119246")));
+            AssertThat(tkn512.generate(59), Equals(std::string("90693936")));
+            AssertThat(tkn1.generate(1111111109), Equals(std::string("07081804")));
+            AssertThat(tkn256.generate(1111111109), Equals(std::string("68084774")));
+            AssertThat(tkn512.generate(1111111109), Equals(std::string("25091201")));
+            AssertThat(tkn1.generate(20000000000), Equals(std::string("65353130")));
+            AssertThat(tkn256.generate(20000000000), Equals(std::string("77737706")));
+            AssertThat(tkn512.generate(20000000000), Equals(std::string("47863826")));
+        });
+
+        // secrets are normalized while decoding: whitespace, padding and case are ignored
+        benchmark_it("[secret normalization]", [&]{
+            const OTPToken tokens[] = {
+                OTPToken("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA1),
+                OTPToken("", "gezdgnbvgy3tqojqgezdgnbvgy3tqojq", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA1),
+                OTPToken("", "GEZD GNBV GY3T QOJQ GEZD GNBV GY3T QOJQ", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA1),
+                OTPToken("", "gezd GNBV gy3t QOJQ\tgezd-GNBV gy3t QOJQ====", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA1),
+            };
+
+            for (auto&& tkn : tokens)
+            {
+                AssertThat(tkn.generate(59), Equals(std::string("94287082")));
+            }
+        });
+
+        // every digit count is a suffix of the 10 digit code, for every algorithm
+        benchmark_it("[compute all digit counts]", [&]{
+            const std::pair<OTPToken::Algorithm, std::string> algorithms[] = {
+                {OTPToken::SHA1, "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ"},
+                {OTPToken::SHA256, "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZA"},
+                {OTPToken::SHA512, "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ"
+                                   "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNA="},
+            };
+
+            for (auto&& [algorithm, secret] : algorithms)
+            {
+                OTPToken tkn("", secret, 10, 30, 0, OTPToken::TOTP, algorithm);
+                const auto full = tkn.generate(1111111109);
+                AssertThat(full.size(), Equals(10));
+
+                for (auto digits = 1; digits < 10; ++digits)
+                {
+                    tkn.setDigits(digits);
+                    AssertThat(tkn.generate(1111111109), Equals(full.substr(10 - digits)));
+                }
+            }
+        });
+
+        // specialized generators of the most common token configurations
+        const auto benchmark_generator = [](OTPToken::Algorithm algorithm, std::uint8_t digits) {
+            OTPToken tkn("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", digits, 30, 0, OTPToken::TOTP, algorithm);
+            char buffer[OTPToken::MaxTokenLength + 1];
+            std::size_t length = 0;
+            for (auto i = 0; i < 10000; ++i)
+            {
+                length += tkn.generate(i * 30, buffer);
+            }
+            AssertThat(length, Equals(10000U * digits));
+        };
+
+        benchmark_it("[generate SHA1/6]", [&]{ benchmark_generator(OTPToken::SHA1, 6); });
+        benchmark_it("[generate SHA1/8]", [&]{ benchmark_generator(OTPToken::SHA1, 8); });
+        benchmark_it("[generate SHA256/6]", [&]{ benchmark_generator(OTPToken::SHA256, 6); });
+        benchmark_it("[generate SHA256/8]", [&]{ benchmark_generator(OTPToken::SHA256, 8); });
+        benchmark_it("[generate SHA512/8]", [&]{ benchmark_generator(OTPToken::SHA512, 8); });
+
+        // the cached key context must follow secret and algorithm changes
+        benchmark_it("[key context]", [&]{
+            OTPToken tkn("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+            AssertThat(tkn.keyContext().error, Equals(OTPToken::Valid));
+            AssertThat(tkn.generate(59), Equals(std::string("94287082")));
+
+            tkn.setSecret("GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZA");
+            tkn.setAlgorithm(OTPToken::SHA256);
+            AssertThat(tkn.generate(59), Equals(std::string("46119246")));
+
+            const OTPToken copy = tkn;
+            AssertThat(copy.generate(59), Equals(std::string("46119246")));
+
+            tkn.setSecret("_");
+            AssertThat(tkn.keyContext().error, Equals(OTPToken::InvalidBase32Input));
+            AssertThat(tkn.generate(59), Equals(std::string()));
+        });
+
+        benchmark_it("[invalid algorithm]", [&]{
+            OTPToken tkn("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 8, 30, 0, OTPToken::TOTP, static_cast<OTPToken::Algorithm>(0));
+            AssertThat(tkn.keyContext().error, Equals(OTPToken::InvalidAlgorithm));
+            AssertThat(tkn.generate(59), Equals(std::string()));
+
+            OTPToken::Error error = OTPToken::Valid;
+            char buffer[OTPToken::MaxTokenLength + 1];
+            AssertThat(tkn.generate(59, buffer, &error), Equals(0));
+            AssertThat(error, Equals(OTPToken::InvalidAlgorithm));
+            AssertThat(tkn.verify("94287082", 59).has_value(), Equals(false));
+        });
+
+        // tokens without a specialized generator report it in their key context
+        benchmark_it("[invalid digits]", [&]{
+            OTPToken tkn("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 11, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+            AssertThat(tkn.keyContext().error, Equals(OTPToken::InvalidDigits));
+            AssertThat(tkn.generate(59), Equals(std::string()));
+            AssertThat(tkn.verify("94287082", 59).has_value(), Equals(false));
+
+            tkn.setDigits(8);
+            AssertThat(tkn.keyContext().error, Equals(OTPToken::Valid));
+            AssertThat(tkn.generate(59), Equals(std::string("94287082")));
+        });
+
+        benchmark_it("[compute into buffer]", [&]{
+            OTPToken tkn("", "XYZA123456KDDK83D28273", 7, 10, 0, OTPToken::TOTP, OTPToken::SHA1);
+            char buffer[OTPToken::MaxTokenLength + 1];
+            AssertThat(tkn.generate(1536573862, buffer), Equals(7));
+            AssertThat(std::string_view(buffer), Equals(std::string_view("8578249")));
+
+            OTPToken::Error error = OTPToken::Valid;
+            char small[7];
+            AssertThat(tkn.generate(1536573862, small, &error), Equals(0));
+            AssertThat(error, Equals(OTPToken::InsufficientBuffer));
+        });
+
+        // once the key context is built, generating into a buffer must never touch the heap
+        benchmark_it("[compute without allocations]", [&]{
+            const OTPToken tokens[] = {
+                OTPToken("", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1),
+                OTPToken("", "XYZA123456KDDK83D", 6, 0, 12, OTPToken::HOTP, OTPToken::SHA1),
+                OTPToken("", "ABC30WAY33X57CCBU3EAXGDDMX35S39M", OTPToken::Steam),
+                OTPToken("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZA", 10, 30, 0, OTPToken::TOTP, OTPToken::SHA512),
+            };
+
+            char buffer[OTPToken::MaxTokenLength + 1];
+            for (auto&& token : tokens)
+            {
+                token.keyContext();
+            }
+
+            const auto before = allocation_counter::count();
+            std::size_t length = 0;
+            for (auto&& token : tokens)
+            {
+                length += token.generate(1536573862, buffer);
+            }
+            const auto allocations = allocation_counter::count() - before;
+
+            AssertThat(allocations, Equals(0));
+            AssertThat(length, Equals(6 + 6 + 5 + 10));
+        });
+
+        benchmark_it("[verify]", [&]{
+            OTPToken tkn("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+
+            // 07081804 is the code of the window containing 1111111109
+            AssertThat(tkn.verify("07081804", 1111111109).value_or(-100), Equals(0));
+            AssertThat(tkn.verify("07081804", 1111111109 + 30).value_or(-100), Equals(-1));
+            AssertThat(tkn.verify("07081804", 1111111109 - 30).value_or(-100), Equals(1));
+            AssertThat(tkn.verify("07081804", 1111111109 + 60).has_value(), Equals(false));
+            AssertThat(tkn.verify("07081804", 1111111109 + 60, 2, 0).value_or(-100), Equals(-2));
+            AssertThat(tkn.verify("07081804", 1111111109 - 30, 1, 0).has_value(), Equals(false));
+            AssertThat(tkn.verify("07081805", 1111111109).has_value(), Equals(false));
+            AssertThat(tkn.verify("7081804", 1111111109).has_value(), Equals(false));
+
+            OTPToken hotp("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 6, 0, 3, OTPToken::HOTP, OTPToken::SHA1);
+            AssertThat(hotp.verify("969429", 0).value_or(-100), Equals(0));
+            AssertThat(hotp.verify("338314", 0).value_or(-100), Equals(1));
+            AssertThat(hotp.verify("359152", 0).value_or(-100), Equals(-1));
+
+            OTPToken steam("", "ABC30WAY33X57CCBU3EAXGDDMX35S39M", OTPToken::Steam);
+            AssertThat(steam.verify("GQTTM", 1536573862).value_or(-100), Equals(0));
+        });
+
+        benchmark_it("[find HOTP counter]", [&]{
+            OTPToken tkn("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 6, 0, 2, OTPToken::HOTP, OTPToken::SHA1);
+            AssertThat(tkn.findHotpCounter("359152", 0).value_or(0), Equals(2));
+            AssertThat(tkn.findHotpCounter("520489", 10).value_or(0), Equals(9));
+            AssertThat(tkn.findHotpCounter("520489", 6).has_value(), Equals(false));
+            AssertThat(tkn.findHotpCounter("755224", 10).has_value(), Equals(false)); // counter 0 is behind
+            AssertThat(tkn.findHotpCounter("52048", 10).has_value(), Equals(false));
+
+            // large resynchronization window, searched in parallel
+            OTPToken drifted("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 8, 0, 25000, OTPToken::HOTP, OTPToken::SHA1);
+            const auto code = drifted.generate();
+            drifted.setCounter(100);
+            const auto counter = drifted.findHotpCounter(code, 50000);
+            AssertThat(counter.value_or(0), Equals(25000));
+            drifted.setCounter(*counter);
+            AssertThat(drifted.generate(), Equals(code));
+
+            OTPToken totp("", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 6, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+            AssertThat(totp.findHotpCounter("755224", 10).has_value(), Equals(false));
+        });
+
         benchmark_it("[remaining validity]", [&]{
             OTPToken tkn("", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1);
             AssertThat(tkn.remainingTokenValidity(), IsLessThanOrEqualTo(31)); // +1 threshold
@@ -0,0 +1,111 @@
+#include <bandit/bandit.h>
+#include <benchmark.hpp>
+
+#include <replaycache.hpp>
+
+#include <thread>
+
+using namespace snowhouse;
+using namespace bandit;
+
+go_bandit([]{
+    describe("replaycache", []{
+        const OTPToken token("test", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+
+        benchmark_it("[mark used]", [&]{
+            ReplayCache cache(1024);
+            AssertThat(cache.capacity(), IsGreaterThanOrEqualTo(1024));
+
+            AssertThat(cache.markUsed(1, 100, 3030, 3000), Equals(true));
+            AssertThat(cache.markUsed(1, 100, 3030, 3010), Equals(false));
+            AssertThat(cache.isUsed(1, 100, 3029), Equals(true));
+            AssertThat(cache.markUsed(1, 101, 3060, 3010), Equals(true));
+            AssertThat(cache.markUsed(2, 100, 3030, 3010), Equals(true));
+
+            // entries expire automatically
+            AssertThat(cache.isUsed(1, 100, 3030), Equals(false));
+            AssertThat(cache.markUsed(1, 100, 3060, 3030), Equals(true));
+
+            cache.clear();
+            AssertThat(cache.isUsed(1, 101, 3010), Equals(false));
+        });
+
+        benchmark_it("[verify]", [&]{
+            ReplayCache cache;
+
+            // 07081804 is the code of the window containing 1111111109
+            AssertThat(cache.verify(token, "07081804", 1111111109).value_or(-100), Equals(0));
+            AssertThat(cache.verify(token, "07081804", 1111111109).has_value(), Equals(false));
+            AssertThat(cache.verify(token, "07081804", 1111111109 + 30).has_value(), Equals(false));
+
+            // a different token with the same code isn't affected
+            const OTPToken other("other", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA1);
+            AssertThat(ReplayCache::identity(other) != ReplayCache::identity(token), Equals(true));
+
+            // so is a token whose codes differ in any other property
+            auto digits = token;
+            digits.setDigits(6);
+            auto period = token;
+            period.setPeriod(60);
+            auto algorithm = token;
+            algorithm.setAlgorithm(OTPToken::SHA256);
+            AssertThat(ReplayCache::identity(digits) != ReplayCache::identity(token), Equals(true));
+            AssertThat(ReplayCache::identity(period) != ReplayCache::identity(token), Equals(true));
+            AssertThat(ReplayCache::identity(algorithm) != ReplayCache::identity(token), Equals(true));
+            AssertThat(cache.verify(other, "07081804", 1111111109 + 30).value_or(-100), Equals(-1));
+        });
+
+        benchmark_it("[bounded]", [&]{
+            ReplayCache cache(ReplayCache::Shards * ReplayCache::Ways);
+            const auto capacity = cache.capacity();
+
+            std::uint64_t accepted = 0;
+            for (std::uint64_t i = 0; i < capacity * 4; ++i)
+            {
+                accepted += cache.markUsed(i, 1, 1000, 0);
+            }
+            AssertThat(cache.capacity(), Equals(capacity));
+            AssertThat(accepted, IsLessThanOrEqualTo(capacity));
+            AssertThat(cache.rejections(), Equals(capacity * 4 - accepted));
+
+            // live entries are never evicted, every accepted code stays a replay
+            for (std::uint64_t i = 0; i < capacity * 4; ++i)
+            {
+                if (cache.isUsed(i, 1, 0))
+                {
+                    AssertThat(cache.markUsed(i, 1, 1000, 0), Equals(false));
+                }
+            }
+            AssertThat(cache.rejections(), Equals(capacity * 4 - accepted));
+
+            // expired entries make room again
+            AssertThat(cache.markUsed(capacity * 4, 1, 2000, 1000), Equals(true));
+        });
+
+        benchmark_it("[concurrent]", [&]{
+            ReplayCache cache(1 << 16);
+            std::atomic<int> accepted = 0;
+
+            // every step must be accepted exactly once across all threads
+            std::vector<std::thread> threads;
+            for (auto t = 0; t < 4; ++t)
+            {
+                threads.emplace_back([&]{
+                    for (std::uint64_t step = 0; step < 10000; ++step)
+                    {
+                        if (cache.markUsed(42, step, 1000, 0))
+                        {
+                            ++accepted;
+                        }
+                    }
+                });
+            }
+            for (auto&& thread : threads)
+            {
+                thread.join();
+            }
+
+            AssertThat(accepted.load(), Equals(10000));
+        });
+    });
+});
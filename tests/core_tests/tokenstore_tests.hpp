@@ -3,6 +3,14 @@
 
 #include <tokenstore.hpp>
 
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
 using namespace snowhouse;
 using namespace bandit;
 
@@ -44,6 +52,209 @@ go_bandit([]{
             AssertThat(tokenStore.size(), Equals(0));
         });
 
+        benchmark_it("[add many]", [&]{
+            std::vector<OTPToken> tokens;
+            for (auto i = 0; i < 1000; ++i)
+            {
+                tokens.emplace_back(OTPToken(std::to_string(i), "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            }
+            tokens.emplace_back(tokens[10]);
+            tokens.emplace_back(OTPToken());
+
+            TokenStore tks;
+            AssertThat(tks.addTokens(tokens), Equals(1000));
+            AssertThat(tks.size(), Equals(1000));
+            AssertThat(tks.addTokens(tokens), Equals(0));
+            AssertThat(tks.size(), Equals(1000));
+
+            AssertThat(tks.contains(tokens[999]), Equals(true));
+            AssertThat(tks.find(tokens[500])->label(), Equals("500"));
+            AssertThat(tks.contains(OTPToken("1000", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1)), Equals(false));
+
+            // token properties matter, not only the label
+            AssertThat(tks.contains(OTPToken("1", "XYZA123456KDDK83E", OTPToken::TOTP, OTPToken::SHA1)), Equals(false));
+        });
+
+        benchmark_it("[remove many]", [&]{
+            TokenStore tks;
+            for (auto i = 0; i < 100; ++i)
+            {
+                tks.addToken(OTPToken(std::to_string(i), "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            }
+
+            // remove every even token, the last token fills each gap
+            for (auto i = 0; i < 100; i += 2)
+            {
+                tks.removeToken(OTPToken(std::to_string(i), "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            }
+            AssertThat(tks.size(), Equals(50));
+
+            for (auto i = 0; i < 100; ++i)
+            {
+                const OTPToken token(std::to_string(i), "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1);
+                AssertThat(tks.contains(token), Equals(i % 2 == 1));
+            }
+
+            // every stored token is still found at its new position
+            for (auto i = 0U; i < tks.size(); ++i)
+            {
+                AssertThat(tks.find(tks[i]), Equals(&tks[i]));
+            }
+
+            tks.clear();
+            AssertThat(tks.contains(OTPToken("1", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1)), Equals(false));
+        });
+
+        benchmark_it("[handles]", [&]{
+            TokenStore tks;
+            std::vector<TokenStore::Handle> handles;
+            for (auto i = 0; i < 10; ++i)
+            {
+                tks.addToken(OTPToken(std::to_string(i), "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+                handles.emplace_back(tks.handle(tks.size() - 1));
+            }
+            AssertThat(tks.handle(10), Equals(TokenStore::InvalidHandle));
+            AssertThat(tks.token(TokenStore::InvalidHandle) == nullptr, Equals(true));
+
+            // handles survive removals which move other tokens around
+            AssertThat(tks.removeToken(handles[3]), Equals(true));
+            AssertThat(tks.removeToken(handles[3]), Equals(false));
+            tks.removeToken(*tks.token(handles[0]));
+            AssertThat(tks.token(handles[0]) == nullptr, Equals(true));
+            AssertThat(tks.token(handles[3]) == nullptr, Equals(true));
+            for (auto i = 0; i < 10; ++i)
+            {
+                if (i != 0 && i != 3)
+                {
+                    AssertThat(tks.token(handles[i])->label(), Equals(std::to_string(i)));
+                    AssertThat(tks[tks.indexOf(handles[i])].label(), Equals(std::to_string(i)));
+                }
+            }
+
+            // reused storage doesn't revive stale handles
+            tks.addToken(OTPToken("new", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            const auto added = tks.handleOf(OTPToken("new", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            AssertThat(tks.token(added)->label(), Equals("new"));
+            AssertThat(added != handles[0] && added != handles[3], Equals(true));
+            AssertThat(tks.token(handles[0]) == nullptr, Equals(true));
+            AssertThat(tks.token(handles[3]) == nullptr, Equals(true));
+
+            tks.clear();
+            AssertThat(tks.token(handles[5]) == nullptr, Equals(true));
+            AssertThat(tks.token(added) == nullptr, Equals(true));
+        });
+
+        benchmark_it("[update]", [&]{
+            TokenStore tks;
+            tks.addToken(OTPToken("hotp", "XYZA123456KDDK83D", 6, 30, 0, OTPToken::HOTP, OTPToken::SHA1));
+            tks.addToken(OTPToken("other", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            const auto handle = tks.handle(0);
+
+            auto updated = *tks.token(handle);
+            updated.setCounter(5);
+            AssertThat(tks.updateToken(handle, updated), Equals(true));
+            AssertThat(tks.token(handle)->counter(), Equals(5));
+            AssertThat(tks.contains(updated), Equals(true));
+            AssertThat(tks.size(), Equals(2));
+
+            // duplicates and invalid tokens are refused
+            AssertThat(tks.updateToken(handle, tks[1]), Equals(false));
+            AssertThat(tks.updateToken(handle, OTPToken()), Equals(false));
+            AssertThat(tks.updateToken(TokenStore::InvalidHandle, updated), Equals(false));
+            AssertThat(tks.findByLabel("hotp")[0], Equals(handle));
+        });
+
+        benchmark_it("[find by label]", [&]{
+            TokenStore tks;
+            for (auto i = 0; i < 100; ++i)
+            {
+                tks.addToken(OTPToken("Account " + std::to_string(i), "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            }
+            tks.addToken(OTPToken("GitHub", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+
+            const auto github = tks.findByLabel("github");
+            AssertThat(github.size(), Equals(1));
+            AssertThat(tks.token(github[0])->label(), Equals("GitHub"));
+
+            AssertThat(tks.findByLabel("account 1", TokenStore::LabelPrefix).size(), Equals(11));
+            AssertThat(tks.findByLabel("NT 5", TokenStore::LabelSubstring).size(), Equals(11));
+            AssertThat(tks.findByLabel("hub", TokenStore::LabelPrefix).size(), Equals(0));
+
+            // kept current on changes
+            tks.removeToken(*tks.token(github[0]));
+            AssertThat(tks.findByLabel("github").size(), Equals(0));
+            AssertThat(tks.findByLabel("account 10", TokenStore::LabelSubstring).size(), Equals(1));
+
+            tks.clear();
+            AssertThat(tks.findByLabel("account", TokenStore::LabelSubstring).size(), Equals(0));
+        });
+
+        benchmark_it("[generate all]", [&]{
+            TokenStore tks;
+            tks.addToken(OTPToken("totp", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            tks.addToken(OTPToken("hotp", "XYZA123456KDDK83D", 6, 0, 12, OTPToken::HOTP, OTPToken::SHA1));
+            tks.addToken(OTPToken("steam", "ABC30WAY33X57CCBU3EAXGDDMX35S39M", OTPToken::Steam));
+            tks.addToken(OTPToken("authy", "XYZA123456KDDK83D28273", 7, 10, 0, OTPToken::TOTP, OTPToken::SHA1));
+            tks.addToken(OTPToken("sha256", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZA", 8, 30, 0, OTPToken::TOTP, OTPToken::SHA256));
+
+            TokenStore::GeneratedCodes codes;
+            tks.generateAll(1536573862, codes);
+            AssertThat(codes.size(), Equals(5));
+
+            for (auto i = 0U; i < tks.size(); ++i)
+            {
+                AssertThat(codes.errors[i], Equals(OTPToken::Valid));
+                AssertThat(std::string(codes.code(i)), Equals(tks[i].generate(1536573862)));
+            }
+
+            AssertThat(codes.code(0), Equals(std::string_view("122810")));
+            AssertThat(codes.code(1), Equals(std::string_view("534003")));
+            AssertThat(codes.code(2), Equals(std::string_view("GQTTM")));
+            AssertThat(codes.code(3), Equals(std::string_view("8578249")));
+        });
+
+        // enough tokens per algorithm to run the vectorized HMAC kernels, RFC 6238 test vectors
+        benchmark_it("[generate all batched]", [&]{
+            TokenStore tks;
+            for (auto i = 0; i < 20; ++i)
+            {
+                tks.addToken(OTPToken("sha1 " + std::to_string(i), "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ",
+                                      8, 30, 0, OTPToken::TOTP, OTPToken::SHA1));
+                tks.addToken(OTPToken("sha256 " + std::to_string(i), "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZA",
+                                      8, 30, 0, OTPToken::TOTP, OTPToken::SHA256));
+                tks.addToken(OTPToken("hotp " + std::to_string(i), "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ",
+                                      6, 0, i % 10, OTPToken::HOTP, OTPToken::SHA1));
+            }
+            AssertThat(tks.size(), Equals(60));
+
+            const std::string hotp[] = {
+                "755224", "287082", "359152", "969429", "338314",
+                "254676", "287922", "162583", "399871", "520489",
+            };
+
+            TokenStore::GeneratedCodes codes;
+            tks.generateAll(1111111109, codes);
+            for (auto i = 0U; i < 20; ++i)
+            {
+                AssertThat(codes.code(i * 3 + 0), Equals(std::string_view("07081804")));
+                AssertThat(codes.code(i * 3 + 1), Equals(std::string_view("68084774")));
+                AssertThat(codes.code(i * 3 + 2), Equals(std::string_view(hotp[i % 10])));
+            }
+        });
+
+        benchmark_it("[generate all 10k]", [&]{
+            TokenStore tks;
+            for (auto i = 0; i < 10000; ++i)
+            {
+                tks.addToken(OTPToken(std::to_string(i), "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            }
+
+            TokenStore::GeneratedCodes codes;
+            tks.generateAll(1536573862, codes);
+            AssertThat(codes.size(), Equals(10000));
+            AssertThat(codes.code(9999), Equals(std::string_view("122810")));
+        });
+
         benchmark_it("[decrypt]", [&]{
             TokenStore tks(test_assets_dir + "/test.tks", "password");
             AssertThat(tks.isValid(), Equals(true));
@@ -52,6 +263,13 @@ go_bandit([]{
             AssertThat(tks[0].secret(), Equals("secret"));
             AssertThat(tks[1].label(), Equals("test2"));
             AssertThat(tks[1].secret(), Equals("secret"));
+            AssertThat(tks.contains(tks[1]), Equals(true));
+            AssertThat(tks.token(tks.handle(1))->label(), Equals("test2"));
+            AssertThat(tks.findByLabel("TEST1")[0], Equals(tks.handle(0)));
+
+            TokenStore wrong(test_assets_dir + "/test.tks", "wrong password");
+            AssertThat(wrong.isValid(), Equals(false));
+            AssertThat(wrong.size(), Equals(0));
         });
 
         benchmark_it("[commit]", [&]{
@@ -67,5 +285,590 @@ go_bandit([]{
             AssertThat(tks2[0].label(), Equals("test3"));
             AssertThat(tks2[0].secret(), Equals("secret"));
         });
+
+        benchmark_it("[commit async]", [&]{
+            const auto file = test_output_dir + "/commit_async_test.tks";
+            std::filesystem::remove(file);
+            std::filesystem::remove(file + ".journal");
+
+            for (auto&& mode : {TokenStore::Snapshot, TokenStore::Journaled})
+            {
+                const auto label = [mode](int i) { return std::to_string(mode) + " " + std::to_string(i); };
+                {
+                    TokenStore tks(file, "password", mode);
+                    std::vector<std::future<TokenStore::ErrorCode>> results;
+                    for (auto i = 0; i < 100; ++i)
+                    {
+                        tks.addToken(OTPToken(label(i), "secret"));
+                        results.emplace_back(tks.commitAsync());
+                    }
+                    tks.flush();
+                    for (auto&& result : results)
+                    {
+                        AssertThat(result.get(), Equals(TokenStore::NoError));
+                    }
+                    AssertThat(std::filesystem::exists(file + ".tmp"), Equals(false));
+
+                    // pending commits are finished on destruction
+                    tks.removeToken(OTPToken(label(0), "secret"));
+                    tks.commitAsync();
+                }
+
+                TokenStore tks(file, "password", mode);
+                AssertThat(tks.isValid(), Equals(true));
+                AssertThat(tks.size(), Equals(99));
+                AssertThat(tks.contains(OTPToken(label(99), "secret")), Equals(true));
+
+                // synchronous commits wait for the background writes
+                tks.clear();
+                tks.commitAsync();
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+        });
+
+#if !defined(_WIN32)
+        // new store files are only readable by their owner
+        benchmark_it("[private file]", [&]{
+            const auto file = test_output_dir + "/private_file_test.tks";
+            std::filesystem::remove(file);
+
+            // a permissive umask mustn't leak into the file permissions
+            const auto mask = ::umask(0);
+            TokenStore tks(file, "password");
+            const auto created = std::filesystem::status(file).permissions();
+            tks.addToken(OTPToken("private", "secret"));
+            const auto result = tks.commit();
+            ::umask(mask);
+
+            const auto shared = std::filesystem::perms::group_all | std::filesystem::perms::others_all;
+            AssertThat(tks.isValid(), Equals(true));
+            AssertThat(result, Equals(TokenStore::NoError));
+            AssertThat((created & shared) == std::filesystem::perms::none, Equals(true));
+            AssertThat((std::filesystem::status(file).permissions() & shared) == std::filesystem::perms::none, Equals(true));
+        });
+#endif
+
+        benchmark_it("[journal]", [&]{
+            const auto file = test_output_dir + "/journal_test.tks";
+            std::filesystem::remove(file);
+            std::filesystem::remove(file + ".journal");
+
+            const OTPToken hotp("hotp", "XYZA123456KDDK83D", 6, 30, 0, OTPToken::HOTP, OTPToken::SHA1);
+            {
+                TokenStore tks(file, "password", TokenStore::Journaled);
+                AssertThat(tks.isValid(), Equals(true));
+                tks.addToken(OTPToken("test1", "secret"));
+                tks.addToken(OTPToken("test2", "secret"));
+                tks.addToken(hotp);
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+
+                // only the journal is written
+                AssertThat(std::filesystem::file_size(file), Equals(0));
+                AssertThat(std::filesystem::exists(tks.journalPath()), Equals(true));
+
+                tks.removeToken(OTPToken("test1", "secret"));
+                auto updated = *tks.find(hotp);
+                updated.setCounter(7);
+                tks.updateToken(tks.handleOf(hotp), updated);
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+
+            const auto check = [&](TokenStore &tks) {
+                AssertThat(tks.isValid(), Equals(true));
+                AssertThat(tks.size(), Equals(2));
+                AssertThat(tks.contains(OTPToken("test1", "secret")), Equals(false));
+                AssertThat(tks.contains(OTPToken("test2", "secret")), Equals(true));
+                AssertThat(tks.token(tks.findByLabel("hotp")[0])->counter(), Equals(7));
+            };
+
+            {
+                TokenStore tks(file, "password", TokenStore::Journaled);
+                check(tks);
+            }
+
+            // the journal is authenticated
+            {
+                TokenStore tks(file, "wrong password", TokenStore::Journaled);
+                AssertThat(tks.state(), Equals(TokenStore::DecryptionError));
+                AssertThat(tks.size(), Equals(0));
+            }
+
+            // a torn record at the end is dropped
+            {
+                std::ofstream journal(file + ".journal", std::ios_base::binary | std::ios_base::app);
+                journal.write("\x40\0\0\0torn", 8);
+            }
+            {
+                TokenStore tks(file, "password", TokenStore::Journaled);
+                check(tks);
+                tks.addToken(OTPToken("test3", "secret"));
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+
+            // a complete record which fails to authenticate isn't torn, the journal is kept as it is
+            {
+                const auto read_journal = [&file]{
+                    std::ifstream stream(file + ".journal", std::ios_base::binary);
+                    return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+                };
+                const auto write_journal = [&file](const std::string &contents){
+                    std::ofstream stream(file + ".journal", std::ios_base::binary | std::ios_base::trunc);
+                    stream.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+                };
+
+                // the tag of the last record, then the first record with records behind it
+                // (68 bytes of header, the record length and the nonce)
+                const auto intact = read_journal();
+                for (const auto position : {intact.size() - 1, std::size_t(68 + 4 + 12)})
+                {
+                    auto tampered = intact;
+                    tampered[position] = static_cast<char>(tampered[position] ^ 1);
+                    write_journal(tampered);
+                    {
+                        TokenStore tks(file, "password", TokenStore::Journaled);
+                        AssertThat(tks.state(), Equals(TokenStore::DecryptionError));
+                        AssertThat(tks.size(), Equals(0));
+                        AssertThat(tks.commit(), Equals(TokenStore::DecryptionError));
+                    }
+                    AssertThat(read_journal() == tampered, Equals(true));
+                }
+                write_journal(intact);
+            }
+            {
+                TokenStore tks(file, "password");
+                AssertThat(tks.size(), Equals(3));
+
+                // snapshot mode folds the journal into the store file
+                tks.removeToken(OTPToken("test3", "secret"));
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+                AssertThat(std::filesystem::exists(tks.journalPath()), Equals(false));
+            }
+
+            // the journal is compacted once it outgrows the store file
+            {
+                TokenStore tks(file, "password", TokenStore::Journaled);
+                check(tks);
+                for (auto i = 0; i < 2000; ++i)
+                {
+                    tks.addToken(OTPToken("token " + std::to_string(i), "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+                }
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+                AssertThat(std::filesystem::exists(tks.journalPath()), Equals(false));
+
+                tks.clear();
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+                AssertThat(std::filesystem::exists(tks.journalPath()), Equals(true));
+            }
+            {
+                TokenStore tks(file, "password");
+                AssertThat(tks.isValid(), Equals(true));
+                AssertThat(tks.size(), Equals(0));
+            }
+        });
+
+        benchmark_it("[lazy icons]", [&]{
+            const auto file = test_output_dir + "/lazy_icons_test.tks";
+            std::filesystem::remove(file);
+
+            const auto icon = [](int i) { return OTPToken::Data(1000 + i, static_cast<char>(i)); };
+            const auto token = [&icon](int i) {
+                OTPToken token("token " + std::to_string(i), "secret");
+                if (i % 2 == 0)
+                {
+                    token.setIcon(icon(i));
+                }
+                return token;
+            };
+            {
+                TokenStore tks(file, "password");
+                for (auto i = 0; i < 10; ++i)
+                {
+                    tks.addToken(token(i));
+                }
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+            {
+                TokenStore tks(file, "password");
+                AssertThat(tks.isValid(), Equals(true));
+                AssertThat(tks.size(), Equals(10));
+
+                // icons are decrypted on first access only
+                AssertThat(tks[0].iconLoaded(), Equals(false));
+                AssertThat(tks[0].iconSize(), Equals(1000));
+                AssertThat(tks[1].iconLoaded(), Equals(true));
+                AssertThat(tks.contains(token(2)), Equals(true));
+                AssertThat(tks[0].icon(), Equals(icon(0)));
+                AssertThat(tks[0].iconLoaded(), Equals(true));
+                AssertThat(tks[4].iconLoaded(), Equals(false));
+
+                // icons which weren't loaded are written as they are
+                tks.removeToken(token(0));
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+
+                tks.prefetchIcons();
+                AssertThat(tks.find(token(4))->iconLoaded(), Equals(true));
+                AssertThat(tks.find(token(4))->icon(), Equals(icon(4)));
+            }
+            {
+                TokenStore tks(file, "password");
+                AssertThat(tks.isValid(), Equals(true));
+                AssertThat(tks.size(), Equals(9));
+                for (auto i = 1; i < 10; ++i)
+                {
+                    AssertThat(tks.find(token(i))->icon(), Equals(i % 2 == 0 ? icon(i) : OTPToken::Data()));
+                }
+            }
+
+            // a tampered icon fails to authenticate and stays empty
+            {
+                std::fstream stream(file, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+                stream.seekp(16 + 12 + 500);
+                stream.put('\xff');
+            }
+            TokenStore tks(file, "password");
+            AssertThat(tks.isValid(), Equals(true));
+            AssertThat(tks.size(), Equals(9));
+            const auto tampered = std::find_if(tks.tokens()->begin(), tks.tokens()->end(), [](const OTPToken &token) { return token.iconSize() > 0; });
+            AssertThat(tampered->icon().empty(), Equals(true));
+        });
+
+        benchmark_it("[shared icons]", [&]{
+            const auto file = test_output_dir + "/shared_icons_test.tks";
+            std::filesystem::remove(file);
+
+            const OTPToken::Data shared(4096, 'S');
+            {
+                TokenStore tks(file, "password");
+                for (auto i = 0; i < 20; ++i)
+                {
+                    OTPToken token("shared " + std::to_string(i), "secret");
+                    token.setIcon(shared);
+                    tks.addToken(token);
+                }
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+
+            // the icon is written once
+            AssertThat(std::filesystem::file_size(file) < 2 * shared.size(), Equals(true));
+
+            TokenStore tks(file, "password");
+            AssertThat(tks.isValid(), Equals(true));
+            AssertThat(tks.size(), Equals(20));
+            AssertThat(tks[0].iconLoaded(), Equals(false));
+            AssertThat(tks[19].iconId(), Equals(tks[0].iconId()));
+
+            // loading the icon of one token loads it for all of them
+            AssertThat(tks[0].icon(), Equals(shared));
+            AssertThat(tks[19].iconLoaded(), Equals(true));
+
+            // tokens with the same icon from elsewhere share it as well
+            OTPToken token("shared 3", "secret");
+            token.setIcon(shared);
+            AssertThat(token.iconId(), Equals(tks[0].iconId()));
+            AssertThat(tks.contains(token), Equals(true));
+        });
+
+        benchmark_it("[streaming]", [&]{
+            const auto file = test_output_dir + "/streaming_test.tks";
+            std::filesystem::remove(file);
+
+            // spans several cipher chunks
+            const std::size_t count = 5000;
+            std::vector<std::size_t> progress;
+            const auto record = [&progress](std::size_t done, std::size_t total) {
+                AssertThat(total, Equals(5000));
+                progress.emplace_back(done);
+            };
+            {
+                TokenStore tks(file, "password", TokenStore::Snapshot, record);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    tks.addToken(OTPToken("token " + std::to_string(i), "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+                }
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+                AssertThat(progress.size(), Equals(count));
+                AssertThat(progress.back(), Equals(count));
+                AssertThat(std::filesystem::file_size(file) > 64 * 1024, Equals(true));
+            }
+
+            progress.clear();
+            TokenStore tks(file, "password", TokenStore::Snapshot, record);
+            AssertThat(tks.isValid(), Equals(true));
+            AssertThat(tks.size(), Equals(count));
+            AssertThat(tks[4999].label(), Equals("token 4999"));
+            AssertThat(tks[4999].secret(), Equals("XYZA123456KDDK83D"));
+            AssertThat(progress.size(), Equals(count));
+            AssertThat(progress.front(), Equals(1));
+            AssertThat(progress.back(), Equals(count));
+
+            tks.setProgressCallback({});
+            tks.removeToken(OTPToken("token 0", "XYZA123456KDDK83D", OTPToken::TOTP, OTPToken::SHA1));
+            AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            AssertThat(progress.size(), Equals(count));
+
+            TokenStore wrong(file, "wrong password");
+            AssertThat(wrong.isValid(), Equals(false));
+            AssertThat(wrong.size(), Equals(0));
+
+            // a truncated file is rejected
+            std::filesystem::resize_file(file, std::filesystem::file_size(file) - 16);
+            TokenStore truncated(file, "password");
+            AssertThat(truncated.isValid(), Equals(false));
+            AssertThat(truncated.size(), Equals(0));
+        });
+
+        benchmark_it("[sealed records]", [&]{
+            const auto file = test_output_dir + "/sealed_records_test.tks";
+            std::filesystem::remove(file);
+
+            const auto read_file = [&file]{
+                std::ifstream stream(file, std::ios_base::binary);
+                return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+            };
+
+            // enough records to be opened in parallel
+            const std::size_t count = 3000;
+            {
+                TokenStore tks(file, "password");
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    tks.addToken(OTPToken("token " + std::to_string(i), "secret", OTPToken::HOTP, OTPToken::SHA1));
+                }
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+            const auto before = read_file();
+
+            std::vector<std::size_t> progress;
+            {
+                TokenStore tks(file, "password", TokenStore::Snapshot, [&progress](std::size_t done, std::size_t) {
+                    progress.emplace_back(done);
+                });
+                AssertThat(tks.isValid(), Equals(true));
+                AssertThat(tks.size(), Equals(count));
+                AssertThat(tks[2999].label(), Equals("token 2999"));
+
+                // the progress is reported in store order
+                AssertThat(progress.size(), Equals(count));
+                AssertThat(std::is_sorted(progress.begin(), progress.end()), Equals(true));
+                AssertThat(progress.back(), Equals(count));
+
+                auto token = tks[2999];
+                token.setCounter(42);
+                AssertThat(tks.updateToken(tks.handle(2999), token), Equals(true));
+                tks.setProgressCallback({});
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+            const auto after = read_file();
+
+            // only the changed record is sealed again
+            AssertThat(after.size(), Equals(before.size()));
+            AssertThat(after.compare(0, 16 + 1000, before, 0, 16 + 1000), Equals(0));
+            AssertThat(after == before, Equals(false));
+            {
+                TokenStore tks(file, "password");
+                AssertThat(tks.isValid(), Equals(true));
+                AssertThat(tks[2999].counter(), Equals(42));
+                AssertThat(tks[0].label(), Equals("token 0"));
+            }
+
+            TokenStore wrong(file, "wrong password");
+            AssertThat(wrong.state(), Equals(TokenStore::DecryptionError));
+
+            // a tampered record fails to authenticate
+            {
+                std::fstream stream(file, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+                stream.seekp(static_cast<std::streamoff>(after.size() / 2));
+                stream.put(static_cast<char>(after[after.size() / 2] ^ 1));
+            }
+            TokenStore tampered(file, "password");
+            AssertThat(tampered.state(), Equals(TokenStore::DecryptionError));
+            AssertThat(tampered.size(), Equals(0));
+        });
+
+        benchmark_it("[parallel snapshots]", [&]{
+            const auto file = test_output_dir + "/parallel_snapshots_test.tks";
+            std::filesystem::remove(file);
+
+            // enough icons and records for several segments
+            const std::size_t count = 3000;
+            const std::size_t icons = 64;
+            const auto icon = [](std::size_t i) {
+                return OTPToken::Data(8 * 1024, static_cast<std::uint8_t>(i));
+            };
+
+            std::vector<std::size_t> progress;
+            {
+                TokenStore tks(file, "password", TokenStore::Snapshot, [&progress](std::size_t done, std::size_t) {
+                    progress.emplace_back(done);
+                }, 4);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    OTPToken token("token " + std::to_string(i), "secret", OTPToken::HOTP, OTPToken::SHA1);
+                    token.setIcon(icon(i % icons));
+                    tks.addToken(token);
+                }
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+
+            // the progress of committing is reported in store order
+            AssertThat(progress.size(), Equals(count));
+            AssertThat(std::is_sorted(progress.begin(), progress.end()), Equals(true));
+            AssertThat(progress.back(), Equals(count));
+
+            // stores written on several threads load on a single one and the other way round
+            {
+                TokenStore tks(file, "password", TokenStore::Snapshot, {}, 1);
+                AssertThat(tks.isValid(), Equals(true));
+                AssertThat(tks.size(), Equals(count));
+                AssertThat(tks[1234].label(), Equals("token 1234"));
+                AssertThat(tks[1234].icon() == icon(1234 % icons), Equals(true));
+
+                auto token = tks[0];
+                token.setLabel("changed");
+                AssertThat(tks.updateToken(tks.handle(0), token), Equals(true));
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+            {
+                TokenStore tks(file, "password", TokenStore::Snapshot, {}, 4);
+                AssertThat(tks.isValid(), Equals(true));
+                AssertThat(tks.size(), Equals(count));
+                AssertThat(tks[0].label(), Equals("changed"));
+
+                tks.prefetchIcons();
+                for (std::size_t i = 0; i < count; i += 97)
+                {
+                    AssertThat(tks[i].icon() == icon(i % icons), Equals(true));
+                }
+            }
+        });
+
+        // every snapshot continues from the file written by the previous one
+        benchmark_it("[consecutive snapshots]", [&]{
+            const auto file = test_output_dir + "/consecutive_snapshots_test.tks";
+            std::filesystem::remove(file);
+
+            const auto read_file = [&file]{
+                std::ifstream stream(file, std::ios_base::binary);
+                return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+            };
+            const auto update = [](TokenStore &tks, std::size_t index, const std::string &label) {
+                auto token = tks[index];
+                token.setLabel(label);
+                return tks.updateToken(tks.handle(index), token);
+            };
+
+            const std::size_t count = 300;
+            const OTPToken::Data icon(4096, 7);
+            {
+                TokenStore tks(file, "password");
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    OTPToken token("token " + std::to_string(i), "secret", OTPToken::HOTP, OTPToken::SHA1);
+                    if (i % 2 == 0)
+                    {
+                        token.setIcon(icon);
+                    }
+                    tks.addToken(token);
+                }
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+
+                AssertThat(update(tks, count - 1, "first edit"), Equals(true));
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+                const auto first = read_file();
+
+                // unchanged records are copied from the previous snapshot, they follow
+                // the header and the sealed icon
+                AssertThat(update(tks, count - 1, "second edit"), Equals(true));
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+                const auto second = read_file();
+                const auto records = 16 + icon.size() + 28;
+                AssertThat(second.size(), Equals(first.size() + 1));
+                AssertThat(second.compare(records, second.size() / 2, first, records, second.size() / 2), Equals(0));
+
+                // background snapshots are adopted as well, also with edits in between
+                AssertThat(update(tks, 0, "async edit"), Equals(true));
+                auto result = tks.commitAsync();
+                AssertThat(update(tks, 1, "edit while writing"), Equals(true));
+                tks.removeToken(tks.handle(2));
+                AssertThat(result.get(), Equals(TokenStore::NoError));
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+
+            TokenStore tks(file, "password");
+            AssertThat(tks.isValid(), Equals(true));
+            AssertThat(tks.size(), Equals(count - 1));
+            AssertThat(tks.findByLabel("second edit").size(), Equals(1));
+            AssertThat(tks.findByLabel("first edit").size(), Equals(0));
+            AssertThat(tks.findByLabel("async edit").size(), Equals(1));
+            AssertThat(tks.findByLabel("edit while writing").size(), Equals(1));
+            AssertThat(tks.findByLabel("token 2").size(), Equals(0));
+
+            // every even token but the removed one has the icon
+            std::size_t withIcon = 0;
+            for (std::size_t i = 0; i < tks.size(); ++i)
+            {
+                if (!tks[i].icon().empty())
+                {
+                    AssertThat(tks[i].icon() == icon, Equals(true));
+                    ++withIcon;
+                }
+            }
+            AssertThat(withIcon, Equals(count / 2 - 1));
+        });
+
+        benchmark_it("[thumbnails]", [&]{
+            const auto file = test_output_dir + "/thumbnails_test.tks";
+            std::filesystem::remove(file);
+
+            std::ifstream image(test_assets_dir + "/qrcode.png", std::ios_base::binary);
+            const OTPToken::Data icon((std::istreambuf_iterator<char>(image)), std::istreambuf_iterator<char>());
+            AssertThat(icon.empty(), Equals(false));
+
+            const auto thumbnail_support = Thumbnail::supported();
+            {
+                TokenStore tks(file, "password");
+                OTPToken token("with icon", "secret");
+                token.setIcon(icon);
+                tks.addToken(token);
+                tks.addToken(OTPToken("without icon", "secret"));
+                AssertThat(tks.thumbnail(tks.handle(1), 30) == nullptr, Equals(true));
+
+                const auto small = tks.thumbnail(tks.handle(0), 30);
+                AssertThat(small != nullptr, Equals(thumbnail_support));
+                if (thumbnail_support)
+                {
+                    AssertThat(std::max(small->width(), small->height()), Equals(30));
+                    AssertThat(small->pixels().size(), Equals(small->width() * small->height() * 4u));
+                    AssertThat(tks.thumbnail(tks.handle(0), 30), Equals(small));
+                    AssertThat(tks.thumbnail(tks.handle(0), 68)->height(), Equals(68));
+                }
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+            {
+                // stored thumbnails don't need the icon
+                TokenStore tks(file, "password");
+                AssertThat(tks.isValid(), Equals(true));
+                AssertThat(tks.size(), Equals(2));
+                const auto small = tks.thumbnail(tks.handle(0), 30);
+                AssertThat(small != nullptr, Equals(thumbnail_support));
+                AssertThat(tks[0].iconLoaded(), Equals(false));
+
+                // unloaded thumbnails are copied into the next snapshot
+                tks.removeToken(tks.handle(1));
+                AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            }
+
+            TokenStore tks(file, "password");
+            AssertThat(tks.isValid(), Equals(true));
+            AssertThat(tks.size(), Equals(1));
+            AssertThat(tks.thumbnail(tks.handle(0), 68) != nullptr, Equals(thumbnail_support));
+            AssertThat(tks[0].iconLoaded(), Equals(false));
+            AssertThat(tks[0].icon(), Equals(icon));
+
+            // thumbnails of removed icons are dropped
+            tks.removeToken(tks.handle(0));
+            AssertThat(tks.commit(), Equals(TokenStore::NoError));
+            AssertThat(std::filesystem::file_size(file) < icon.size(), Equals(true));
+        });
     });
 });
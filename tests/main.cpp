@@ -4,8 +4,12 @@
 #include <bandit/bandit.h>
 #include <fmt/printf.h>
 
+#include "core_tests/clock_tests.hpp"
 #include "core_tests/otptoken_tests.hpp"
+#include "core_tests/labelindex_tests.hpp"
 #include "core_tests/tokenstore_tests.hpp"
+#include "core_tests/codeschedule_tests.hpp"
+#include "core_tests/replaycache_tests.hpp"
 #include "core_tests/qr_tests.hpp"
 
 bool check_has_info_reporter(const std::vector<const char*> &args)